@@ -31,6 +31,38 @@
 #define AARUREMOTE_NAME "Aaru Remote Server"
 #define AARUREMOTE_VERSION "0.99.195"
 #define AARUREMOTE_PORT 6666
+#define AARUREMOTE_LISTEN_BACKLOG 16
+#define AARUREMOTE_POLL_WORKERS 4
+#define AARUREMOTE_POLL_IN (1 << 0)
+#define AARUREMOTE_POLL_OUT (1 << 1)
+#define AARUREMOTE_RESUME_GRACE 30
+#if defined(_WIN32) || defined(GEKKO)
+#define AARUREMOTE_LOCAL_SOCKET ""
+#else
+#define AARUREMOTE_LOCAL_SOCKET "/tmp/aaruremote.sock"
+#endif
+#define AARUREMOTE_SHM_HEADER_SIZE 4096
+#define AARUREMOTE_SHM_DEFAULT_SIZE (16 * 1024 * 1024)
+#define AARUREMOTE_SHM_MAX_SIZE (256 * 1024 * 1024)
+#define AARUREMOTE_RX_BUFFER_SIZE 65536
+#define AARUREMOTE_MAX_PACKET_SIZE (32 * 1024 * 1024)
+#define AARUREMOTE_STREAM_CHUNK_SIZE (256 * 1024)
+#define AARUREMOTE_ARENA_MAX_SIZE (1024 * 1024)
+#define AARUREMOTE_SENSE_BUFFER_SIZE 32
+#define AARUREMOTE_NET_IOV_BATCH 16
+#define AARUREMOTE_OSREAD_IOV_BATCH 64
+#define AARUREMOTE_LZ_HASH_BITS 12
+#define AARUREMOTE_COMPRESSION_THRESHOLD 4096
+#define AARUREMOTE_LZ_BUFFER_SIZE (AARUREMOTE_STREAM_CHUNK_SIZE + 4096)
+#define AARUREMOTE_SPARSE_BLOCK_SIZE 512
+#define AARUREMOTE_SPARSE_THRESHOLD 4096
+#define AARUREMOTE_PIPELINE_DEPTH 32
+#define AARUREMOTE_MAX_DEVICE_HANDLES 16
+#define AARUREMOTE_SCSI_CACHE_SIZE (8 * 1024 * 1024)
+#define AARUREMOTE_SCSI_PREFETCH_READS 2
+#define AARUREMOTE_READ_AHEAD_MAX_DEPTH 4
+#define AARUREMOTE_READ_AHEAD_MAX_SIZE (4 * 1024 * 1024)
+#define AARUREMOTE_DMA_ALIGNMENT 4096
 #define AARUREMOTE_REMOTE_ID 0x52434944 // "DICR"
 #define AARUREMOTE_PACKET_ID 0x544B4350 // "PCKT"
 #define AARUREMOTE_PACKET_VERSION 1
@@ -67,7 +99,55 @@
 #define AARUREMOTE_PACKET_TYPE_COMMAND_REOPEN 30
 #define AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD 31
 #define AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD 32
-#define AARUREMOTE_PROTOCOL_MAX 2
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_COMPRESSED 33
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_SPARSE 34
+#define AARUREMOTE_PACKET_TYPE_CAPABILITIES 35
+#define AARUREMOTE_PACKET_TYPE_COMMAND_RESUME 36
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD_CHUNK 37
+#define AARUREMOTE_PACKET_TYPE_COMMAND_SHM_SETUP 38
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_SHM_SETUP 39
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD_SHM 40
+#define AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_SCSI 41
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_MULTI_SCSI 42
+#define AARUREMOTE_PACKET_TYPE_COMMAND_SCSI_READ_STREAM 43
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI_READ_CHUNK 44
+#define AARUREMOTE_PACKET_TYPE_COMMAND_SCSI_RECOVER 45
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI_RECOVER 46
+#define AARUREMOTE_PACKET_TYPE_COMMAND_HASH 47
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_HASH 48
+#define AARUREMOTE_PACKET_TYPE_COMMAND_DEVICE 49
+#define AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_OSREAD 50
+#define AARUREMOTE_PACKET_TYPE_RESPONSE_MULTI_OSREAD 51
+#define AARUREMOTE_PROTOCOL_MAX 5
+#define AARUREMOTE_PROTOCOL_TAGS 3
+#define AARUREMOTE_PROTOCOL_FLAGS 3
+#define AARUREMOTE_PROTOCOL_CAPABILITIES 4
+#define AARUREMOTE_PROTOCOL_STREAM 5
+#define AARUREMOTE_HELLO_FLAG_COMPRESSION (1 << 0)
+#define AARUREMOTE_HELLO_FLAG_SPARSE (1 << 1)
+#define AARUREMOTE_HELLO_FLAG_SCSI_CACHE (1 << 2)
+#define AARUREMOTE_CAPABILITY_MAX_TRANSFER 1
+#define AARUREMOTE_CAPABILITY_PIPELINE_DEPTH 2
+#define AARUREMOTE_CAPABILITY_BATCH_PACKETS 3
+#define AARUREMOTE_CAPABILITY_COMPRESSION 4
+#define AARUREMOTE_CAPABILITY_PROCESSORS 5
+#define AARUREMOTE_CAPABILITY_ZERO_COPY 6
+#define AARUREMOTE_CAPABILITY_RESUME 7
+#define AARUREMOTE_CAPABILITY_MAX_PACKET 8
+#define AARUREMOTE_CAPABILITY_DEVICE_HANDLES 9
+#define AARUREMOTE_COMPRESSION_LZ4 1
+#define AARUREMOTE_ZERO_COPY_OSREAD (1 << 0)
+#define AARUREMOTE_ZERO_COPY_SHM (1 << 1)
+#define AARUREMOTE_MULTI_SCSI_FLAG_STOP_ON_ERROR (1 << 0)
+#define AARUREMOTE_SCSI_READ_STREAM_FLAG_STOP_ON_ERROR (1 << 0)
+#define AARUREMOTE_HASH_CRC32 (1 << 0)
+#define AARUREMOTE_HASH_CRC64 (1 << 1)
+#define AARUREMOTE_HASH_MD5 (1 << 2)
+#define AARUREMOTE_HASH_SHA1 (1 << 3)
+#define AARUREMOTE_HASH_SHA256 (1 << 4)
+#define AARUREMOTE_HASH_SOURCE_OS 0
+#define AARUREMOTE_HASH_SOURCE_SCSI 1
+#define AARUREMOTE_HASH_FLAG_VERIFY_ONLY (1 << 0)
 #define AARUREMOTE_PACKET_NOP_REASON_OOO 0
 #define AARUREMOTE_PACKET_NOP_REASON_NOT_IMPLEMENTED 1
 #define AARUREMOTE_PACKET_NOP_REASON_NOT_RECOGNIZED 2
@@ -76,6 +156,11 @@
 #define AARUREMOTE_PACKET_NOP_REASON_OPEN_ERROR 5
 #define AARUREMOTE_PACKET_NOP_REASON_REOPEN_OK 6
 #define AARUREMOTE_PACKET_NOP_REASON_CLOSE_ERROR 5
+#define AARUREMOTE_PACKET_NOP_REASON_RESUME_OK 7
+#define AARUREMOTE_PACKET_NOP_REASON_RESUME_ERROR 8
+#define AARUREMOTE_PACKET_NOP_REASON_TOO_LARGE 9
+#define AARUREMOTE_PACKET_NOP_REASON_SHM_ERROR 10
+#define AARUREMOTE_PACKET_NOP_REASON_INVALID_ARGUMENT 11
 #define AARUREMOTE_DEVICE_TYPE_UNKNOWN -1
 #define AARUREMOTE_DEVICE_TYPE_ATA 1
 #define AARUREMOTE_DEVICE_TYPE_ATAPI 2
@@ -152,7 +237,7 @@ typedef struct
     uint32_t len;
     uint8_t  version;
     int8_t   packet_type;
-    char     spare[2];
+    uint16_t tag;
 } AaruPacketHeader;
 
 typedef struct
@@ -161,7 +246,8 @@ typedef struct
     char             application[128];
     char             version[64];
     uint8_t          max_protocol;
-    char             spare[3];
+    uint8_t          flags;
+    char             spare[2];
     char             sysname[256];
     char             release[256];
     char             machine[256];
@@ -508,6 +594,178 @@ typedef struct
     AaruResSdhci     responses[0];
 } AaruPacketMultiResSdhci;
 
+typedef struct
+{
+    uint32_t cdb_len;
+    uint32_t buf_len;
+    int32_t  direction;
+    uint32_t timeout;
+} AaruCmdScsi;
+
+// Each command's CDB and then its buffer follow the array, in order
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         cmd_count;
+    uint32_t         flags;
+    AaruCmdScsi      commands[0];
+} AaruPacketMultiCmdScsi;
+
+typedef struct
+{
+    uint32_t sense_len;
+    uint32_t buf_len;
+    uint32_t duration;
+    uint32_t sense;
+    uint32_t error_no;
+} AaruResScsi;
+
+// Only the commands that ran are answered, each one's sense and then its buffer follow the array, in order
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         cmd_count;
+    uint32_t         reserved;
+    AaruResScsi      responses[0];
+} AaruPacketMultiResScsi;
+
+// READ(10), READ(12) or READ(16) over a range of blocks, answered with a stream of chunks
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         lba;
+    uint32_t         blocks;
+    uint32_t         block_size;
+    uint32_t         chunk_blocks;
+    uint32_t         timeout;
+    uint8_t          opcode;
+    uint8_t          flags;
+    char             spare[6];
+} AaruPacketCmdScsiReadStream;
+
+// Sense data, and then the data when the read succeeded, follow the header
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         lba;
+    uint32_t         blocks;
+    uint32_t         buf_len;
+    uint32_t         sense_len;
+    uint32_t         duration;
+    uint32_t         sense;
+    uint32_t         error_no;
+    uint8_t          last;
+    char             spare[7];
+} AaruPacketResScsiReadChunk;
+
+// Reads a range that failed, splitting it in halves until the unreadable blocks are found
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         lba;
+    uint32_t         blocks;
+    uint32_t         block_size;
+    uint32_t         timeout;
+    uint32_t         retries;
+    uint32_t         min_split;
+    uint8_t          opcodes[4];
+} AaruPacketCmdScsiRecover;
+
+typedef struct
+{
+    uint64_t lba;
+    uint32_t blocks;
+    uint32_t error_no;
+    uint32_t sense;
+    uint32_t sense_len;
+    char     sense_data[AARUREMOTE_SENSE_BUFFER_SIZE];
+} AaruScsiBadRange;
+
+// The unreadable ranges, and then the data of the whole range with them zeroed, follow the header
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         lba;
+    uint32_t         blocks;
+    uint32_t         block_size;
+    uint32_t         bad_count;
+    uint32_t         commands;
+    uint32_t         duration;
+    uint32_t         spare;
+} AaruPacketResScsiRecover;
+
+// Hashes a range read with OsRead, or with SCSI reads in blocks. The data comes first as a stream of chunks, unless
+// only the digests are wanted.
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         offset;
+    uint64_t         length;
+    uint32_t         block_size;
+    uint32_t         timeout;
+    uint8_t          source;
+    uint8_t          opcode;
+    uint8_t          algorithms;
+    uint8_t          flags;
+    char             spare[4];
+} AaruPacketCmdHash;
+
+// Followed by a complete packet for the device behind the handle
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         handle;
+    uint32_t         spare;
+} AaruPacketCmdDevice;
+
+// Digests cover the data read up to the first error
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         length;
+    uint32_t         error_no;
+    uint32_t         sense;
+    uint32_t         duration;
+    uint8_t          algorithms;
+    char             spare[3];
+    uint32_t         crc32;
+    uint64_t         crc64;
+    uint8_t          md5[16];
+    uint8_t          sha1[20];
+    uint8_t          sha256[32];
+} AaruPacketResHash;
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+} AaruOsReadExtent;
+
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         extent_count;
+    uint32_t         reserved;
+    AaruOsReadExtent extents[0];
+} AaruPacketMultiCmdOsRead;
+
+// Length is what could be read, the data is always as long as asked for and zero filled past that
+typedef struct
+{
+    int32_t  error_no;
+    uint32_t length;
+} AaruResOsRead;
+
+// Extents are read in offset order but answered in the order they were asked for, their data following the array
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         extent_count;
+    uint32_t         reserved;
+    AaruResOsRead    responses[0];
+} AaruPacketMultiResOsRead;
+
 typedef struct
 {
     AaruPacketHeader hdr;
@@ -520,6 +778,12 @@ typedef struct
     uint32_t         length;
 } AaruPacketCmdOsRead;
 
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         token;
+} AaruPacketCmdResume;
+
 typedef struct
 {
     AaruPacketHeader hdr;
@@ -527,6 +791,96 @@ typedef struct
     uint32_t         duration;
 } AaruPacketResOsRead;
 
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint64_t         offset;
+    uint32_t         length;
+    int32_t          error_no;
+    uint32_t         duration;
+    uint8_t          last;
+    char             spare[3];
+} AaruPacketResOsReadChunk;
+
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         size;
+} AaruPacketCmdShmSetup;
+
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         size;
+    uint32_t         data_offset;
+} AaruPacketResShmSetup;
+
+typedef struct
+{
+    AaruPacketHeader hdr;
+    int32_t          error_no;
+    uint32_t         duration;
+    uint64_t         position;
+    uint32_t         length;
+} AaruPacketResOsReadShm;
+
+typedef struct
+{
+    uint64_t head;
+    uint64_t tail;
+} AaruShmRing;
+
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         raw_len;
+} AaruPacketResCompressed;
+
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         raw_len;
+    uint32_t         prefix_len;
+    uint32_t         block_size;
+    uint32_t         block_count;
+} AaruPacketResSparse;
+
+typedef struct
+{
+    AaruPacketHeader hdr;
+    uint32_t         count;
+} AaruPacketCapabilities;
+
+typedef struct
+{
+    uint16_t type;
+    uint16_t len;
+} AaruCapability;
+
+typedef struct
+{
+    int32_t  device_type;
+    uint32_t max_transfer;
+} AaruCapabilityMaxTransfer;
+
+typedef struct
+{
+    uint32_t paths;
+    uint32_t max_length;
+} AaruCapabilityZeroCopy;
+
+typedef struct
+{
+    uint64_t token;
+    uint32_t grace;
+} AaruCapabilityResume;
+
+typedef struct
+{
+    uint32_t max_packet;
+    uint32_t chunk_size;
+} AaruCapabilityMaxPacket;
+
 #pragma pack(pop)
 
 typedef struct
@@ -543,6 +897,147 @@ typedef struct
     uint8_t  write;
 } MmcSingleCommand;
 
+typedef struct
+{
+    const void* buf;
+    int32_t     len;
+} NetIoVec;
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t index;
+    char*    buffer;
+    uint32_t read;
+    int32_t  error_no;
+} OsReadExtent;
+
+typedef struct
+{
+    void*            net_ctx;
+    void*            poll_ctx;
+    AaruPacketHello* pkt_server_hello;
+    uint8_t          local;
+} ListenerContext;
+
+typedef struct OrphanSession
+{
+    struct OrphanSession* next;
+    uint64_t              token;
+    void*                 device_ctx;
+    uint32_t              remaining;
+} OrphanSession;
+
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t  block[64];
+} DigestContext;
+
+typedef struct
+{
+    uint8_t       algorithms;
+    uint32_t      crc32;
+    uint64_t      crc64;
+    DigestContext md5;
+    DigestContext sha1;
+    DigestContext sha256;
+} HashContext;
+
+// Scratch memory that lives for a single packet, so handlers do not go to the heap for every command
+typedef struct
+{
+    char*    buf;
+    uint32_t size;
+    uint32_t used;
+    uint32_t wanted;
+    void*    spills;
+    uint64_t mallocs;
+} Arena;
+
+// Followed by the packet itself
+typedef struct DevicePacket
+{
+    struct DevicePacket* next;
+    uint32_t             len;
+} DevicePacket;
+
+// Packets sent to a device handle, run in order by the handle's own thread
+typedef struct
+{
+    void*         mutex;
+    void*         ready;
+    void*         stopped;
+    DevicePacket* head;
+    DevicePacket* tail;
+    uint32_t      count;
+    uint8_t       failed;
+} DeviceQueue;
+
+typedef struct ClientContext
+{
+    void*                  net_ctx;
+    void*                  poll_ctx;
+    uint32_t               poll_events;
+    struct ClientContext*  next_ready;
+    void*                  device_ctx;
+    AaruPacketHello*       pkt_server_hello;
+    AaruPacketNop*         pkt_nop;
+    uint8_t                hello_received;
+    uint8_t                protocol;
+    uint16_t               tag;
+    uint64_t               token;
+    char                   address[64];
+    char*                  rx_buf;
+    uint32_t               rx_size;
+    uint32_t               rx_len;
+    uint32_t               rx_off;
+    uint32_t               rx_discard;
+    char*                  stream_buf;
+    uint8_t                local;
+    AaruShmRing*           shm;
+    uint32_t               shm_size;
+    int32_t                shm_fd;
+    uint64_t               shm_head;
+    uint64_t               shm_bytes;
+    uint64_t               packets;
+    uint64_t               recv_calls;
+    Arena                  arena;
+    uint8_t                compress;
+    uint32_t*              lz_table;
+    char*                  lz_in;
+    char*                  lz_out;
+    uint32_t               lz_size;
+    uint64_t               raw_bytes;
+    uint64_t               compressed_in_bytes;
+    uint64_t               compressed_out_bytes;
+    uint8_t                sparse;
+    AaruPacketResSparse*   pkt_res_sparse;
+    uint8_t*               sparse_map;
+    uint32_t               sparse_map_size;
+    NetIoVec*              sparse_iov;
+    uint32_t               sparse_iov_size;
+    uint64_t               sparse_bytes;
+    void*                  send_mutex;
+    struct ClientContext** handles;
+    DeviceQueue*           queue;
+    uint8_t                scsi_cache_enabled;
+    void*                  scsi_cache;
+    uint64_t               scsi_cache_hits;
+    uint64_t               scsi_cache_misses;
+    uint64_t               scsi_cache_prefetched;
+    void*                  read_ahead;
+    uint64_t               read_ahead_hits;
+    uint64_t               read_ahead_misses;
+    uint64_t               read_ahead_stalls;
+    char*                  dma_buf;
+    uint32_t               dma_size;
+    uint64_t               scsi_transfers;
+    uint64_t               scsi_direct_transfers;
+} ClientContext;
+
 DeviceInfoList*  ListDevices();
 void             FreeDeviceInfoList(DeviceInfoList* start);
 uint16_t         DeviceInfoListCount(DeviceInfoList* start);
@@ -552,7 +1047,7 @@ int32_t          GetDeviceType(void* device_ctx);
 int32_t          SendScsiCommand(void*     device_ctx,
                                  char*     cdb,
                                  char*     buffer,
-                                 char**    sense_buffer,
+                                 char*     sense_buffer,
                                  uint32_t  timeout,
                                  int32_t   direction,
                                  uint32_t* duration,
@@ -562,6 +1057,9 @@ int32_t          SendScsiCommand(void*     device_ctx,
                                  uint32_t* sense_len);
 int              Hexchr2Bin(const char hex, char* out);
 size_t           Hexs2Bin(const char* hex, unsigned char** out);
+int32_t          LzCompress(const uint8_t* in, int32_t in_len, uint8_t* out, int32_t out_len, uint32_t* table);
+int32_t          LzDecompress(const uint8_t* in, int32_t in_len, uint8_t* out, int32_t out_len);
+uint32_t         ZeroBlocks(const uint8_t* buf, uint32_t len, uint32_t block_size, uint8_t* map);
 int32_t          GetSdhciRegisters(void*     device_ctx,
                                    char**    csd,
                                    char**    cid,
@@ -639,6 +1137,28 @@ int32_t          SendMultiSdhciCommand(void*            device_ctx,
                                        uint32_t*        duration,
                                        uint32_t*        sense);
 int32_t          OsRead(void* device_ctx, char* buffer, uint64_t offset, uint32_t length, uint32_t* duration);
+int32_t          OsReadToNet(void*                device_ctx,
+                             void*                net_ctx,
+                             AaruPacketResOsRead* pkt_res,
+                             uint64_t             offset,
+                             uint32_t             length);
+uint32_t         OsReadToNetMaximum();
+int32_t          OsReadv(void* device_ctx, OsReadExtent* extents, uint32_t count);
+uint64_t         OsGetSize(void* device_ctx);
+uint32_t         GetMaxTransfer(int32_t device_type);
+void             ScsiDirectStats(void* device_ctx, uint64_t* transfers, uint64_t* direct);
+uint32_t         GetProcessorCount();
+void*            MutexCreate();
+void             MutexLock(void* mutex);
+void             MutexUnlock(void* mutex);
+void             MutexFree(void* mutex);
+void*            SemaphoreCreate(uint32_t count);
+void             SemaphorePost(void* semaphore);
+void             SemaphoreWait(void* semaphore);
+void             SemaphoreFree(void* semaphore);
+void             SleepSeconds(uint32_t seconds);
+int32_t          GetRandomBytes(void* buf, uint32_t len);
+uint64_t         GetMicroseconds();
 AaruPacketHello* GetHello();
 int              PrintNetworkAddresses();
 char*            PrintIpv4Address(struct in_addr addr);
@@ -646,12 +1166,89 @@ void*            NetSocket(uint32_t domain, uint32_t type, uint32_t protocol);
 int32_t          NetBind(void* net_ctx, struct sockaddr* addr, socklen_t addrlen);
 int32_t          NetListen(void* net_ctx, uint32_t backlog);
 void*            NetAccept(void* net_ctx, struct sockaddr* addr, socklen_t* addrlen);
-int32_t          NetRecv(void* net_ctx, void* buf, int32_t len, uint32_t flags);
+int32_t          NetRecvAvailable(void* net_ctx, void* buf, int32_t len, uint8_t wait);
 int32_t          NetWrite(void* net_ctx, const void* buf, int32_t size);
+int32_t          NetWritev(void* net_ctx, const NetIoVec* iov, int32_t iov_count);
 int32_t          NetClose(void* net_ctx);
+void*            NetListenLocal(const char* path, uint32_t backlog);
+int32_t          NetSendFd(void* net_ctx, const void* buf, int32_t len, int32_t fd);
+void*            ShmCreate(uint32_t size, int32_t* fd);
+void             ShmFree(void* shm, uint32_t size, int32_t fd);
+int32_t          NetFlush(void* net_ctx);
+int32_t          NetDrain(void* net_ctx);
+void*            NetPollCreate();
+int32_t          NetPollAdd(void* poll_ctx, void* net_ctx, void* data);
+int32_t          NetPollRearm(void* poll_ctx, void* net_ctx, void* data);
+int32_t          NetPollRemove(void* poll_ctx, void* net_ctx);
+void*            NetPollWait(void* poll_ctx, uint32_t* events);
 void             Initialize();
 void             PlatformLoop(AaruPacketHello* pkt_server_hello);
 void*            WorkingLoop(void* arguments);
+void*            AcceptLoop(void* arguments);
+void*            ClientLoop(void* arguments);
+void*            PollLoop(void* arguments);
+void*            SessionLoop(void* arguments);
+int32_t          ReceiveClientHello(ClientContext* client);
+int32_t          ProcessPacket(ClientContext* client);
+int32_t          FillPacket(ClientContext* client, uint8_t wait);
+int32_t          SendResponse(ClientContext* client, void* pkt, int32_t len);
+int32_t          SendResponsev(ClientContext* client, NetIoVec* iov, int32_t iov_count);
+int32_t          SparseResponse(ClientContext* client, NetIoVec** iov, int32_t iov_count);
+int32_t          SendCapabilities(ClientContext* client);
+int32_t          StreamOsRead(ClientContext* client, uint64_t offset, uint32_t length);
+int32_t          MultiScsiCommand(ClientContext* client, AaruPacketMultiCmdScsi* pkt_cmd_multi_scsi);
+int32_t          MultiOsRead(ClientContext* client, AaruPacketMultiCmdOsRead* pkt_cmd_multi_osread);
+int32_t          StreamScsiRead(ClientContext* client, AaruPacketCmdScsiReadStream* pkt_cmd_read_stream);
+int32_t          RecoverScsiRead(ClientContext* client, AaruPacketCmdScsiRecover* pkt_cmd_recover);
+int32_t          HashRead(ClientContext* client, AaruPacketCmdHash* pkt_cmd_hash);
+int32_t          DeviceHandleCommand(ClientContext* client, AaruPacketCmdDevice* pkt_cmd_device);
+void*            DeviceHandleLoop(void* arguments);
+uint32_t         BuildScsiRead(unsigned char* cdb, uint8_t opcode, uint64_t lba, uint32_t count);
+void*            ScsiCacheCreate(void* device_ctx, uint32_t size);
+void             ScsiCacheFree(void* scsi_cache);
+void             ScsiCacheInvalidate(void* scsi_cache);
+void             ScsiCacheLockDevice(void* scsi_cache);
+void             ScsiCacheUnlockDevice(void* scsi_cache, uint8_t modified);
+void             ScsiCacheStats(void* scsi_cache, uint64_t* hits, uint64_t* misses, uint64_t* prefetched);
+int32_t          ScsiCacheCommand(void*     scsi_cache,
+                                  char*     cdb,
+                                  char*     buffer,
+                                  char*     sense_buffer,
+                                  uint32_t  timeout,
+                                  int32_t   direction,
+                                  uint32_t* duration,
+                                  uint32_t* sense,
+                                  uint32_t  cdb_len,
+                                  uint32_t* buf_len,
+                                  uint32_t* sense_len);
+void*            ReadAheadCreate(void* device_ctx);
+void             ReadAheadFree(void* read_ahead);
+void             ReadAheadStats(void* read_ahead, uint64_t* hits, uint64_t* misses, uint64_t* stalls);
+uint8_t          ReadAheadFollows(void* read_ahead, uint64_t offset);
+void             ReadAheadCancel(void* read_ahead);
+void             ReadAheadSkip(void* read_ahead, uint64_t offset, uint32_t length);
+int32_t          ReadAheadRead(void* read_ahead, char* buffer, uint64_t offset, uint32_t length, uint32_t* duration);
+int32_t          SetupShm(ClientContext* client, uint32_t size);
+int32_t          ShmOsRead(ClientContext* client, uint64_t offset, uint32_t length);
+int32_t          ParkSession(ClientContext* client);
+void*            ResumeSession(uint64_t token);
+void*            ReaperLoop(void* arguments);
+void             FreeClient(ClientContext* client);
+ClientContext*   CreateClient(void* net_ctx, AaruPacketHello* pkt_server_hello);
+void*            ArenaAlloc(Arena* arena, uint32_t size);
+void             ArenaReset(Arena* arena);
+void             ArenaFree(Arena* arena);
+void*            DmaAlloc(uint32_t size);
+void             DmaFree(void* buf);
+void             HashInit(HashContext* ctx, uint8_t algorithms);
+void             HashUpdate(HashContext* ctx, const void* data, uint32_t len);
+void             HashFinal(HashContext* ctx,
+                           uint32_t*    crc32,
+                           uint64_t*    crc64,
+                           uint8_t*     md5,
+                           uint8_t*     sha1,
+                           uint8_t*     sha256);
+int32_t          StartWorkerThread(void* (*thread_func)(void*), void* arguments);
 uint8_t          AmIRoot();
 int32_t          ReOpen(void* device_ctx, uint32_t* closeFailed);
 #endif
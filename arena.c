@@ -0,0 +1,128 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include "win32/win32.h"
+#else
+#include <stdint.h>
+#endif
+
+#include "aaruremote.h"
+
+#define ARENA_ALIGNMENT 16
+
+// Allocations that do not fit go to the heap, chained so they are released on reset
+typedef struct ArenaSpill
+{
+    struct ArenaSpill* next;
+    uint64_t           pad;
+} ArenaSpill;
+
+void* ArenaAlloc(Arena* arena, uint32_t size)
+{
+    ArenaSpill* spill;
+    uint32_t    aligned = (size + ARENA_ALIGNMENT - 1) & ~(uint32_t)(ARENA_ALIGNMENT - 1);
+
+    if(aligned < size) return NULL;
+
+    // Remember how much this packet needed, so the next reset can make room for all of it
+    if(arena->wanted + (uint64_t)aligned <= AARUREMOTE_ARENA_MAX_SIZE) arena->wanted += aligned;
+
+    if(arena->buf && aligned <= arena->size - arena->used)
+    {
+        arena->used += aligned;
+        return arena->buf + arena->used - aligned;
+    }
+
+    spill = malloc(sizeof(ArenaSpill) + aligned);
+
+    if(!spill) return NULL;
+
+    arena->mallocs++;
+    spill->next   = arena->spills;
+    arena->spills = spill;
+
+    return (char*)spill + sizeof(ArenaSpill);
+}
+
+void ArenaReset(Arena* arena)
+{
+    ArenaSpill* spill;
+    char*       new_buf;
+
+    while(arena->spills)
+    {
+        spill         = arena->spills;
+        arena->spills = spill->next;
+        free(spill);
+    }
+
+    // Grow to the largest packet seen so far, a steady workload stops allocating after the first few packets
+    if(arena->wanted > arena->size)
+    {
+        new_buf = malloc(arena->wanted);
+
+        if(new_buf)
+        {
+            free(arena->buf);
+            arena->mallocs++;
+            arena->buf  = new_buf;
+            arena->size = arena->wanted;
+        }
+    }
+
+    arena->used   = 0;
+    arena->wanted = 0;
+}
+
+void ArenaFree(Arena* arena)
+{
+    ArenaReset(arena);
+    free(arena->buf);
+    arena->buf  = NULL;
+    arena->size = 0;
+}
+
+// Page aligned, so the kernel can map it for a device rather than copy it through a buffer of its own
+void* DmaAlloc(uint32_t size)
+{
+    char* base;
+    char* buf;
+
+    base = malloc((size_t)size + AARUREMOTE_DMA_ALIGNMENT + sizeof(void*));
+
+    if(!base) return NULL;
+
+    // What malloc returned is kept right before the aligned buffer, to free it
+    buf = (char*)(((uintptr_t)base + sizeof(void*) + AARUREMOTE_DMA_ALIGNMENT - 1) &
+                  ~(uintptr_t)(AARUREMOTE_DMA_ALIGNMENT - 1));
+
+    ((void**)buf)[-1] = base;
+
+    return buf;
+}
+
+void DmaFree(void* buf)
+{
+    if(!buf) return;
+
+    free(((void**)buf)[-1]);
+}
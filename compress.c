@@ -0,0 +1,191 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "aaruremote.h"
+
+// Output is a LZ4 block, so clients can use any LZ4 block decoder.
+// Each sequence is a token (literal length << 4 | match length - 4), extra literal length bytes, the literals,
+// a little endian 16-bit offset and extra match length bytes. Lengths of 15 or more continue in bytes of 255.
+// The last sequence only has literals, and the last 5 bytes are always literals.
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t LzRead32(const uint8_t* p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(uint32_t));
+
+    return v;
+}
+
+static uint32_t LzHash(uint32_t v) { return (v * 2654435761U) >> (32 - AARUREMOTE_LZ_HASH_BITS); }
+
+static uint32_t LzLengthBytes(uint32_t len) { return len >= 15 ? (len - 15) / 255 + 1 : 0; }
+
+static uint8_t* LzWriteLength(uint8_t* op, uint32_t len)
+{
+    for(len -= 15; len >= 255; len -= 255) *op++ = 255;
+
+    *op++ = (uint8_t)len;
+
+    return op;
+}
+
+int32_t LzCompress(const uint8_t* in, int32_t in_len, uint8_t* out, int32_t out_len, uint32_t* table)
+{
+    const uint8_t* ip     = in;
+    const uint8_t* anchor = in;
+    const uint8_t* end    = in + in_len;
+    const uint8_t* ref;
+    uint8_t*       op   = out;
+    uint8_t*       oend = out + out_len;
+    uint8_t*       token;
+    uint32_t       h;
+    uint32_t       lit;
+    uint32_t       len;
+    uint32_t       off;
+
+    memset(table, 0, sizeof(uint32_t) << AARUREMOTE_LZ_HASH_BITS);
+
+    while(in_len > LZ_MATCH_LIMIT && ip < end - LZ_MATCH_LIMIT)
+    {
+        h        = LzHash(LzRead32(ip));
+        ref      = in + table[h];
+        table[h] = (uint32_t)(ip - in);
+
+        if(ref >= ip || ip - ref > LZ_MAX_OFFSET || LzRead32(ref) != LzRead32(ip))
+        {
+            // Skip faster through data that does not compress
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        while(ip > anchor && ref > in && ip[-1] == ref[-1])
+        {
+            ip--;
+            ref--;
+        }
+
+        for(len = LZ_MIN_MATCH; ip + len < end - LZ_LAST_LITERALS && ip[len] == ref[len]; len++)
+            ;
+
+        lit = (uint32_t)(ip - anchor);
+        off = (uint32_t)(ip - ref);
+
+        if(1 + LzLengthBytes(lit) + lit + 2 + LzLengthBytes(len - LZ_MIN_MATCH) > (uint32_t)(oend - op)) return 0;
+
+        token  = op++;
+        *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+
+        if(lit >= 15) op = LzWriteLength(op, lit);
+
+        memcpy(op, anchor, lit);
+        op += lit;
+
+        *op++ = (uint8_t)(off & 0xFF);
+        *op++ = (uint8_t)(off >> 8);
+
+        *token |= (uint8_t)(len - LZ_MIN_MATCH >= 15 ? 15 : len - LZ_MIN_MATCH);
+
+        if(len - LZ_MIN_MATCH >= 15) op = LzWriteLength(op, len - LZ_MIN_MATCH);
+
+        ip += len;
+        anchor = ip;
+    }
+
+    lit = (uint32_t)(end - anchor);
+
+    if(1 + LzLengthBytes(lit) + lit > (uint32_t)(oend - op)) return 0;
+
+    token  = op++;
+    *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+
+    if(lit >= 15) op = LzWriteLength(op, lit);
+
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return (int32_t)(op - out);
+}
+
+int32_t LzDecompress(const uint8_t* in, int32_t in_len, uint8_t* out, int32_t out_len)
+{
+    const uint8_t* ip   = in;
+    const uint8_t* iend = in + in_len;
+    uint8_t*       op   = out;
+    uint8_t*       oend = out + out_len;
+    const uint8_t* ref;
+    uint8_t        token;
+    uint8_t        b;
+    uint32_t       len;
+    uint32_t       off;
+
+    while(ip < iend)
+    {
+        token = *ip++;
+        len   = token >> 4;
+
+        if(len == 15) do
+            {
+                if(ip >= iend) return -1;
+
+                b = *ip++;
+                len += b;
+            } while(b == 255);
+
+        if(len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op)) return -1;
+
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        // The last sequence has no match
+        if(ip >= iend) break;
+
+        if(iend - ip < 2) return -1;
+
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if(off == 0 || off > (uint32_t)(op - out)) return -1;
+
+        len = token & 15;
+
+        if(len == 15) do
+            {
+                if(ip >= iend) return -1;
+
+                b = *ip++;
+                len += b;
+            } while(b == 255);
+
+        len += LZ_MIN_MATCH;
+
+        if(len > (uint32_t)(oend - op)) return -1;
+
+        // Matches can overlap what they are producing
+        for(ref = op - off; len > 0; len--) *op++ = *ref++;
+    }
+
+    return (int32_t)(op - out);
+}
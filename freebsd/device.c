@@ -20,9 +20,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/disk.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "../aaruremote.h"
+#include "../unix/unix.h"
 #include "freebsd.h"
 
 void* DeviceOpen(const char* device_path)
@@ -134,4 +139,47 @@ int32_t OsRead(void* device_ctx, char* buffer, uint64_t offset, uint32_t length,
     ret = read(ctx->device.fd, (void*)buffer, (size_t)length);
 
     return ret < 0 ? errno : 0;
-}
\ No newline at end of file
+}
+
+int32_t OsReadv(void* device_ctx, OsReadExtent* extents, uint32_t count)
+{
+    DeviceContext* ctx = device_ctx;
+
+    if(!ctx) return -1;
+
+    return PreadExtents(ctx->device->fd, extents, count);
+}
+
+int32_t OsReadToNet(void* device_ctx, void* net_ctx, AaruPacketResOsRead* pkt_res, uint64_t offset, uint32_t length)
+{
+    // Not supported, the response is read into memory
+    return 0;
+}
+
+uint32_t OsReadToNetMaximum() { return 0; }
+
+// Files know their size, disks have to be asked. 0 when neither applies.
+uint64_t OsGetSize(void* device_ctx)
+{
+    DeviceContext* ctx  = device_ctx;
+    off_t          size = 0;
+    struct stat    st;
+
+    if(!ctx || fstat(ctx->device->fd, &st) < 0) return 0;
+
+    if(S_ISREG(st.st_mode)) return (uint64_t)st.st_size;
+
+    return ioctl(ctx->device->fd, DIOCGMEDIASIZE, &size) < 0 ? 0 : (uint64_t)size;
+}
+
+uint32_t GetMaxTransfer(int32_t device_type)
+{
+    switch(device_type)
+    {
+        // CAM does not take bigger transfers
+        case AARUREMOTE_DEVICE_TYPE_SCSI:
+        case AARUREMOTE_DEVICE_TYPE_ATAPI:
+        case AARUREMOTE_DEVICE_TYPE_ATA: return MAXPHYS;
+        default: return 0;
+    }
+}
@@ -28,7 +28,7 @@
 int32_t SendScsiCommand(void*     device_ctx,
                         char*     cdb,
                         char*     buffer,
-                        char**    sense_buffer,
+                        char*     sense_buffer,
                         uint32_t  timeout,
                         int32_t   direction,
                         uint32_t* duration,
@@ -37,11 +37,11 @@ int32_t SendScsiCommand(void*     device_ctx,
                         uint32_t* buf_len,
                         uint32_t* sense_len)
 {
-    DeviceContext* ctx = device_ctx;
-    *sense_len         = 0;
-    *sense_buffer      = NULL;
-    *duration          = 0;
-    *sense             = false;
+    DeviceContext* ctx      = device_ctx;
+    uint32_t       sense_max = *sense_len;
+    *sense_len              = 0;
+    *duration               = 0;
+    *sense                  = false;
     union ccb*      camccb;
     u_int32_t       flags;
     int             error;
@@ -49,6 +49,7 @@ int32_t SendScsiCommand(void*     device_ctx,
     struct timespec start_tp;
     struct timespec end_tp;
     double          start, end;
+    uint32_t        returned;
 
     switch(direction)
     {
@@ -61,9 +62,8 @@ int32_t SendScsiCommand(void*     device_ctx,
     if(!ctx) return -1;
     if(!ctx->device) return -1;
 
-    *sense_buffer = malloc(32);
-
-    if(!*sense_buffer) return -1;
+    // The caller owns the sense buffer, it must fit at least the status byte
+    if(sense_max < 1) return -1;
 
     camccb = cam_getccb(ctx->device);
 
@@ -77,7 +77,7 @@ int32_t SendScsiCommand(void*     device_ctx,
     camccb->ccb_h.timeout     = timeout;
     camccb->csio.data_ptr     = (u_int8_t*)buffer;
     camccb->csio.dxfer_len    = *buf_len;
-    camccb->csio.sense_len    = 32;
+    camccb->csio.sense_len    = sense_max > SSD_FULL_SIZE ? SSD_FULL_SIZE : sense_max;
     camccb->csio.cdb_len      = cdb_len;
     camccb->csio.tag_action   = 0x20;
 
@@ -117,19 +117,21 @@ int32_t SendScsiCommand(void*     device_ctx,
 
     if((camccb->ccb_h.status & CAM_STATUS_MASK) == CAM_SCSI_STATUS_ERROR)
     {
-        *sense             = true;
-        *sense_buffer      = malloc(1);
-        (*sense_buffer)[0] = camccb->csio.scsi_status;
+        *sense          = true;
+        *sense_len      = 1;
+        sense_buffer[0] = camccb->csio.scsi_status;
     }
 
     if((camccb->ccb_h.status & CAM_AUTOSNS_VALID) && camccb->csio.sense_len - camccb->csio.sense_resid > 0)
     {
-        *sense             = (camccb->ccb_h.status & CAM_STATUS_MASK) == CAM_SCSI_STATUS_ERROR;
-        *sense_buffer      = malloc(camccb->csio.sense_len - camccb->csio.sense_resid);
-        (*sense_buffer)[0] = camccb->csio.sense_data.error_code;
-        memcpy((*sense_buffer) + 1,
-               camccb->csio.sense_data.sense_buf,
-               (camccb->csio.sense_len - camccb->csio.sense_resid) - 1);
+        returned = camccb->csio.sense_len - camccb->csio.sense_resid;
+
+        if(returned > sense_max) returned = sense_max;
+
+        *sense          = (camccb->ccb_h.status & CAM_STATUS_MASK) == CAM_SCSI_STATUS_ERROR;
+        *sense_len      = returned;
+        sense_buffer[0] = camccb->csio.sense_data.error_code;
+        memcpy(sense_buffer + 1, camccb->csio.sense_data.sense_buf, returned - 1);
     }
 
     cam_freeccb(camccb);
@@ -137,4 +139,7 @@ int32_t SendScsiCommand(void*     device_ctx,
     *buf_len = camccb->csio.dxfer_len;
 
     return error;
-}
\ No newline at end of file
+}
+
+// There is no fallback to copying to count, the buffer is always handed to the device as it is
+void ScsiDirectStats(void* device_ctx, uint64_t* transfers, uint64_t* direct) {}
@@ -0,0 +1,495 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define AARUREMOTE_HASH_PCLMUL
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define AARUREMOTE_HASH_ARMV8
+#include <arm_acle.h>
+#endif
+
+#include "aaruremote.h"
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+#define CRC64_POLYNOMIAL 0xC96C5795D7870F42ULL
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t crc32_table[8][256];
+static uint64_t crc64_table[8][256];
+static uint8_t  crc32_pclmul;
+static uint8_t  tables_ready;
+
+static const uint32_t md5_k[64] = {
+    0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE,
+    0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+    0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE,
+    0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+    0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA,
+    0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+    0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED,
+    0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+    0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C,
+    0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+    0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05,
+    0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+    0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039,
+    0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+    0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1,
+    0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391};
+
+static const uint8_t md5_r[64] = {7,  12, 17, 22, 7,  12, 17, 22, 7,  12, 17, 22, 7,  12, 17, 22,
+                                  5,  9,  14, 20, 5,  9,  14, 20, 5,  9,  14, 20, 5,  9,  14, 20,
+                                  4,  11, 16, 23, 4,  11, 16, 23, 4,  11, 16, 23, 4,  11, 16, 23,
+                                  6,  10, 15, 21, 6,  10, 15, 21, 6,  10, 15, 21, 6,  10, 15, 21};
+
+static const uint32_t sha256_k[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+static uint32_t Load32Le(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t Load32Be(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void HashTables()
+{
+    uint32_t n, k;
+    uint32_t c;
+    uint64_t c64;
+
+    for(n = 0; n < 256; n++)
+    {
+        c   = n;
+        c64 = n;
+
+        for(k = 0; k < 8; k++)
+        {
+            c   = c & 1 ? (c >> 1) ^ CRC32_POLYNOMIAL : c >> 1;
+            c64 = c64 & 1 ? (c64 >> 1) ^ CRC64_POLYNOMIAL : c64 >> 1;
+        }
+
+        crc32_table[0][n] = c;
+        crc64_table[0][n] = c64;
+    }
+
+    // Slicing by 8, each table advances the previous one by a byte
+    for(n = 0; n < 256; n++)
+        for(k = 1; k < 8; k++)
+        {
+            crc32_table[k][n] = crc32_table[0][crc32_table[k - 1][n] & 0xFF] ^ (crc32_table[k - 1][n] >> 8);
+            crc64_table[k][n] = crc64_table[0][crc64_table[k - 1][n] & 0xFF] ^ (crc64_table[k - 1][n] >> 8);
+        }
+
+#ifdef AARUREMOTE_HASH_PCLMUL
+    // Carry-less multiplication folds 64 bytes at a time, SSE4.1 extracts the result
+    crc32_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+#ifdef AARUREMOTE_HASH_PCLMUL
+// Folding as described in Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", with the
+// bit-reflected constants of the CRC32 polynomial. Takes at least 64 bytes, in multiples of 16.
+__attribute__((target("pclmul,sse4.1"))) static uint32_t Crc32Pclmul(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL);
+
+    buf += 64;
+    len -= 64;
+
+    while(len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while(len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i*)buf);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    // Fold 128 bits to 64, then Barrett reduce to 32
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_set_epi64x(0, 0x0163CD6124LL);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+static uint32_t Crc32Update(uint32_t c, const uint8_t* p, uint32_t len)
+{
+    uint32_t one, two;
+
+#if defined(AARUREMOTE_HASH_PCLMUL)
+    if(crc32_pclmul && len >= 64)
+    {
+        c = Crc32Pclmul(c, p, len & ~15U);
+        p += len & ~15U;
+        len &= 15;
+    }
+#elif defined(AARUREMOTE_HASH_ARMV8)
+    while(len >= 8)
+    {
+        c = __crc32d(c, (uint64_t)Load32Le(p) | ((uint64_t)Load32Le(p + 4) << 32));
+        p += 8;
+        len -= 8;
+    }
+#endif
+
+    while(len >= 8)
+    {
+        one = Load32Le(p) ^ c;
+        two = Load32Le(p + 4);
+        c   = crc32_table[7][one & 0xFF] ^ crc32_table[6][(one >> 8) & 0xFF] ^ crc32_table[5][(one >> 16) & 0xFF] ^
+            crc32_table[4][one >> 24] ^ crc32_table[3][two & 0xFF] ^ crc32_table[2][(two >> 8) & 0xFF] ^
+            crc32_table[1][(two >> 16) & 0xFF] ^ crc32_table[0][two >> 24];
+        p += 8;
+        len -= 8;
+    }
+
+    while(len--) c = crc32_table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+
+    return c;
+}
+
+static uint64_t Crc64Update(uint64_t c, const uint8_t* p, uint32_t len)
+{
+    uint64_t one;
+
+    while(len >= 8)
+    {
+        one = c ^ ((uint64_t)Load32Le(p) | ((uint64_t)Load32Le(p + 4) << 32));
+        c   = crc64_table[7][one & 0xFF] ^ crc64_table[6][(one >> 8) & 0xFF] ^ crc64_table[5][(one >> 16) & 0xFF] ^
+            crc64_table[4][(one >> 24) & 0xFF] ^ crc64_table[3][(one >> 32) & 0xFF] ^
+            crc64_table[2][(one >> 40) & 0xFF] ^ crc64_table[1][(one >> 48) & 0xFF] ^ crc64_table[0][one >> 56];
+        p += 8;
+        len -= 8;
+    }
+
+    while(len--) c = crc64_table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+
+    return c;
+}
+
+static void Md5Transform(uint32_t* state, const uint8_t* block)
+{
+    uint32_t w[16];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t f, g, tmp;
+    uint32_t i;
+
+    for(i = 0; i < 16; i++) w[i] = Load32Le(block + i * 4);
+
+    for(i = 0; i < 64; i++)
+    {
+        if(i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if(i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) & 15;
+        }
+        else if(i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+
+        tmp = d;
+        d   = c;
+        c   = b;
+        f   = a + f + md5_k[i] + w[g];
+        b   = b + ROTL32(f, md5_r[i]);
+        a   = tmp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+static void Sha1Transform(uint32_t* state, const uint8_t* block)
+{
+    uint32_t w[80];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    uint32_t f, k, tmp;
+    uint32_t i;
+
+    for(i = 0; i < 16; i++) w[i] = Load32Be(block + i * 4);
+    for(i = 16; i < 80; i++) w[i] = ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    for(i = 0; i < 80; i++)
+    {
+        if(i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if(i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if(i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        tmp = ROTL32(a, 5) + f + e + k + w[i];
+        e   = d;
+        d   = c;
+        c   = ROTL32(b, 30);
+        b   = a;
+        a   = tmp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+static void Sha256Transform(uint32_t* state, const uint8_t* block)
+{
+    uint32_t w[64];
+    uint32_t s[8];
+    uint32_t t1, t2;
+    uint32_t i;
+
+    for(i = 0; i < 16; i++) w[i] = Load32Be(block + i * 4);
+
+    for(i = 16; i < 64; i++)
+        w[i] = w[i - 16] + (ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] +
+               (ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+    memcpy(s, state, sizeof(s));
+
+    for(i = 0; i < 64; i++)
+    {
+        t1 = s[7] + (ROTR32(s[4], 6) ^ ROTR32(s[4], 11) ^ ROTR32(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) +
+             sha256_k[i] + w[i];
+        t2 = (ROTR32(s[0], 2) ^ ROTR32(s[0], 13) ^ ROTR32(s[0], 22)) +
+             ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+        s[7] = s[6];
+        s[6] = s[5];
+        s[5] = s[4];
+        s[4] = s[3] + t1;
+        s[3] = s[2];
+        s[2] = s[1];
+        s[1] = s[0];
+        s[0] = t1 + t2;
+    }
+
+    for(i = 0; i < 8; i++) state[i] += s[i];
+}
+
+// MD5, SHA-1 and SHA-256 share the same 64 byte block framing
+static void
+    DigestUpdate(DigestContext* ctx, const uint8_t* data, uint32_t len, void (*transform)(uint32_t*, const uint8_t*))
+{
+    uint32_t used = (uint32_t)(ctx->length & 63);
+    uint32_t fill = 64 - used;
+
+    ctx->length += len;
+
+    if(used > 0)
+    {
+        if(len < fill)
+        {
+            memcpy(ctx->block + used, data, len);
+            return;
+        }
+
+        memcpy(ctx->block + used, data, fill);
+        transform(ctx->state, ctx->block);
+        data += fill;
+        len -= fill;
+    }
+
+    while(len >= 64)
+    {
+        transform(ctx->state, data);
+        data += 64;
+        len -= 64;
+    }
+
+    if(len > 0) memcpy(ctx->block, data, len);
+}
+
+static void DigestFinal(DigestContext* ctx,
+                        void (*transform)(uint32_t*, const uint8_t*),
+                        uint8_t  big_endian,
+                        uint8_t* digest,
+                        uint32_t words)
+{
+    uint8_t  pad[72];
+    uint64_t bits = ctx->length * 8;
+    uint32_t used = (uint32_t)(ctx->length & 63);
+    uint32_t len  = used < 56 ? 56 - used : 120 - used;
+    uint32_t i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+
+    for(i = 0; i < 8; i++) pad[len + i] = (uint8_t)(big_endian ? bits >> (56 - i * 8) : bits >> (i * 8));
+
+    DigestUpdate(ctx, pad, len + 8, transform);
+
+    for(i = 0; i < words * 4; i++)
+        digest[i] = (uint8_t)(ctx->state[i / 4] >> (big_endian ? 24 - (i % 4) * 8 : (i % 4) * 8));
+}
+
+void HashInit(HashContext* ctx, uint8_t algorithms)
+{
+    static const uint32_t md5_init[4]    = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+    static const uint32_t sha1_init[5]   = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    static const uint32_t sha256_init[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                            0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+    // Building the tables twice from two threads is harmless
+    if(!tables_ready)
+    {
+        HashTables();
+        tables_ready = 1;
+    }
+
+    memset(ctx, 0, sizeof(HashContext));
+
+    ctx->algorithms = algorithms;
+    ctx->crc32      = 0xFFFFFFFF;
+    ctx->crc64      = 0xFFFFFFFFFFFFFFFFULL;
+    memcpy(ctx->md5.state, md5_init, sizeof(md5_init));
+    memcpy(ctx->sha1.state, sha1_init, sizeof(sha1_init));
+    memcpy(ctx->sha256.state, sha256_init, sizeof(sha256_init));
+}
+
+void HashUpdate(HashContext* ctx, const void* data, uint32_t len)
+{
+    if(ctx->algorithms & AARUREMOTE_HASH_CRC32) ctx->crc32 = Crc32Update(ctx->crc32, data, len);
+    if(ctx->algorithms & AARUREMOTE_HASH_CRC64) ctx->crc64 = Crc64Update(ctx->crc64, data, len);
+    if(ctx->algorithms & AARUREMOTE_HASH_MD5) DigestUpdate(&ctx->md5, data, len, Md5Transform);
+    if(ctx->algorithms & AARUREMOTE_HASH_SHA1) DigestUpdate(&ctx->sha1, data, len, Sha1Transform);
+    if(ctx->algorithms & AARUREMOTE_HASH_SHA256) DigestUpdate(&ctx->sha256, data, len, Sha256Transform);
+}
+
+void HashFinal(HashContext* ctx, uint32_t* crc32, uint64_t* crc64, uint8_t* md5, uint8_t* sha1, uint8_t* sha256)
+{
+    *crc32 = ctx->algorithms & AARUREMOTE_HASH_CRC32 ? ~ctx->crc32 : 0;
+    *crc64 = ctx->algorithms & AARUREMOTE_HASH_CRC64 ? ~ctx->crc64 : 0;
+
+    if(ctx->algorithms & AARUREMOTE_HASH_MD5) DigestFinal(&ctx->md5, Md5Transform, 0, md5, 4);
+    if(ctx->algorithms & AARUREMOTE_HASH_SHA1) DigestFinal(&ctx->sha1, Sha1Transform, 1, sha1, 5);
+    if(ctx->algorithms & AARUREMOTE_HASH_SHA256) DigestFinal(&ctx->sha256, Sha256Transform, 1, sha256, 8);
+}
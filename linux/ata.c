@@ -53,8 +53,8 @@ int32_t SendAtaChsCommand(void*                 device_ctx,
     *duration = 0;
     *sense    = 0;
     unsigned char  cdb[16];
-    char*          sense_buf;
-    uint32_t       sense_len;
+    char           sense_buf[AARUREMOTE_SENSE_BUFFER_SIZE];
+    uint32_t       sense_len = sizeof(sense_buf);
     DeviceContext* ctx = device_ctx;
 
     if(!ctx) return -1;
@@ -88,7 +88,7 @@ int32_t SendAtaChsCommand(void*                 device_ctx,
     int error = SendScsiCommand(ctx,
                                 (char*)cdb,
                                 buffer,
-                                &sense_buf,
+                                sense_buf,
                                 timeout,
                                 AtaProtocolToScsiDirection(protocol),
                                 duration,
@@ -128,8 +128,8 @@ int32_t SendAtaLba28Command(void*                   device_ctx,
     *duration = 0;
     *sense    = 0;
     unsigned char  cdb[16];
-    char*          sense_buf;
-    uint32_t       sense_len;
+    char           sense_buf[AARUREMOTE_SENSE_BUFFER_SIZE];
+    uint32_t       sense_len = sizeof(sense_buf);
     DeviceContext* ctx = device_ctx;
 
     if(!ctx) return -1;
@@ -165,7 +165,7 @@ int32_t SendAtaLba28Command(void*                   device_ctx,
     int error = SendScsiCommand(ctx,
                                 (char*)cdb,
                                 buffer,
-                                &sense_buf,
+                                sense_buf,
                                 timeout,
                                 AtaProtocolToScsiDirection(protocol),
                                 duration,
@@ -205,8 +205,8 @@ int32_t SendAtaLba48Command(void*                   device_ctx,
     *duration = 0;
     *sense    = 0;
     unsigned char  cdb[16];
-    char*          sense_buf;
-    uint32_t       sense_len;
+    char           sense_buf[AARUREMOTE_SENSE_BUFFER_SIZE];
+    uint32_t       sense_len = sizeof(sense_buf);
     DeviceContext* ctx = device_ctx;
 
     if(!ctx) return -1;
@@ -248,7 +248,7 @@ int32_t SendAtaLba48Command(void*                   device_ctx,
     int error = SendScsiCommand(ctx,
                                 (char*)cdb,
                                 buffer,
-                                &sense_buf,
+                                sense_buf,
                                 timeout,
                                 AtaProtocolToScsiDirection(protocol),
                                 duration,
@@ -15,20 +15,276 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/fs.h>
 
 #ifdef HAS_UDEV
 #include <libudev.h>
 #endif
 
 #include "../aaruremote.h"
+#include "../unix/unix.h"
 #include "linux.h"
+#include "mmc/ioctl.h"
+
+// Direct I/O is opt in, it keeps a full disk read from evicting the page cache but makes small reads slower
+static void OpenDirect(DeviceContext* ctx)
+{
+    const char*  direct     = getenv("AARUREMOTE_DIRECT_IO");
+    int          block_size = 0;
+    uint8_t      supported  = 1;
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+#endif
+
+    ctx->direct_fd           = -1;
+    ctx->direct_offset_align = 0;
+    ctx->direct_mem_align    = 0;
+    ctx->fadvise             = 0;
+
+    if(!direct || strtoul(direct, NULL, 10) == 0) return;
+
+#ifdef STATX_DIOALIGN
+    // The kernel knows the alignments the file or device really needs, and whether it can do direct I/O at all
+    if(statx(AT_FDCWD, ctx->device_path, 0, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN))
+    {
+        ctx->direct_offset_align = stx.stx_dio_offset_align;
+        ctx->direct_mem_align    = stx.stx_dio_mem_align;
+        supported                = stx.stx_dio_offset_align > 0;
+    }
+#endif
+
+    if(supported) ctx->direct_fd = open(ctx->device_path, O_RDONLY | O_DIRECT);
+
+    if(ctx->direct_fd >= 0 && ctx->direct_offset_align == 0)
+    {
+        // Block devices need their logical block size, anything else gets a page and hopes for the best
+        if(ioctl(ctx->direct_fd, BLKSSZGET, &block_size) < 0 || block_size <= 0) block_size = getpagesize();
+
+        ctx->direct_offset_align = (uint32_t)block_size;
+        ctx->direct_mem_align    = (uint32_t)block_size;
+    }
+
+    if(ctx->direct_fd >= 0 && ctx->direct_offset_align <= AARUREMOTE_DIRECT_IO_MAX_ALIGN &&
+       ctx->direct_mem_align <= AARUREMOTE_DIRECT_IO_MAX_ALIGN &&
+       (ctx->direct_offset_align & (ctx->direct_offset_align - 1)) == 0 &&
+       (ctx->direct_mem_align & (ctx->direct_mem_align - 1)) == 0)
+        return;
+
+    if(ctx->direct_fd >= 0) close(ctx->direct_fd);
+
+    ctx->direct_fd = -1;
+
+    // Without direct I/O, at least tell the kernel the data is read in order and only once
+    posix_fadvise(ctx->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ctx->fadvise = 1;
+}
+
+static void CloseDirect(DeviceContext* ctx)
+{
+    if(ctx->direct_fd >= 0) close(ctx->direct_fd);
+
+    free(ctx->direct_buf);
+    ctx->direct_fd  = -1;
+    ctx->direct_buf = NULL;
+}
+
+static void CloseUring(DeviceContext* ctx)
+{
+    if(ctx->uring_fd >= 0) close(ctx->uring_fd);
+
+    UringFree(ctx->uring_ctx);
+    ctx->uring_ctx = NULL;
+    ctx->uring_fd  = -1;
+}
+
+// Aligned parts go straight to the caller's buffer when it is aligned too, the rest bounces through an aligned buffer
+static int32_t DirectRead(DeviceContext* ctx, char* buffer, uint64_t offset, uint32_t length, uint32_t* got)
+{
+    uint64_t mask = ctx->direct_offset_align - 1;
+    uint64_t pos;
+    uint64_t start;
+    uint32_t skip;
+    uint32_t chunk;
+    uint32_t copy;
+    uint32_t align;
+    ssize_t  ret;
+    char*    dest;
+
+    *got = 0;
+
+    while(*got < length)
+    {
+        pos  = offset + *got;
+        dest = buffer + *got;
+
+        if((pos & mask) == 0 && ((uintptr_t)dest & (ctx->direct_mem_align - 1)) == 0 &&
+           length - *got >= ctx->direct_offset_align)
+        {
+            chunk = (uint32_t)((length - *got) & ~mask);
+            ret   = pread(ctx->direct_fd, dest, chunk, (off_t)pos);
+
+            if(ret < 0 && errno == EINTR) continue;
+
+            if(ret < 0) return errno;
+
+            *got += (uint32_t)ret;
+
+            // Short only at the end of the device
+            if((uint32_t)ret < chunk) break;
+
+            continue;
+        }
+
+        if(!ctx->direct_buf)
+        {
+            align = ctx->direct_offset_align > ctx->direct_mem_align ? ctx->direct_offset_align : ctx->direct_mem_align;
+
+            if(align < sizeof(void*)) align = sizeof(void*);
+
+            if(posix_memalign((void**)&ctx->direct_buf, align, AARUREMOTE_DIRECT_IO_BUFFER_SIZE) != 0)
+            {
+                ctx->direct_buf = NULL;
+                return ENOMEM;
+            }
+        }
+
+        start = pos & ~mask;
+        skip  = (uint32_t)(pos - start);
+        chunk = AARUREMOTE_DIRECT_IO_BUFFER_SIZE;
+
+        if((uint64_t)skip + (length - *got) < chunk) chunk = (uint32_t)((skip + (length - *got) + mask) & ~mask);
+
+        ret = pread(ctx->direct_fd, ctx->direct_buf, chunk, (off_t)start);
+
+        if(ret < 0 && errno == EINTR) continue;
+
+        if(ret < 0) return errno;
+
+        if((uint32_t)ret <= skip) break;
+
+        copy = (uint32_t)ret - skip < length - *got ? (uint32_t)ret - skip : length - *got;
+        memcpy(dest, ctx->direct_buf + skip, copy);
+        *got += copy;
+
+        if((uint32_t)ret < chunk) break;
+    }
+
+    return 0;
+}
+
+// Images with holes in them get only their data read, the holes are zeroes that need no disk at all
+static void OpenSparse(DeviceContext* ctx)
+{
+#ifdef SEEK_HOLE
+    struct stat st;
+    off_t       hole;
+#endif
+
+    ctx->sparse = 0;
+
+#ifdef SEEK_HOLE
+    if(fstat(ctx->fd, &st) < 0 || !S_ISREG(st.st_mode)) return;
+
+    // Files without holes, or in filesystems that cannot tell where they are, have one at their end only
+    hole = lseek(ctx->fd, 0, SEEK_HOLE);
+
+    ctx->sparse = hole >= 0 && hole < st.st_size;
+#endif
+}
+
+// Reads the data in the range and clears the holes between it, up to the end of the file like a short read
+static int32_t SparseRead(DeviceContext* ctx, char* buffer, uint64_t offset, uint32_t length, uint32_t* got)
+{
+#ifdef SEEK_HOLE
+    struct stat st;
+    uint64_t    end;
+    uint64_t    pos;
+    off_t       data;
+    off_t       hole;
+    uint32_t    chunk;
+    uint32_t    done;
+    ssize_t     ret;
+    int32_t     error_no;
+
+    *got = 0;
+
+    if(fstat(ctx->fd, &st) < 0) return errno;
+
+    if(offset >= (uint64_t)st.st_size) return 0;
+
+    end = offset + length < (uint64_t)st.st_size ? offset + length : (uint64_t)st.st_size;
+
+    for(pos = offset; pos < end; pos = (uint64_t)hole)
+    {
+        data = lseek(ctx->fd, (off_t)pos, SEEK_DATA);
+
+        // No more data before the end of the file
+        if(data < 0 && errno != ENXIO) return errno;
+
+        if(data < 0 || (uint64_t)data > end) data = (off_t)end;
+
+        memset(buffer + (pos - offset), 0, (size_t)((uint64_t)data - pos));
+
+        if((uint64_t)data == end) break;
+
+        hole = lseek(ctx->fd, data, SEEK_HOLE);
+
+        if(hole < 0) return errno;
+
+        if((uint64_t)hole > end) hole = (off_t)end;
+
+        chunk = (uint32_t)(hole - data);
+        done  = 0;
+
+        if(ctx->direct_fd >= 0)
+        {
+            error_no = DirectRead(ctx, buffer + (data - offset), (uint64_t)data, chunk, &done);
+
+            if(error_no != 0) return error_no;
+        }
+
+        while(ctx->direct_fd < 0 && done < chunk)
+        {
+            ret = pread(ctx->fd, buffer + (data - offset) + done, chunk - done, data + done);
+
+            if(ret < 0 && errno == EINTR) continue;
+
+            if(ret < 0) return errno;
+
+            if(ret == 0) break;
+
+            done += (uint32_t)ret;
+        }
+
+        // The file shrank under us
+        if(done < chunk)
+        {
+            *got = (uint32_t)(data - offset) + done;
+            return 0;
+        }
+    }
+
+    *got = (uint32_t)(end - offset);
+
+    return 0;
+#else
+    *got = 0;
+
+    return -1;
+#endif
+}
 
 void* DeviceOpen(const char* device_path)
 {
@@ -50,6 +306,11 @@ void* DeviceOpen(const char* device_path)
 
     memset(ctx, 0, sizeof(DeviceContext));
 
+    // The pipe is open when its descriptors are, whatever size the kernel gave it
+    ctx->pipe_fds[0] = -1;
+    ctx->pipe_fds[1] = -1;
+    ctx->uring_fd    = -1;
+
     ctx->fd = open(device_path, O_RDWR | O_NONBLOCK | O_CREAT);
 
     if((ctx->fd < 0) && (errno == EACCES || errno == EROFS)) { ctx->fd = open(device_path, O_RDONLY | O_NONBLOCK); }
@@ -65,6 +326,9 @@ void* DeviceOpen(const char* device_path)
 
     free(real_device_path);
 
+    OpenDirect(ctx);
+    OpenSparse(ctx);
+
     return ctx;
 }
 
@@ -75,7 +339,15 @@ void DeviceClose(void* device_ctx)
     if(!ctx) return;
 
     close(ctx->fd);
+    CloseDirect(ctx);
+
+    if(ctx->pipe_fds[0] >= 0)
+    {
+        close(ctx->pipe_fds[0]);
+        close(ctx->pipe_fds[1]);
+    }
 
+    CloseUring(ctx);
     free(ctx);
 }
 
@@ -368,22 +640,42 @@ int32_t ReOpen(void* device_ctx, uint32_t* closeFailed)
         return errno;
     }
 
+    CloseDirect(ctx);
+    CloseUring(ctx);
+
     ctx->fd = open(ctx->device_path, O_RDWR | O_NONBLOCK | O_CREAT);
 
     if((ctx->fd < 0) && (errno == EACCES || errno == EROFS)) ctx->fd = open(ctx->device_path, O_RDONLY | O_NONBLOCK);
 
-    return ctx->fd <= 0 ? errno : 0;
+    if(ctx->fd <= 0) return errno;
+
+    OpenDirect(ctx);
+    OpenSparse(ctx);
+
+    return 0;
 }
 
 int32_t OsRead(void* device_ctx, char* buffer, uint64_t offset, uint32_t length, uint32_t* duration)
 {
     DeviceContext* ctx = device_ctx;
     ssize_t        ret;
+    uint32_t       got;
     *duration = 0;
     off_t pos;
 
     if(!ctx) return -1;
 
+    if(ctx->sparse)
+    {
+        ret = SparseRead(ctx, buffer, offset, length, &got);
+
+        if(ctx->fadvise) posix_fadvise(ctx->fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+
+        return (int32_t)ret;
+    }
+
+    if(ctx->direct_fd >= 0) return DirectRead(ctx, buffer, offset, length, &got);
+
     // TODO: Timing
     pos = lseek(ctx->fd, (off_t)offset, SEEK_SET);
 
@@ -392,5 +684,255 @@ int32_t OsRead(void* device_ctx, char* buffer, uint64_t offset, uint32_t length,
     // TODO: Timing
     ret = read(ctx->fd, (void*)buffer, (size_t)length);
 
+    if(ctx->fadvise) posix_fadvise(ctx->fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+
     return ret < 0 ? errno : 0;
-}
\ No newline at end of file
+}
+
+int32_t OsReadv(void* device_ctx, OsReadExtent* extents, uint32_t count)
+{
+    DeviceContext* ctx = device_ctx;
+    uint32_t       n;
+
+    if(!ctx) return -1;
+
+    if(ctx->direct_fd < 0 && !ctx->sparse)
+    {
+        PreadExtents(ctx->fd, extents, count);
+
+        for(n = 0; n < count && ctx->fadvise; n++)
+            posix_fadvise(ctx->fd, (off_t)extents[n].offset, (off_t)extents[n].length, POSIX_FADV_DONTNEED);
+
+        return 0;
+    }
+
+    for(n = 0; n < count; n++)
+    {
+        extents[n].error_no =
+            ctx->sparse ? SparseRead(ctx, extents[n].buffer, extents[n].offset, extents[n].length, &extents[n].read)
+                        : DirectRead(ctx, extents[n].buffer, extents[n].offset, extents[n].length, &extents[n].read);
+
+        if(ctx->fadvise)
+            posix_fadvise(ctx->fd, (off_t)extents[n].offset, (off_t)extents[n].length, POSIX_FADV_DONTNEED);
+    }
+
+    return 0;
+}
+
+static void ClosePipe(DeviceContext* ctx)
+{
+    if(ctx->pipe_fds[0] < 0) return;
+
+    close(ctx->pipe_fds[0]);
+    close(ctx->pipe_fds[1]);
+    ctx->pipe_fds[0] = -1;
+    ctx->pipe_fds[1] = -1;
+    ctx->pipe_size   = 0;
+}
+
+// Reads into a buffer registered with the kernel and sends from it, linked so both take a single system call
+static int32_t OsReadToNetUring(DeviceContext*       ctx,
+                                void*                net_ctx,
+                                AaruPacketResOsRead* pkt_res,
+                                uint64_t             offset,
+                                uint32_t             length)
+{
+    NetworkContext* net   = net_ctx;
+    uint32_t        total = sizeof(AaruPacketResOsRead) + length;
+    uint32_t        got;
+    int32_t         results[2];
+    char*           buffer;
+    struct timespec start;
+    struct timespec end;
+
+    if(ctx->uring_failed || total > AARUREMOTE_URING_BUFFER_SIZE) return 0;
+
+    if(!ctx->uring_ctx) ctx->uring_ctx = UringCreate(AARUREMOTE_URING_BUFFER_SIZE);
+
+    // The device is open without blocking, and the ring would give up on anything not already cached
+    if(ctx->uring_ctx && ctx->uring_fd < 0) ctx->uring_fd = open(ctx->device_path, O_RDONLY | O_CLOEXEC);
+
+    // Not supported by this kernel, do not try again for this device
+    if(!ctx->uring_ctx || ctx->uring_fd < 0)
+    {
+        CloseUring(ctx);
+        ctx->uring_failed = 1;
+        return 0;
+    }
+
+    buffer = UringBuffer(ctx->uring_ctx);
+
+    // The header is sent before the read completes, so it says the read succeeded and took as long as the last one.
+    // Reads that fall short cancel the send, and are answered below with what really happened.
+    pkt_res->error_no = 0;
+    pkt_res->duration = htole32(ctx->uring_duration);
+    memcpy(buffer, pkt_res, sizeof(AaruPacketResOsRead));
+
+    // The ring bypasses the output queue, so it must be empty to keep the stream in order
+    if(NetDrain(net_ctx) < 0) return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Part of the response may already be on its way, so there is no falling back to the other paths
+    if(UringReadSend(ctx->uring_ctx,
+                     ctx->uring_fd,
+                     sizeof(AaruPacketResOsRead),
+                     length,
+                     offset,
+                     net->fd,
+                     0,
+                     total,
+                     results) < 0)
+    {
+        CloseUring(ctx);
+        ctx->uring_failed = 1;
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ctx->uring_duration = (uint32_t)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+
+    if(results[1] == -ECANCELED)
+    {
+        got = results[0] < 0 ? 0 : (uint32_t)results[0];
+
+        // Like a short read into a cleared buffer, what could not be read goes out as zeroes
+        memset(buffer + sizeof(AaruPacketResOsRead) + got, 0, length - got);
+
+        pkt_res->error_no = htole32(results[0] < 0 ? -results[0] : 0);
+        pkt_res->duration = htole32(ctx->uring_duration);
+        memcpy(buffer, pkt_res, sizeof(AaruPacketResOsRead));
+
+        if(UringSend(ctx->uring_ctx, net->fd, 0, total, &results[1]) < 0) return -1;
+    }
+
+    if(results[1] < 0 && results[1] != -EAGAIN && results[1] != -EWOULDBLOCK) return -1;
+
+    // Sockets without room for all of it take the rest through the output queue
+    got = results[1] < 0 ? 0 : (uint32_t)results[1];
+
+    if(got < total && NetWrite(net_ctx, buffer + got, (int32_t)(total - got)) < 0) return -1;
+
+    return 1;
+}
+
+int32_t OsReadToNet(void* device_ctx, void* net_ctx, AaruPacketResOsRead* pkt_res, uint64_t offset, uint32_t length)
+{
+    DeviceContext*  ctx      = device_ctx;
+    loff_t          pos      = (loff_t)offset;
+    uint32_t        got      = 0;
+    int32_t         error_no = 0;
+    ssize_t         ret;
+    int             size;
+    struct timespec start;
+    struct timespec end;
+    char            zeroes[4096];
+
+    // Both paths below read through the page cache
+    if(!ctx || ctx->direct_fd >= 0) return 0;
+
+    // Small reads are bound by system calls rather than copies
+    ret = OsReadToNetUring(ctx, net_ctx, pkt_res, offset, length);
+
+    if(ret > 0 && ctx->fadvise) posix_fadvise(ctx->fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+
+    if(ret != 0) return (int32_t)ret;
+
+    if(length > AARUREMOTE_SPLICE_MAX) return 0;
+
+    // Data is staged in a pipe so the header, that carries the result, can go out first.
+    // Unaligned reads can take one more page than their length.
+    size = (int)length + 2 * getpagesize();
+
+    if(ctx->pipe_size < size)
+    {
+        if(ctx->pipe_fds[0] < 0 && pipe2(ctx->pipe_fds, O_CLOEXEC) < 0) return 0;
+
+        ctx->pipe_size = fcntl(ctx->pipe_fds[1], F_SETPIPE_SZ, size);
+
+        if(ctx->pipe_size < size)
+        {
+            // Bigger than the system allows for a pipe, let the caller read it into memory
+            ClosePipe(ctx);
+            return 0;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while(got < length)
+    {
+        ret = splice(ctx->fd, &pos, ctx->pipe_fds[1], NULL, length - got, SPLICE_F_MOVE);
+
+        if(ret == 0) break;
+
+        if(ret < 0)
+        {
+            if(errno == EINTR) continue;
+
+            // This device cannot be spliced, nothing has been sent yet so let the caller read it into memory
+            if(got == 0 && (errno == EINVAL || errno == ENOSYS)) return 0;
+
+            error_no = errno;
+            break;
+        }
+
+        got += ret;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(ctx->fadvise) posix_fadvise(ctx->fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+
+    pkt_res->error_no = htole32(error_no);
+    pkt_res->duration =
+        htole32((uint32_t)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000));
+
+    if(NetWrite(net_ctx, pkt_res, sizeof(AaruPacketResOsRead)) < 0 ||
+       NetSplice(net_ctx, ctx->pipe_fds[0], got) < 0)
+    {
+        // The pipe may still hold data
+        ClosePipe(ctx);
+        return -1;
+    }
+
+    // Like a short read into a cleared buffer, what could not be read goes out as zeroes
+    memset(zeroes, 0, sizeof(zeroes));
+
+    for(; got < length; got += ret)
+    {
+        ret = length - got > sizeof(zeroes) ? sizeof(zeroes) : length - got;
+
+        if(NetWrite(net_ctx, zeroes, (int32_t)ret) < 0) return -1;
+    }
+
+    return 1;
+}
+
+uint32_t OsReadToNetMaximum() { return AARUREMOTE_SPLICE_MAX; }
+
+// Files know their size, block devices have to be asked. 0 when neither applies.
+uint64_t OsGetSize(void* device_ctx)
+{
+    DeviceContext* ctx  = device_ctx;
+    uint64_t       size = 0;
+    struct stat    st;
+
+    if(!ctx || fstat(ctx->fd, &st) < 0) return 0;
+
+    if(!S_ISBLK(st.st_mode)) return (uint64_t)st.st_size;
+
+    return ioctl(ctx->fd, BLKGETSIZE64, &size) < 0 ? 0 : size;
+}
+
+uint32_t GetMaxTransfer(int32_t device_type)
+{
+    switch(device_type)
+    {
+        case AARUREMOTE_DEVICE_TYPE_SECURE_DIGITAL:
+        case AARUREMOTE_DEVICE_TYPE_MMC: return MMC_IOC_MAX_BYTES;
+        // Depends on the host adapter
+        default: return 0;
+    }
+}
@@ -19,11 +19,45 @@
 #define AARUREMOTE_LINUX_LINUX_H_
 
 #define PATH_SYS_DEVBLOCK "/sys/block"
+#define AARUREMOTE_SPLICE_MAX (1024 * 1024)
+#define AARUREMOTE_URING_BUFFER_SIZE (256 * 1024)
+#define AARUREMOTE_DIRECT_IO_BUFFER_SIZE (1024 * 1024)
+#define AARUREMOTE_DIRECT_IO_MAX_ALIGN (64 * 1024)
+
+#include <stdint.h>
 
 typedef struct
 {
-    int  fd;
-    char device_path[4096];
+    int      fd;
+    char     device_path[4096];
+    int      pipe_fds[2];
+    int      pipe_size;
+    void*    uring_ctx;
+    uint8_t  uring_failed;
+    int      uring_fd;
+    uint32_t uring_duration;
+    int      direct_fd;
+    uint32_t direct_offset_align;
+    uint32_t direct_mem_align;
+    char*    direct_buf;
+    uint8_t  fadvise;
+    uint8_t  sparse;
+    uint64_t scsi_transfers;
+    uint64_t scsi_direct_transfers;
 } DeviceContext;
 
+void*   UringCreate(uint32_t buffer_size);
+void    UringFree(void* uring_ctx);
+char*   UringBuffer(void* uring_ctx);
+int32_t UringSend(void* uring_ctx, int fd, uint32_t buf_off, uint32_t len, int32_t* result);
+int32_t UringReadSend(void*    uring_ctx,
+                      int      fd,
+                      uint32_t read_off,
+                      uint32_t read_len,
+                      uint64_t offset,
+                      int      sock,
+                      uint32_t send_off,
+                      uint32_t send_len,
+                      int32_t* results);
+
 #endif // AARUREMOTE_LINUX_LINUX_H_
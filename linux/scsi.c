@@ -27,7 +27,7 @@
 int32_t SendScsiCommand(void*     device_ctx,
                         char*     cdb,
                         char*     buffer,
-                        char**    sense_buffer,
+                        char*     sense_buffer,
                         uint32_t  timeout,
                         int32_t   direction,
                         uint32_t* duration,
@@ -39,14 +39,13 @@ int32_t SendScsiCommand(void*     device_ctx,
     DeviceContext* ctx = device_ctx;
     sg_io_hdr_t    hdr;
     int            dir, ret;
-    *sense_len = 32;
 
     if(!ctx) return -1;
 
     memset(&hdr, 0, sizeof(sg_io_hdr_t));
-    *sense_buffer = malloc(*sense_len);
 
-    if(!*sense_buffer) return -1;
+    // The caller owns the sense buffer and says how large it is
+    if(*sense_len > 255) *sense_len = 255;
 
     switch(direction)
     {
@@ -60,21 +59,41 @@ int32_t SendScsiCommand(void*     device_ctx,
 
     hdr.interface_id    = 'S';
     hdr.cmd_len         = (char)cdb_len;
-    hdr.mx_sb_len       = 32;
+    hdr.mx_sb_len       = (unsigned char)*sense_len;
     hdr.dxfer_direction = dir;
     hdr.dxfer_len       = *buf_len;
     hdr.dxferp          = buffer;
     hdr.cmdp            = (unsigned char*)cdb;
-    hdr.sbp             = (unsigned char*)*sense_buffer;
+    hdr.sbp             = (unsigned char*)sense_buffer;
     hdr.timeout         = timeout;
     hdr.flags           = SG_FLAG_DIRECT_IO;
 
     ret = ioctl(ctx->fd, SG_IO, &hdr);
 
+    // The sg driver falls back to copying when it cannot map the buffer, and says which it did.
+    // Handles and the prefetcher send commands to the same device from threads of their own.
+    if(ret == 0 && hdr.dxfer_len > 0 && dir != SG_DXFER_NONE)
+    {
+        __atomic_fetch_add(&ctx->scsi_transfers, 1, __ATOMIC_RELAXED);
+
+        if(hdr.info & SG_INFO_DIRECT_IO) __atomic_fetch_add(&ctx->scsi_direct_transfers, 1, __ATOMIC_RELAXED);
+    }
+
     *sense = (hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK;
     // TODO: Manual timing if duration is 0
     *duration  = hdr.duration;
     *sense_len = hdr.sb_len_wr;
 
     return ret; // TODO: Implement
-}
\ No newline at end of file
+}
+
+void ScsiDirectStats(void* device_ctx, uint64_t* transfers, uint64_t* direct)
+{
+    DeviceContext* ctx = device_ctx;
+
+    if(!ctx) return;
+
+    // Counted once, the device may outlive the client that asks, and commands may be counting meanwhile
+    *transfers += __atomic_exchange_n(&ctx->scsi_transfers, 0, __ATOMIC_RELAXED);
+    *direct += __atomic_exchange_n(&ctx->scsi_direct_transfers, 0, __ATOMIC_RELAXED);
+}
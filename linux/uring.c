@@ -0,0 +1,306 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "linux.h"
+
+#if defined(HAS_IO_URING) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+
+#define AARUREMOTE_URING_ENTRIES 4
+
+// There is no liburing dependency, the rings are used directly
+typedef struct
+{
+    int                  fd;
+    unsigned*            sq_head;
+    unsigned*            sq_tail;
+    unsigned*            sq_mask;
+    unsigned*            sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned*            cq_head;
+    unsigned*            cq_tail;
+    unsigned*            cq_mask;
+    struct io_uring_cqe* cqes;
+    void*                sq_ring;
+    size_t               sq_ring_size;
+    void*                cq_ring;
+    size_t               cq_ring_size;
+    size_t               sqes_size;
+    char*                buffer;
+    uint32_t             buffer_size;
+} UringContext;
+
+static int UringSupports(int fd, const uint8_t* opcodes, size_t count)
+{
+    struct io_uring_probe* probe;
+    size_t                 size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    size_t                 n;
+    int                    supported = 1;
+
+    probe = malloc(size);
+
+    if(!probe) return 0;
+
+    memset(probe, 0, size);
+
+    if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) supported = 0;
+
+    for(n = 0; supported && n < count; n++)
+        if(opcodes[n] > probe->last_op || !(probe->ops[opcodes[n]].flags & IO_URING_OP_SUPPORTED)) supported = 0;
+
+    free(probe);
+
+    return supported;
+}
+
+void* UringCreate(uint32_t buffer_size)
+{
+    static const uint8_t   opcodes[] = {IORING_OP_READ_FIXED, IORING_OP_SEND};
+    UringContext*          ctx;
+    struct io_uring_params params;
+    struct iovec           iov;
+
+    ctx = malloc(sizeof(UringContext));
+
+    if(!ctx) return NULL;
+
+    memset(ctx, 0, sizeof(UringContext));
+    memset(&params, 0, sizeof(params));
+
+    ctx->sq_ring = MAP_FAILED;
+    ctx->cq_ring = MAP_FAILED;
+    ctx->sqes    = MAP_FAILED;
+    ctx->buffer  = MAP_FAILED;
+
+    // Fails on kernels without io_uring or where it has been disabled
+    ctx->fd = (int)syscall(__NR_io_uring_setup, AARUREMOTE_URING_ENTRIES, &params);
+
+    if(ctx->fd < 0)
+    {
+        free(ctx);
+        return NULL;
+    }
+
+    if(!UringSupports(ctx->fd, opcodes, sizeof(opcodes)))
+    {
+        UringFree(ctx);
+        return NULL;
+    }
+
+    ctx->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ctx->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ctx->sqes_size    = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ctx->sq_ring =
+        mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ctx->fd, IORING_OFF_SQ_RING);
+    ctx->cq_ring =
+        mmap(NULL, ctx->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ctx->fd, IORING_OFF_CQ_RING);
+    ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ctx->fd, IORING_OFF_SQES);
+
+    // The data buffer is registered once, so the kernel does not have to map it for every read
+    ctx->buffer_size = buffer_size;
+    ctx->buffer      = mmap(NULL, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(ctx->sq_ring == MAP_FAILED || ctx->cq_ring == MAP_FAILED || ctx->sqes == MAP_FAILED ||
+       ctx->buffer == MAP_FAILED)
+    {
+        UringFree(ctx);
+        return NULL;
+    }
+
+    iov.iov_base = ctx->buffer;
+    iov.iov_len  = buffer_size;
+
+    if(syscall(__NR_io_uring_register, ctx->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+    {
+        UringFree(ctx);
+        return NULL;
+    }
+
+    ctx->sq_head  = (unsigned*)((char*)ctx->sq_ring + params.sq_off.head);
+    ctx->sq_tail  = (unsigned*)((char*)ctx->sq_ring + params.sq_off.tail);
+    ctx->sq_mask  = (unsigned*)((char*)ctx->sq_ring + params.sq_off.ring_mask);
+    ctx->sq_array = (unsigned*)((char*)ctx->sq_ring + params.sq_off.array);
+    ctx->cq_head  = (unsigned*)((char*)ctx->cq_ring + params.cq_off.head);
+    ctx->cq_tail  = (unsigned*)((char*)ctx->cq_ring + params.cq_off.tail);
+    ctx->cq_mask  = (unsigned*)((char*)ctx->cq_ring + params.cq_off.ring_mask);
+    ctx->cqes     = (struct io_uring_cqe*)((char*)ctx->cq_ring + params.cq_off.cqes);
+
+    return ctx;
+}
+
+void UringFree(void* uring_ctx)
+{
+    UringContext* ctx = uring_ctx;
+
+    if(!ctx) return;
+
+    if(ctx->buffer != MAP_FAILED) munmap(ctx->buffer, ctx->buffer_size);
+    if(ctx->sqes != MAP_FAILED) munmap(ctx->sqes, ctx->sqes_size);
+    if(ctx->cq_ring != MAP_FAILED) munmap(ctx->cq_ring, ctx->cq_ring_size);
+    if(ctx->sq_ring != MAP_FAILED) munmap(ctx->sq_ring, ctx->sq_ring_size);
+
+    close(ctx->fd);
+    free(ctx);
+}
+
+char* UringBuffer(void* uring_ctx) { return ((UringContext*)uring_ctx)->buffer; }
+
+// Queues the requests, submits them and waits for all their completions in the same system call
+static int32_t UringSubmit(UringContext* ctx, struct io_uring_sqe* requests, uint32_t count, int32_t* results)
+{
+    struct io_uring_cqe* cqe;
+    unsigned             tail = *ctx->sq_tail;
+    unsigned             head;
+    unsigned             index;
+    uint32_t             done = 0;
+    uint32_t             n;
+
+    for(n = 0; n < count; n++)
+    {
+        index = (tail + n) & *ctx->sq_mask;
+
+        memcpy(&ctx->sqes[index], &requests[n], sizeof(struct io_uring_sqe));
+        ctx->sqes[index].user_data = n;
+        ctx->sq_array[index]       = index;
+    }
+
+    __atomic_store_n(ctx->sq_tail, tail + count, __ATOMIC_RELEASE);
+
+    while(done < count)
+    {
+        head = *ctx->cq_head;
+
+        if(head == __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            // Only submit again what the kernel has not taken yet, as an interrupted wait may have already submitted it
+            if(syscall(__NR_io_uring_enter,
+                       ctx->fd,
+                       tail + count - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE),
+                       count - done,
+                       IORING_ENTER_GETEVENTS,
+                       NULL,
+                       0) < 0 &&
+               errno != EINTR)
+                return -1;
+
+            continue;
+        }
+
+        cqe = &ctx->cqes[head & *ctx->cq_mask];
+
+        if(cqe->user_data < count) results[cqe->user_data] = cqe->res;
+
+        __atomic_store_n(ctx->cq_head, head + 1, __ATOMIC_RELEASE);
+        done++;
+    }
+
+    return 0;
+}
+
+static void UringPrepareRead(UringContext*        ctx,
+                             struct io_uring_sqe* sqe,
+                             int                  fd,
+                             uint32_t             buf_off,
+                             uint32_t             len,
+                             uint64_t             offset)
+{
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    sqe->opcode    = IORING_OP_READ_FIXED;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)(ctx->buffer + buf_off);
+    sqe->len       = len;
+    sqe->off       = offset;
+    sqe->buf_index = 0;
+}
+
+static void UringPrepareSend(UringContext* ctx, struct io_uring_sqe* sqe, int fd, uint32_t buf_off, uint32_t len)
+{
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)(ctx->buffer + buf_off);
+    sqe->len       = len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+}
+
+int32_t UringSend(void* uring_ctx, int fd, uint32_t buf_off, uint32_t len, int32_t* result)
+{
+    UringContext*       ctx = uring_ctx;
+    struct io_uring_sqe sqe;
+
+    UringPrepareSend(ctx, &sqe, fd, buf_off, len);
+
+    return UringSubmit(ctx, &sqe, 1, result);
+}
+
+// The send only starts when the read filled all of its length, a short or failed read cancels it with -ECANCELED
+int32_t UringReadSend(void*    uring_ctx,
+                      int      fd,
+                      uint32_t read_off,
+                      uint32_t read_len,
+                      uint64_t offset,
+                      int      sock,
+                      uint32_t send_off,
+                      uint32_t send_len,
+                      int32_t* results)
+{
+    UringContext*       ctx = uring_ctx;
+    struct io_uring_sqe sqes[2];
+
+    UringPrepareRead(ctx, &sqes[0], fd, read_off, read_len, offset);
+    UringPrepareSend(ctx, &sqes[1], sock, send_off, send_len);
+    sqes[0].flags = IOSQE_IO_LINK;
+
+    return UringSubmit(ctx, sqes, 2, results);
+}
+#else
+void* UringCreate(uint32_t buffer_size) { return NULL; }
+
+void UringFree(void* uring_ctx) {}
+
+char* UringBuffer(void* uring_ctx) { return NULL; }
+
+int32_t UringSend(void* uring_ctx, int fd, uint32_t buf_off, uint32_t len, int32_t* result) { return -1; }
+
+int32_t UringReadSend(void*    uring_ctx,
+                      int      fd,
+                      uint32_t read_off,
+                      uint32_t read_len,
+                      uint64_t offset,
+                      int      sock,
+                      uint32_t send_off,
+                      uint32_t send_len,
+                      int32_t* results)
+{
+    return -1;
+}
+#endif
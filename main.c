@@ -33,6 +33,9 @@ int main()
     AaruPacketHello* pkt_server_hello;
     int              ret;
 
+    // Each line reaches a log file or a pipe as soon as it is printed
+    setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+
     Initialize();
 
     printf("Aaru Remote Server %s\n", AARUREMOTE_VERSION);
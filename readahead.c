@@ -0,0 +1,383 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include "win32/win32.h"
+#else
+#include <stdint.h>
+#endif
+
+#include "aaruremote.h"
+
+typedef struct
+{
+    char*    buf;
+    uint32_t size;
+    uint64_t offset;
+    uint32_t length;
+    int32_t  error_no;
+    uint32_t duration;
+    uint8_t  ready;
+} ReadAheadSlot;
+
+typedef struct
+{
+    void*         device_ctx;
+    void*         mutex;
+    void*         wake;
+    void*         done;
+    void*         stopped;
+    uint8_t       stop;
+    uint8_t       active;
+    uint8_t       busy;
+    uint8_t       waiting;
+    ReadAheadSlot slots[AARUREMOTE_READ_AHEAD_MAX_DEPTH];
+    uint32_t      head;
+    uint32_t      queued;
+    uint32_t      depth;
+    uint32_t      generation;
+    uint64_t      fetch_offset;
+    uint32_t      length;
+    uint64_t      next_offset;
+    uint32_t      run;
+    uint64_t      last_return;
+    uint64_t      disk_us;
+    uint64_t      net_us;
+    uint64_t      hits;
+    uint64_t      misses;
+    uint64_t      stalls;
+} ReadAhead;
+
+// Waits with the lock held until the thread is done with the read it is doing
+static void ReadAheadWait(ReadAhead* ra)
+{
+    ra->waiting = 1;
+    MutexUnlock(ra->mutex);
+    SemaphoreWait(ra->done);
+    MutexLock(ra->mutex);
+}
+
+// Drops whatever was read ahead and leaves the device to the caller, with the lock held
+static void ReadAheadReset(ReadAhead* ra)
+{
+    ra->active = 0;
+    ra->queued = 0;
+    ra->generation++;
+
+    while(ra->busy) ReadAheadWait(ra);
+}
+
+// One read ready while the next is being read, and as many more as the disk is slower than the network
+static void ReadAheadAdapt(ReadAhead* ra)
+{
+    uint64_t depth = AARUREMOTE_READ_AHEAD_MAX_DEPTH;
+
+    if(ra->net_us > 0) depth = 1 + (ra->disk_us + ra->net_us - 1) / ra->net_us;
+
+    if(depth < 2) depth = 2;
+
+    if(depth > AARUREMOTE_READ_AHEAD_MAX_DEPTH) depth = AARUREMOTE_READ_AHEAD_MAX_DEPTH;
+
+    ra->depth = (uint32_t)depth;
+}
+
+// Sequential means following the last read, the first read of a run is the one after that
+static void ReadAheadFollow(ReadAhead* ra, uint64_t offset, uint32_t length)
+{
+    ra->run         = offset == ra->next_offset ? ra->run + 1 : 0;
+    ra->next_offset = offset + length;
+}
+
+static void* ReadAheadLoop(void* arguments)
+{
+    ReadAhead*     ra = arguments;
+    ReadAheadSlot* slot;
+    char*          new_buf;
+    uint64_t       offset;
+    uint64_t       start;
+    uint32_t       length;
+    uint32_t       generation;
+    uint32_t       duration;
+    int32_t        ret;
+    uint8_t        stop = 0;
+
+    while(!stop)
+    {
+        SemaphoreWait(ra->wake);
+
+        for(;;)
+        {
+            MutexLock(ra->mutex);
+
+            stop = ra->stop;
+
+            if(stop || !ra->active || ra->queued >= ra->depth)
+            {
+                MutexUnlock(ra->mutex);
+                break;
+            }
+
+            slot         = &ra->slots[(ra->head + ra->queued) % AARUREMOTE_READ_AHEAD_MAX_DEPTH];
+            offset       = ra->fetch_offset;
+            length       = ra->length;
+            generation   = ra->generation;
+            ra->busy     = 1;
+            slot->offset = offset;
+            slot->length = length;
+            slot->ready  = 0;
+            ra->queued++;
+            ra->fetch_offset += length;
+
+            MutexUnlock(ra->mutex);
+
+            ret      = 0;
+            duration = 0;
+
+            if(length > slot->size)
+            {
+                new_buf = realloc(slot->buf, length);
+
+                if(new_buf)
+                {
+                    slot->buf  = new_buf;
+                    slot->size = length;
+                }
+                else
+                    ret = -1;
+            }
+
+            start = GetMicroseconds();
+
+            // Like a read into a cleared buffer, whatever the device could not give stays zeroes
+            if(ret == 0)
+            {
+                memset(slot->buf, 0, length);
+                ret = OsRead(ra->device_ctx, slot->buf, offset, length, &duration);
+            }
+
+            MutexLock(ra->mutex);
+
+            ra->busy = 0;
+
+            // The client went elsewhere while this was being read
+            if(generation == ra->generation)
+            {
+                slot->error_no = ret;
+                slot->duration = duration;
+                slot->ready    = 1;
+                ra->disk_us    = (ra->disk_us * 7 + GetMicroseconds() - start) / 8;
+
+                // Errors are for the client to find in order, nothing after them is read ahead
+                if(ret != 0) ra->active = 0;
+            }
+
+            if(ra->waiting)
+            {
+                ra->waiting = 0;
+                SemaphorePost(ra->done);
+            }
+
+            MutexUnlock(ra->mutex);
+        }
+    }
+
+    SemaphorePost(ra->stopped);
+
+    return NULL;
+}
+
+void* ReadAheadCreate(void* device_ctx)
+{
+    ReadAhead* ra;
+
+    if(!device_ctx) return NULL;
+
+    ra = malloc(sizeof(ReadAhead));
+
+    if(!ra) return NULL;
+
+    memset(ra, 0, sizeof(ReadAhead));
+
+    ra->device_ctx = device_ctx;
+    ra->depth      = 1;
+    ra->mutex      = MutexCreate();
+    ra->wake       = SemaphoreCreate(0);
+    ra->done       = SemaphoreCreate(0);
+    ra->stopped    = SemaphoreCreate(0);
+
+    if(!ra->mutex || !ra->wake || !ra->done || !ra->stopped || StartWorkerThread(ReadAheadLoop, ra) != 0)
+    {
+        MutexFree(ra->mutex);
+        SemaphoreFree(ra->wake);
+        SemaphoreFree(ra->done);
+        SemaphoreFree(ra->stopped);
+        free(ra);
+        return NULL;
+    }
+
+    return ra;
+}
+
+void ReadAheadFree(void* read_ahead)
+{
+    ReadAhead* ra = read_ahead;
+    uint32_t   n;
+
+    if(!ra) return;
+
+    // The device must not go away under a read in flight
+    MutexLock(ra->mutex);
+    ReadAheadReset(ra);
+    ra->stop = 1;
+    MutexUnlock(ra->mutex);
+
+    SemaphorePost(ra->wake);
+    SemaphoreWait(ra->stopped);
+
+    for(n = 0; n < AARUREMOTE_READ_AHEAD_MAX_DEPTH; n++) free(ra->slots[n].buf);
+
+    MutexFree(ra->mutex);
+    SemaphoreFree(ra->wake);
+    SemaphoreFree(ra->done);
+    SemaphoreFree(ra->stopped);
+    free(ra);
+}
+
+void ReadAheadStats(void* read_ahead, uint64_t* hits, uint64_t* misses, uint64_t* stalls)
+{
+    ReadAhead* ra = read_ahead;
+
+    if(!ra) return;
+
+    MutexLock(ra->mutex);
+    *hits += ra->hits;
+    *misses += ra->misses;
+    *stalls += ra->stalls;
+    MutexUnlock(ra->mutex);
+}
+
+uint8_t ReadAheadFollows(void* read_ahead, uint64_t offset)
+{
+    ReadAhead* ra = read_ahead;
+    uint8_t    follows;
+
+    if(!ra) return 0;
+
+    MutexLock(ra->mutex);
+    follows = ra->run > 0 && offset == ra->next_offset;
+    MutexUnlock(ra->mutex);
+
+    return follows;
+}
+
+void ReadAheadCancel(void* read_ahead)
+{
+    ReadAhead* ra = read_ahead;
+
+    if(!ra) return;
+
+    MutexLock(ra->mutex);
+    ReadAheadReset(ra);
+    MutexUnlock(ra->mutex);
+}
+
+void ReadAheadSkip(void* read_ahead, uint64_t offset, uint32_t length)
+{
+    ReadAhead* ra = read_ahead;
+
+    if(!ra) return;
+
+    MutexLock(ra->mutex);
+    ReadAheadFollow(ra, offset, length);
+    ra->last_return = GetMicroseconds();
+    MutexUnlock(ra->mutex);
+}
+
+int32_t ReadAheadRead(void* read_ahead, char* buffer, uint64_t offset, uint32_t length, uint32_t* duration)
+{
+    ReadAhead*     ra  = read_ahead;
+    uint64_t       now = GetMicroseconds();
+    ReadAheadSlot* slot;
+    int32_t        ret;
+    uint8_t        active;
+
+    MutexLock(ra->mutex);
+
+    // Whatever the client did since the last read, sending it among the rest, is what the disk has to keep up with
+    if(ra->run > 0 && offset == ra->next_offset) ra->net_us = (ra->net_us * 7 + now - ra->last_return) / 8;
+
+    ReadAheadFollow(ra, offset, length);
+
+    slot = &ra->slots[ra->head];
+
+    // The thread may not have even started on it yet
+    if(ra->active && length == ra->length &&
+       ((ra->queued > 0 && slot->offset == offset) || (ra->queued == 0 && ra->fetch_offset == offset)))
+    {
+        if(ra->queued == 0 || !slot->ready) ra->stalls++;
+
+        while(ra->active && (ra->queued == 0 || !slot->ready)) ReadAheadWait(ra);
+    }
+
+    if(ra->queued > 0 && slot->ready && slot->offset == offset && slot->length == length)
+    {
+        memcpy(buffer, slot->buf, length);
+        *duration = slot->duration;
+        ret       = slot->error_no;
+        ra->head  = (ra->head + 1) % AARUREMOTE_READ_AHEAD_MAX_DEPTH;
+        ra->queued--;
+        ra->hits++;
+        ReadAheadAdapt(ra);
+        MutexUnlock(ra->mutex);
+
+        SemaphorePost(ra->wake);
+    }
+    else
+    {
+        // Not what was read ahead, the device is the caller's until the read is done
+        ReadAheadReset(ra);
+        ra->misses++;
+        MutexUnlock(ra->mutex);
+
+        ret = OsRead(ra->device_ctx, buffer, offset, length, duration);
+
+        MutexLock(ra->mutex);
+
+        if(ra->run > 0 && ret == 0 && length <= AARUREMOTE_READ_AHEAD_MAX_SIZE)
+        {
+            ra->active       = 1;
+            ra->length       = length;
+            ra->fetch_offset = offset + length;
+        }
+
+        active = ra->active;
+        MutexUnlock(ra->mutex);
+
+        if(active) SemaphorePost(ra->wake);
+    }
+
+    MutexLock(ra->mutex);
+    ra->last_return = GetMicroseconds();
+    MutexUnlock(ra->mutex);
+
+    return ret;
+}
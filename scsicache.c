@@ -0,0 +1,639 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include "win32/win32.h"
+#else
+#include <stdint.h>
+#endif
+
+#include "aaruremote.h"
+
+#define SCSI_CACHE_NONE 0xFFFFFFFF
+#define SCSI_CACHE_MIN_ENTRIES 64
+
+typedef struct
+{
+    uint64_t lba;
+    uint32_t newer;
+    uint32_t older;
+    uint32_t chain;
+} ScsiCacheEntry;
+
+typedef struct
+{
+    void*           device_ctx;
+    void*           device_mutex;
+    void*           mutex;
+    void*           wake;
+    void*           stopped;
+    uint8_t         stop;
+    uint32_t        size;
+    char*           data;
+    ScsiCacheEntry* entries;
+    uint32_t*       buckets;
+    uint32_t        block_size;
+    uint32_t        capacity;
+    uint32_t        bucket_mask;
+    uint32_t        count;
+    uint32_t        newest;
+    uint32_t        oldest;
+    uint32_t        generation;
+    uint64_t        next_lba;
+    uint32_t        last_count;
+    uint64_t        prefetch_lba;
+    uint64_t        prefetch_end;
+    uint32_t        prefetch_count;
+    uint32_t        prefetch_timeout;
+    uint8_t         prefetch_opcode;
+    char*           prefetch_buf;
+    uint32_t        prefetch_size;
+    uint64_t        hits;
+    uint64_t        misses;
+    uint64_t        prefetched;
+} ScsiCache;
+
+// Returns the opcode of a plain READ(10), READ(12) or READ(16), or 0 for anything that must reach the device
+static uint8_t ParseScsiRead(const unsigned char* cdb, uint32_t cdb_len, uint64_t* lba, uint32_t* count)
+{
+    // Forced unit access and protection information ask for what the medium says right now
+    if(cdb_len < 10 || (cdb[1] & 0xE8)) return 0;
+
+    switch(cdb[0])
+    {
+        case 0x28:
+            if(cdb_len != 10) return 0;
+
+            *lba   = (uint64_t)cdb[2] << 24 | (uint64_t)cdb[3] << 16 | (uint64_t)cdb[4] << 8 | cdb[5];
+            *count = (uint32_t)cdb[7] << 8 | cdb[8];
+            return cdb[0];
+        case 0xA8:
+            if(cdb_len != 12) return 0;
+
+            *lba   = (uint64_t)cdb[2] << 24 | (uint64_t)cdb[3] << 16 | (uint64_t)cdb[4] << 8 | cdb[5];
+            *count = (uint32_t)cdb[6] << 24 | (uint32_t)cdb[7] << 16 | (uint32_t)cdb[8] << 8 | cdb[9];
+            return cdb[0];
+        case 0x88:
+            if(cdb_len != 16) return 0;
+
+            *lba = (uint64_t)cdb[2] << 56 | (uint64_t)cdb[3] << 48 | (uint64_t)cdb[4] << 40 | (uint64_t)cdb[5] << 32 |
+                   (uint64_t)cdb[6] << 24 | (uint64_t)cdb[7] << 16 | (uint64_t)cdb[8] << 8 | cdb[9];
+            *count = (uint32_t)cdb[10] << 24 | (uint32_t)cdb[11] << 16 | (uint32_t)cdb[12] << 8 | cdb[13];
+            return cdb[0];
+        default: return 0;
+    }
+}
+
+// Anything that sends data to the device, or changes or ejects the medium, may leave cached sectors stale
+static int ScsiModifiesMedium(const unsigned char* cdb, uint32_t cdb_len, int32_t direction)
+{
+    if(direction != AARUREMOTE_SCSI_DIRECTION_IN && direction != AARUREMOTE_SCSI_DIRECTION_NONE) return 1;
+
+    if(!cdb || cdb_len == 0) return 0;
+
+    switch(cdb[0])
+    {
+        case 0x04: // FORMAT UNIT
+        case 0x0A: // WRITE(6)
+        case 0x19: // ERASE(6)
+        case 0x1B: // START STOP UNIT
+        case 0x2A: // WRITE(10)
+        case 0x2C: // ERASE(10)
+        case 0x2E: // WRITE AND VERIFY(10)
+        case 0x41: // WRITE SAME(10)
+        case 0x5B: // CLOSE TRACK/SESSION
+        case 0x8A: // WRITE(16)
+        case 0x8E: // WRITE AND VERIFY(16)
+        case 0x93: // WRITE SAME(16)
+        case 0xA1: // BLANK
+        case 0xA6: // LOAD/UNLOAD MEDIUM
+        case 0xAA: // WRITE(12)
+        case 0xAE: // WRITE AND VERIFY(12)
+            return 1;
+        default: return 0;
+    }
+}
+
+// A unit attention follows a reset or a medium change, a not ready with no medium means it is gone
+static int ScsiMediumChanged(const unsigned char* sense, uint32_t sense_len)
+{
+    uint8_t key;
+    uint8_t asc;
+
+    if(sense_len < 3) return 0;
+
+    if((sense[0] & 0x7F) == 0x72 || (sense[0] & 0x7F) == 0x73)
+    {
+        key = sense[1] & 0x0F;
+        asc = sense[2];
+    }
+    else
+    {
+        key = sense[2] & 0x0F;
+        asc = sense_len > 12 ? sense[12] : 0;
+    }
+
+    return key == 0x06 || (key == 0x02 && asc == 0x3A);
+}
+
+static void ScsiCacheReset(ScsiCache* cache)
+{
+    uint32_t n;
+
+    cache->generation++;
+    cache->count          = 0;
+    cache->newest         = SCSI_CACHE_NONE;
+    cache->oldest         = SCSI_CACHE_NONE;
+    cache->last_count     = 0;
+    cache->prefetch_lba   = 0;
+    cache->prefetch_end   = 0;
+    cache->prefetch_count = 0;
+
+    if(cache->buckets)
+        for(n = 0; n <= cache->bucket_mask; n++) cache->buckets[n] = SCSI_CACHE_NONE;
+}
+
+// Entries are sized for a block size, a different one starts the cache over
+static int ScsiCacheSetBlockSize(ScsiCache* cache, uint32_t block_size)
+{
+    ScsiCacheEntry* new_entries;
+    uint32_t*       new_buckets;
+    uint32_t        capacity = cache->size / block_size;
+    uint32_t        buckets  = 1;
+
+    if(block_size == cache->block_size) return 0;
+
+    while(buckets < capacity) buckets <<= 1;
+
+    if(!cache->data) cache->data = malloc(cache->size);
+
+    new_entries = realloc(cache->entries, sizeof(ScsiCacheEntry) * capacity);
+
+    if(new_entries) cache->entries = new_entries;
+
+    new_buckets = realloc(cache->buckets, sizeof(uint32_t) * buckets);
+
+    if(new_buckets) cache->buckets = new_buckets;
+
+    if(!cache->data || !new_entries || !new_buckets)
+    {
+        cache->block_size = 0;
+        return -1;
+    }
+
+    cache->block_size  = block_size;
+    cache->capacity    = capacity;
+    cache->bucket_mask = buckets - 1;
+    ScsiCacheReset(cache);
+
+    return 0;
+}
+
+static uint32_t ScsiCacheFind(ScsiCache* cache, uint64_t lba)
+{
+    uint32_t index = cache->buckets[lba & cache->bucket_mask];
+
+    while(index != SCSI_CACHE_NONE && cache->entries[index].lba != lba) index = cache->entries[index].chain;
+
+    return index;
+}
+
+static void ScsiCacheUnlink(ScsiCache* cache, uint32_t index)
+{
+    ScsiCacheEntry* entry = &cache->entries[index];
+
+    if(entry->newer != SCSI_CACHE_NONE)
+        cache->entries[entry->newer].older = entry->older;
+    else
+        cache->newest = entry->older;
+
+    if(entry->older != SCSI_CACHE_NONE)
+        cache->entries[entry->older].newer = entry->newer;
+    else
+        cache->oldest = entry->newer;
+}
+
+static void ScsiCacheTouch(ScsiCache* cache, uint32_t index)
+{
+    ScsiCacheEntry* entry = &cache->entries[index];
+
+    entry->newer = SCSI_CACHE_NONE;
+    entry->older = cache->newest;
+
+    if(cache->newest != SCSI_CACHE_NONE) cache->entries[cache->newest].newer = index;
+
+    cache->newest = index;
+
+    if(cache->oldest == SCSI_CACHE_NONE) cache->oldest = index;
+}
+
+static void ScsiCacheInsert(ScsiCache* cache, uint64_t lba, const char* data)
+{
+    uint32_t* link;
+    uint32_t  index = ScsiCacheFind(cache, lba);
+
+    if(index != SCSI_CACHE_NONE)
+        ScsiCacheUnlink(cache, index);
+    else
+    {
+        if(cache->count < cache->capacity)
+            index = cache->count++;
+        else
+        {
+            // Evict the least recently used sector
+            index = cache->oldest;
+            ScsiCacheUnlink(cache, index);
+
+            for(link = &cache->buckets[cache->entries[index].lba & cache->bucket_mask]; *link != index;
+                link = &cache->entries[*link].chain)
+                ;
+
+            *link = cache->entries[index].chain;
+        }
+
+        cache->entries[index].lba   = lba;
+        cache->entries[index].chain = cache->buckets[lba & cache->bucket_mask];
+        cache->buckets[lba & cache->bucket_mask] = index;
+    }
+
+    memcpy(cache->data + (size_t)index * cache->block_size, data, cache->block_size);
+    ScsiCacheTouch(cache, index);
+}
+
+// Only a read that is cached whole is served, so the device still reports every error itself
+static int ScsiCacheLookup(ScsiCache* cache, uint64_t lba, uint32_t count, uint32_t block_size, char* buffer)
+{
+    uint32_t n;
+    uint32_t index;
+
+    if(block_size != cache->block_size || count > cache->count) return 0;
+
+    for(n = 0; n < count; n++)
+        if(ScsiCacheFind(cache, lba + n) == SCSI_CACHE_NONE) return 0;
+
+    if(!buffer) return 1;
+
+    for(n = 0; n < count; n++)
+    {
+        index = ScsiCacheFind(cache, lba + n);
+        memcpy(buffer + (size_t)n * block_size, cache->data + (size_t)index * block_size, block_size);
+        ScsiCacheUnlink(cache, index);
+        ScsiCacheTouch(cache, index);
+    }
+
+    return 1;
+}
+
+// Reads that continue the previous one keep the prefetcher a few reads ahead, anything else stops it
+static void ScsiCacheFollow(ScsiCache* cache, uint8_t opcode, uint64_t lba, uint32_t count, uint32_t timeout)
+{
+    uint64_t end = lba + count + (uint64_t)count * AARUREMOTE_SCSI_PREFETCH_READS;
+
+    if(cache->last_count > 0 && lba == cache->next_lba && end - lba <= cache->capacity / 2)
+    {
+        if(cache->prefetch_lba < lba + count || cache->prefetch_count != count || cache->prefetch_opcode != opcode)
+            cache->prefetch_lba = lba + count;
+
+        cache->prefetch_end     = end;
+        cache->prefetch_count   = count;
+        cache->prefetch_opcode  = opcode;
+        cache->prefetch_timeout = timeout;
+
+        SemaphorePost(cache->wake);
+    }
+    else
+        cache->prefetch_end = cache->prefetch_lba;
+
+    cache->next_lba   = lba + count;
+    cache->last_count = count;
+}
+
+static void* ScsiCacheLoop(void* arguments)
+{
+    ScsiCache*    cache = arguments;
+    unsigned char cdb[16];
+    char          sense_buf[AARUREMOTE_SENSE_BUFFER_SIZE];
+    char*         new_buf;
+    uint64_t      lba;
+    uint32_t      count;
+    uint32_t      block_size;
+    uint32_t      generation;
+    uint32_t      timeout;
+    uint32_t      cdb_len;
+    uint32_t      buf_len;
+    uint32_t      sense_len;
+    uint32_t      duration;
+    uint32_t      sense;
+    uint32_t      n;
+    int32_t       ret;
+    uint8_t       stop = 0;
+
+    while(!stop)
+    {
+        SemaphoreWait(cache->wake);
+
+        for(;;)
+        {
+            MutexLock(cache->mutex);
+
+            stop = cache->stop;
+
+            if(stop || cache->prefetch_lba >= cache->prefetch_end)
+            {
+                MutexUnlock(cache->mutex);
+                break;
+            }
+
+            lba        = cache->prefetch_lba;
+            count      = cache->prefetch_count;
+            block_size = cache->block_size;
+            generation = cache->generation;
+            timeout    = cache->prefetch_timeout;
+            cdb_len    = BuildScsiRead(cdb, cache->prefetch_opcode, lba, count);
+
+            cache->prefetch_lba += count;
+
+            // Nothing to do when the client already read it, or an earlier prefetch did
+            if(cdb_len == 0 || ScsiCacheLookup(cache, lba, count, block_size, NULL))
+            {
+                MutexUnlock(cache->mutex);
+                continue;
+            }
+
+            MutexUnlock(cache->mutex);
+
+            if(count * block_size > cache->prefetch_size)
+            {
+                // Nothing in it is kept, and an aligned one lets the kernel read straight into it
+                new_buf = DmaAlloc(count * block_size);
+
+                if(!new_buf) continue;
+
+                DmaFree(cache->prefetch_buf);
+                cache->prefetch_buf  = new_buf;
+                cache->prefetch_size = count * block_size;
+            }
+
+            buf_len   = count * block_size;
+            sense_len = sizeof(sense_buf);
+            sense     = 0;
+
+            MutexLock(cache->device_mutex);
+            ret = SendScsiCommand(cache->device_ctx,
+                                  (char*)cdb,
+                                  cache->prefetch_buf,
+                                  sense_buf,
+                                  timeout,
+                                  AARUREMOTE_SCSI_DIRECTION_IN,
+                                  &duration,
+                                  &sense,
+                                  cdb_len,
+                                  &buf_len,
+                                  &sense_len);
+            MutexUnlock(cache->device_mutex);
+
+            MutexLock(cache->mutex);
+
+            // Whatever was invalidated meanwhile may have been read before the medium changed
+            if(generation == cache->generation)
+            {
+                if(ret == 0 && !sense)
+                {
+                    for(n = 0; n < count; n++)
+                        ScsiCacheInsert(cache, lba + n, cache->prefetch_buf + (size_t)n * block_size);
+
+                    cache->prefetched += count;
+                }
+                // Errors are left for the client's own read to find
+                else
+                    cache->prefetch_end = cache->prefetch_lba;
+            }
+
+            MutexUnlock(cache->mutex);
+        }
+    }
+
+    SemaphorePost(cache->stopped);
+
+    return NULL;
+}
+
+void* ScsiCacheCreate(void* device_ctx, uint32_t size)
+{
+    ScsiCache* cache;
+
+    if(!device_ctx || size == 0) return NULL;
+
+    cache = malloc(sizeof(ScsiCache));
+
+    if(!cache) return NULL;
+
+    memset(cache, 0, sizeof(ScsiCache));
+
+    cache->device_ctx   = device_ctx;
+    cache->size         = size;
+    cache->device_mutex = MutexCreate();
+    cache->mutex        = MutexCreate();
+    cache->wake         = SemaphoreCreate(0);
+    cache->stopped      = SemaphoreCreate(0);
+
+    if(!cache->device_mutex || !cache->mutex || !cache->wake || !cache->stopped ||
+       StartWorkerThread(ScsiCacheLoop, cache) != 0)
+    {
+        MutexFree(cache->device_mutex);
+        MutexFree(cache->mutex);
+        SemaphoreFree(cache->wake);
+        SemaphoreFree(cache->stopped);
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void ScsiCacheFree(void* scsi_cache)
+{
+    ScsiCache* cache = scsi_cache;
+
+    if(!cache) return;
+
+    // The prefetcher may be in the middle of a read, the device must not go away under it
+    MutexLock(cache->mutex);
+    cache->stop = 1;
+    MutexUnlock(cache->mutex);
+
+    SemaphorePost(cache->wake);
+    SemaphoreWait(cache->stopped);
+
+    MutexFree(cache->device_mutex);
+    MutexFree(cache->mutex);
+    SemaphoreFree(cache->wake);
+    SemaphoreFree(cache->stopped);
+    free(cache->data);
+    free(cache->entries);
+    free(cache->buckets);
+    DmaFree(cache->prefetch_buf);
+    free(cache);
+}
+
+void ScsiCacheInvalidate(void* scsi_cache)
+{
+    ScsiCache* cache = scsi_cache;
+
+    if(!cache) return;
+
+    MutexLock(cache->mutex);
+    ScsiCacheReset(cache);
+    MutexUnlock(cache->mutex);
+}
+
+// Commands that bypass the cache still wait for a prefetch in flight, and drop whatever they may have changed
+void ScsiCacheLockDevice(void* scsi_cache)
+{
+    ScsiCache* cache = scsi_cache;
+
+    if(cache) MutexLock(cache->device_mutex);
+}
+
+void ScsiCacheUnlockDevice(void* scsi_cache, uint8_t modified)
+{
+    ScsiCache* cache = scsi_cache;
+
+    if(!cache) return;
+
+    if(modified) ScsiCacheInvalidate(cache);
+
+    MutexUnlock(cache->device_mutex);
+}
+
+void ScsiCacheStats(void* scsi_cache, uint64_t* hits, uint64_t* misses, uint64_t* prefetched)
+{
+    ScsiCache* cache = scsi_cache;
+
+    if(!cache) return;
+
+    MutexLock(cache->mutex);
+    *hits += cache->hits;
+    *misses += cache->misses;
+    *prefetched += cache->prefetched;
+    MutexUnlock(cache->mutex);
+}
+
+int32_t ScsiCacheCommand(void*     scsi_cache,
+                         char*     cdb,
+                         char*     buffer,
+                         char*     sense_buffer,
+                         uint32_t  timeout,
+                         int32_t   direction,
+                         uint32_t* duration,
+                         uint32_t* sense,
+                         uint32_t  cdb_len,
+                         uint32_t* buf_len,
+                         uint32_t* sense_len)
+{
+    ScsiCache* cache      = scsi_cache;
+    uint64_t   lba        = 0;
+    uint32_t   count      = 0;
+    uint32_t   block_size = 0;
+    uint32_t   generation = 0;
+    uint32_t   n;
+    uint8_t    opcode = 0;
+    int        modifies;
+    int        hit = 0;
+    int32_t    ret;
+
+    if(cdb && buffer && direction == AARUREMOTE_SCSI_DIRECTION_IN)
+        opcode = ParseScsiRead((unsigned char*)cdb, cdb_len, &lba, &count);
+
+    // Sectors larger than a sixty-fourth of the cache would not leave room for a useful number of them
+    if(opcode && count > 0 && *buf_len % count == 0) block_size = *buf_len / count;
+
+    if(block_size == 0 || block_size > cache->size / SCSI_CACHE_MIN_ENTRIES) opcode = 0;
+
+    modifies = ScsiModifiesMedium((unsigned char*)cdb, cdb_len, direction);
+
+    if(opcode)
+    {
+        MutexLock(cache->mutex);
+
+        if(ScsiCacheSetBlockSize(cache, block_size) == 0)
+        {
+            hit = ScsiCacheLookup(cache, lba, count, block_size, buffer);
+            ScsiCacheFollow(cache, opcode, lba, count, timeout);
+        }
+        else
+            opcode = 0;
+
+        if(hit) cache->hits++;
+
+        MutexUnlock(cache->mutex);
+    }
+    else if(modifies)
+        ScsiCacheInvalidate(cache);
+
+    // Waits for a prefetch in flight, which may be the very sectors asked for
+    if(!hit) MutexLock(cache->device_mutex);
+
+    if(!hit && opcode)
+    {
+        MutexLock(cache->mutex);
+
+        hit        = ScsiCacheLookup(cache, lba, count, block_size, buffer);
+        generation = cache->generation;
+
+        if(hit)
+            cache->hits++;
+        else
+            cache->misses++;
+
+        MutexUnlock(cache->mutex);
+
+        if(hit) MutexUnlock(cache->device_mutex);
+    }
+
+    if(hit)
+    {
+        *duration  = 0;
+        *sense     = 0;
+        *sense_len = 0;
+        return 0;
+    }
+
+    ret = SendScsiCommand(
+        cache->device_ctx, cdb, buffer, sense_buffer, timeout, direction, duration, sense, cdb_len, buf_len, sense_len);
+
+    MutexUnlock(cache->device_mutex);
+
+    if(modifies || (*sense && ScsiMediumChanged((unsigned char*)sense_buffer, *sense_len)))
+        ScsiCacheInvalidate(cache);
+    else if(opcode && ret == 0 && !*sense && *buf_len == count * block_size)
+    {
+        MutexLock(cache->mutex);
+
+        if(generation == cache->generation)
+            for(n = 0; n < count; n++) ScsiCacheInsert(cache, lba + n, buffer + (size_t)n * block_size);
+
+        MutexUnlock(cache->mutex);
+    }
+
+    return ret;
+}
@@ -0,0 +1,151 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../endian.h"
+#include "client.h"
+
+#define ALLOC_IMAGE "alloc.img"
+#define ALLOC_IMAGE_SIZE (8 * 1024 * 1024)
+#define ALLOC_SHORT_ROUNDS 20
+#define ALLOC_LONG_ROUNDS 200
+
+// Sizes a client mixes while dumping, from a sector to a streamed read
+static const uint32_t read_sizes[] = {512, 4096, 65536, AARUREMOTE_STREAM_CHUNK_SIZE, 4 * AARUREMOTE_STREAM_CHUNK_SIZE};
+
+static int ReadImage(TestClient* client, uint64_t offset, uint32_t length)
+{
+    AaruPacketCmdOsRead       pkt_cmd_osread;
+    AaruPacketResOsReadChunk* pkt_res_chunk;
+    AaruPacketHeader*         pkt_hdr;
+
+    pkt_cmd_osread.offset = htole64(offset);
+    pkt_cmd_osread.length = htole32(length);
+
+    if(TestSend(client,
+                AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD,
+                0,
+                (char*)&pkt_cmd_osread + sizeof(AaruPacketHeader),
+                sizeof(AaruPacketCmdOsRead) - sizeof(AaruPacketHeader)) < 0)
+        return -1;
+
+    // Large reads come back in chunks, the last one says so
+    for(;;)
+    {
+        pkt_hdr = TestRecv(client);
+
+        if(!pkt_hdr) return -1;
+
+        if(pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD)
+            return ((AaruPacketResOsRead*)pkt_hdr)->error_no == 0 ? 0 : -1;
+
+        if(pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD_CHUNK) return -1;
+
+        pkt_res_chunk = (AaruPacketResOsReadChunk*)pkt_hdr;
+
+        if(pkt_res_chunk->error_no != 0) return -1;
+
+        if(pkt_res_chunk->last) return 0;
+    }
+}
+
+// Runs a session of the given length on a server of its own, and returns how many heap allocations it needed
+static int Session(const char* server_path, const char* log_path, uint32_t rounds, uint64_t* mallocs)
+{
+    TestClient        client;
+    AaruPacketHeader* pkt_hdr;
+    pid_t             server;
+    uint64_t          offset;
+    uint32_t          round;
+    uint32_t          n;
+    int               failed = 1;
+
+    server = TestServerStart(server_path, log_path);
+
+    if(server < 0) return -1;
+
+    if(TestConnect(&client, 0) == 0 && TestHello(&client, 0) == 0 && TestOpen(&client, ALLOC_IMAGE) == 0)
+    {
+        failed = 0;
+
+        for(round = 0; round < rounds && !failed; round++)
+        {
+            pkt_hdr = TestSend(&client, AARUREMOTE_PACKET_TYPE_COMMAND_AM_I_ROOT, 0, NULL, 0) < 0 ? NULL
+                                                                                                 : TestRecv(&client);
+            failed  = !pkt_hdr || pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_AM_I_ROOT;
+
+            for(n = 0; n < sizeof(read_sizes) / sizeof(uint32_t) && !failed; n++)
+            {
+                offset = ((uint64_t)round * AARUREMOTE_STREAM_CHUNK_SIZE) % (ALLOC_IMAGE_SIZE - read_sizes[n]);
+                failed = ReadImage(&client, offset, read_sizes[n]) < 0;
+            }
+        }
+    }
+
+    TestClose(&client);
+
+    if(failed) printf("Commands were not answered\n");
+    else if(TestWaitLog(log_path, "Client 127.0.0.1 needed %llu heap allocations to process its packets.", mallocs, NULL))
+        failed = 1;
+
+    TestServerStop(server);
+
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t short_mallocs;
+    uint64_t long_mallocs;
+    int      failed;
+
+    if(argc < 2)
+    {
+        printf("Usage: %s <aaruremote>\n", argv[0]);
+        return 1;
+    }
+
+    if(TestWriteImage(ALLOC_IMAGE, ALLOC_IMAGE_SIZE, 0) < 0)
+    {
+        printf("Could not write %s\n", ALLOC_IMAGE);
+        return 1;
+    }
+
+    failed = Session(argv[1], "alloc-short.log", ALLOC_SHORT_ROUNDS, &short_mallocs) < 0 ||
+             Session(argv[1], "alloc-long.log", ALLOC_LONG_ROUNDS, &long_mallocs) < 0;
+
+    unlink(ALLOC_IMAGE);
+
+    if(!failed)
+    {
+        printf("%u commands needed %llu heap allocations, %u commands needed %llu\n",
+               ALLOC_SHORT_ROUNDS * (1 + (uint32_t)(sizeof(read_sizes) / sizeof(uint32_t))),
+               (unsigned long long)short_mallocs,
+               ALLOC_LONG_ROUNDS * (1 + (uint32_t)(sizeof(read_sizes) / sizeof(uint32_t))),
+               (unsigned long long)long_mallocs);
+
+        // Only warming up allocates, ten times the commands must not need a single allocation more
+        failed = long_mallocs > short_mallocs;
+    }
+
+    printf(failed ? "Commands allocate from the heap once warmed up\n" : "Commands do not allocate once warmed up\n");
+
+    return failed;
+}
@@ -0,0 +1,472 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../endian.h"
+#include "client.h"
+
+// Runs the server in the background with its log in a file, and waits until it takes clients
+pid_t TestServerStart(const char* server, const char* log_path)
+{
+    TestClient probe;
+    pid_t      pid;
+    int        fd;
+    int        status;
+    int        n;
+
+    unlink(TEST_LOCAL_SOCKET);
+
+    pid = fork();
+
+    if(pid < 0) return -1;
+
+    if(pid == 0)
+    {
+        fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        setenv("AARUREMOTE_LOCAL_SOCKET", TEST_LOCAL_SOCKET, 1);
+        execl(server, server, (char*)NULL);
+        _exit(127);
+    }
+
+    // Only this server listens on this socket, so reaching it means the TCP port is this server's too
+    for(n = 0; n < TEST_SERVER_TIMEOUT * 10; n++)
+    {
+        if(waitpid(pid, &status, WNOHANG) == pid)
+        {
+            printf("Server exited before taking clients, see %s\n", log_path);
+            return -1;
+        }
+
+        // Taking its hello first lets the server see an orderly close
+        if(TestConnect(&probe, 1) == 0)
+        {
+            TestRecv(&probe);
+            TestClose(&probe);
+            return pid;
+        }
+
+        usleep(100000);
+    }
+
+    printf("Server did not take clients in %d seconds, see %s\n", TEST_SERVER_TIMEOUT, log_path);
+    TestServerStop(pid);
+    return -1;
+}
+
+void TestServerStop(pid_t pid)
+{
+    if(pid <= 0) return;
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(TEST_LOCAL_SOCKET);
+}
+
+int TestConnect(TestClient* client, uint8_t local)
+{
+    struct sockaddr_in tcp_addr;
+    struct sockaddr_un local_addr;
+    int                one = 1;
+    int                ret;
+
+    memset(client, 0, sizeof(TestClient));
+
+    client->fd = socket(local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+
+    if(client->fd < 0) return -1;
+
+    if(local)
+    {
+        memset(&local_addr, 0, sizeof(struct sockaddr_un));
+        local_addr.sun_family = AF_UNIX;
+        strncpy(local_addr.sun_path, TEST_LOCAL_SOCKET, sizeof(local_addr.sun_path) - 1);
+
+        ret = connect(client->fd, (struct sockaddr*)&local_addr, sizeof(struct sockaddr_un));
+    }
+    else
+    {
+        memset(&tcp_addr, 0, sizeof(struct sockaddr_in));
+        tcp_addr.sin_family      = AF_INET;
+        tcp_addr.sin_port        = htons(AARUREMOTE_PORT);
+        tcp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+        ret = connect(client->fd, (struct sockaddr*)&tcp_addr, sizeof(struct sockaddr_in));
+    }
+
+    if(ret < 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Takes the server's hello, answers with the newest protocol, and skips the capabilities that follow it
+int TestHello(TestClient* client, uint8_t flags)
+{
+    AaruPacketHello   pkt_hello;
+    AaruPacketHeader* pkt_hdr;
+
+    pkt_hdr = TestRecv(client);
+
+    if(!pkt_hdr || pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_HELLO) return -1;
+
+    memset(&pkt_hello, 0, sizeof(AaruPacketHello));
+    strncpy(pkt_hello.application, "aaruremote tests", sizeof(pkt_hello.application) - 1);
+    strncpy(pkt_hello.version, AARUREMOTE_VERSION, sizeof(pkt_hello.version) - 1);
+    strncpy(pkt_hello.sysname, "test", sizeof(pkt_hello.sysname) - 1);
+    pkt_hello.max_protocol = AARUREMOTE_PROTOCOL_MAX;
+    pkt_hello.flags        = flags;
+
+    if(TestSend(client,
+                AARUREMOTE_PACKET_TYPE_HELLO,
+                0,
+                (char*)&pkt_hello + sizeof(AaruPacketHeader),
+                sizeof(AaruPacketHello) - sizeof(AaruPacketHeader)) < 0)
+        return -1;
+
+    pkt_hdr = TestRecv(client);
+
+    return pkt_hdr && pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_CAPABILITIES ? 0 : -1;
+}
+
+int TestSend(TestClient* client, int8_t packet_type, uint16_t tag, const void* body, uint32_t len)
+{
+    AaruPacketHeader pkt_hdr;
+    struct iovec     iov[2];
+    struct msghdr    msg;
+    ssize_t          sent;
+    size_t           total = sizeof(AaruPacketHeader) + len;
+
+    memset(&pkt_hdr, 0, sizeof(AaruPacketHeader));
+    pkt_hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_hdr.len         = htole32((uint32_t)total);
+    pkt_hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_hdr.packet_type = packet_type;
+    pkt_hdr.tag         = htole16(tag);
+
+    iov[0].iov_base = &pkt_hdr;
+    iov[0].iov_len  = sizeof(AaruPacketHeader);
+    iov[1].iov_base = (void*)body;
+    iov[1].iov_len  = len;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+
+    while(total > 0)
+    {
+        sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+
+        if(sent < 0 && errno == EINTR) continue;
+
+        if(sent <= 0) return -1;
+
+        total -= (size_t)sent;
+
+        while(msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov[0].iov_len)
+        {
+            sent -= (ssize_t)msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+
+        if(msg.msg_iovlen > 0)
+        {
+            msg.msg_iov[0].iov_base = (char*)msg.msg_iov[0].iov_base + sent;
+            msg.msg_iov[0].iov_len -= (size_t)sent;
+        }
+    }
+
+    return 0;
+}
+
+static int RecvAll(TestClient* client, char* buf, uint32_t len)
+{
+    ssize_t got;
+
+    while(len > 0)
+    {
+        got = recv(client->fd, buf, len, 0);
+
+        if(got < 0 && errno == EINTR) continue;
+
+        if(got <= 0) return -1;
+
+        buf += got;
+        len -= (uint32_t)got;
+        client->received += (uint64_t)got;
+    }
+
+    return 0;
+}
+
+// Reads a whole packet into the client's buffer, that stays valid until the next one
+AaruPacketHeader* TestRecv(TestClient* client)
+{
+    AaruPacketHeader pkt_hdr;
+    uint32_t         len;
+    char*            new_buf;
+
+    if(RecvAll(client, (char*)&pkt_hdr, sizeof(AaruPacketHeader)) < 0) return NULL;
+
+    len = le32toh(pkt_hdr.len);
+
+    if(le32toh(pkt_hdr.remote_id) != AARUREMOTE_REMOTE_ID || le32toh(pkt_hdr.packet_id) != AARUREMOTE_PACKET_ID ||
+       len < sizeof(AaruPacketHeader))
+    {
+        printf("Received a malformed packet\n");
+        return NULL;
+    }
+
+    if(len > client->size)
+    {
+        new_buf = realloc(client->buf, len);
+
+        if(!new_buf) return NULL;
+
+        client->buf  = new_buf;
+        client->size = len;
+    }
+
+    memcpy(client->buf, &pkt_hdr, sizeof(AaruPacketHeader));
+
+    if(RecvAll(client, client->buf + sizeof(AaruPacketHeader), len - (uint32_t)sizeof(AaruPacketHeader)) < 0)
+        return NULL;
+
+    return (AaruPacketHeader*)client->buf;
+}
+
+// Rebuilds the response a zero block elided one stands for, anything else is returned as it is
+AaruPacketHeader* TestExpand(TestClient* client, AaruPacketHeader* pkt_hdr)
+{
+    AaruPacketResSparse* pkt_res_sparse = (AaruPacketResSparse*)pkt_hdr;
+    const uint8_t*       map;
+    const char*          in;
+    const char*          end;
+    char*                out;
+    char*                new_raw;
+    uint32_t             raw_len;
+    uint32_t             prefix_len;
+    uint32_t             block_size;
+    uint32_t             blocks;
+    uint32_t             size;
+    uint32_t             n;
+
+    if(!pkt_hdr || pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_SPARSE) return pkt_hdr;
+
+    raw_len    = le32toh(pkt_res_sparse->raw_len);
+    prefix_len = le32toh(pkt_res_sparse->prefix_len);
+    block_size = le32toh(pkt_res_sparse->block_size);
+    blocks     = le32toh(pkt_res_sparse->block_count);
+    in         = (const char*)(pkt_res_sparse + 1);
+    end        = (const char*)pkt_hdr + le32toh(pkt_hdr->len);
+
+    if(prefix_len < sizeof(AaruPacketHeader) || prefix_len > raw_len || block_size == 0 ||
+       blocks != (raw_len - prefix_len + block_size - 1) / block_size || in + prefix_len + (blocks + 7) / 8 > end)
+    {
+        printf("Received a malformed sparse response\n");
+        return NULL;
+    }
+
+    if(raw_len > client->raw_size)
+    {
+        new_raw = realloc(client->raw, raw_len);
+
+        if(!new_raw) return NULL;
+
+        client->raw      = new_raw;
+        client->raw_size = raw_len;
+    }
+
+    memcpy(client->raw, in, prefix_len);
+    map = (const uint8_t*)in + prefix_len;
+    in += prefix_len + (blocks + 7) / 8;
+    out = client->raw + prefix_len;
+
+    for(n = 0; n < blocks; n++)
+    {
+        size = raw_len - prefix_len - n * block_size < block_size ? raw_len - prefix_len - n * block_size : block_size;
+
+        if(map[n / 8] & (1 << (n % 8))) memset(out, 0, size);
+        else if(in + size > end)
+        {
+            printf("Received a sparse response shorter than its blocks\n");
+            return NULL;
+        }
+        else
+        {
+            memcpy(out, in, size);
+            in += size;
+        }
+
+        out += size;
+    }
+
+    if(in != end)
+    {
+        printf("Received a sparse response longer than its blocks\n");
+        return NULL;
+    }
+
+    return (AaruPacketHeader*)client->raw;
+}
+
+int TestOpen(TestClient* client, const char* path)
+{
+    AaruPacketCmdOpen pkt_cmd_open;
+    AaruPacketNop*    pkt_nop;
+
+    memset(&pkt_cmd_open, 0, sizeof(AaruPacketCmdOpen));
+    strncpy(pkt_cmd_open.device_path, path, sizeof(pkt_cmd_open.device_path) - 1);
+
+    if(TestSend(client,
+                AARUREMOTE_PACKET_TYPE_COMMAND_OPEN_DEVICE,
+                0,
+                (char*)&pkt_cmd_open + sizeof(AaruPacketHeader),
+                sizeof(AaruPacketCmdOpen) - sizeof(AaruPacketHeader)) < 0)
+        return -1;
+
+    pkt_nop = (AaruPacketNop*)TestRecv(client);
+
+    return pkt_nop && pkt_nop->hdr.packet_type == AARUREMOTE_PACKET_TYPE_NOP &&
+                   pkt_nop->reason_code == AARUREMOTE_PACKET_NOP_REASON_OPEN_OK
+               ? 0
+               : -1;
+}
+
+void TestClose(TestClient* client)
+{
+    if(client->fd >= 0) close(client->fd);
+
+    free(client->buf);
+    free(client->raw);
+    client->fd       = -1;
+    client->buf      = NULL;
+    client->size     = 0;
+    client->raw      = NULL;
+    client->raw_size = 0;
+}
+
+// Stand-in media, with contents a read can be checked against without keeping a copy
+uint8_t TestImageByte(uint64_t offset, uint32_t seed)
+{
+    uint32_t word = (uint32_t)(offset >> 2) * 2654435761U + seed;
+
+    return (uint8_t)(word >> ((offset & 3) * 8));
+}
+
+int TestWriteImage(const char* path, uint64_t size, uint32_t seed)
+{
+    char     buf[65536];
+    FILE*    file;
+    uint64_t off;
+    uint32_t len;
+    uint32_t n;
+
+    file = fopen(path, "wb");
+
+    if(!file) return -1;
+
+    for(off = 0; off < size; off += len)
+    {
+        len = size - off < sizeof(buf) ? (uint32_t)(size - off) : (uint32_t)sizeof(buf);
+
+        for(n = 0; n < len; n++) buf[n] = (char)TestImageByte(off + n, seed);
+
+        if(fwrite(buf, 1, len, file) != len)
+        {
+            fclose(file);
+            return -1;
+        }
+    }
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// Waits for the server to log a line with two numbers in it, or one when second is NULL, like the counters it prints
+// when a client goes
+int TestWaitLog(const char* log_path, const char* format, uint64_t* first, uint64_t* second)
+{
+    FILE*              log;
+    char               line[512];
+    unsigned long long a;
+    unsigned long long b;
+    int                n;
+
+    for(n = 0; n < TEST_SERVER_TIMEOUT * 10; n++)
+    {
+        log = fopen(log_path, "r");
+
+        while(log && fgets(line, sizeof(line), log))
+        {
+            if(sscanf(line, format, &a, &b) != (second ? 2 : 1)) continue;
+
+            fclose(log);
+            *first = a;
+
+            if(second) *second = b;
+
+            return 0;
+        }
+
+        if(log) fclose(log);
+
+        usleep(100000);
+    }
+
+    printf("Server did not log \"%s\" in %d seconds\n", format, TEST_SERVER_TIMEOUT);
+    return -1;
+}
+
+double TestSeconds()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
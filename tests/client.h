@@ -0,0 +1,54 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AARUREMOTE_TESTS_CLIENT_H_
+#define AARUREMOTE_TESTS_CLIENT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../aaruremote.h"
+
+// Relative to the test's directory, that the server inherits, so it stays short enough for sun_path
+#define TEST_LOCAL_SOCKET "aaruremote-test.sock"
+#define TEST_SERVER_TIMEOUT 10
+
+typedef struct
+{
+    int      fd;
+    char*    buf;
+    uint32_t size;
+    char*    raw;
+    uint32_t raw_size;
+    uint64_t received;
+} TestClient;
+
+pid_t             TestServerStart(const char* server, const char* log_path);
+void              TestServerStop(pid_t pid);
+int               TestConnect(TestClient* client, uint8_t local);
+int               TestHello(TestClient* client, uint8_t flags);
+int               TestSend(TestClient* client, int8_t packet_type, uint16_t tag, const void* body, uint32_t len);
+AaruPacketHeader* TestRecv(TestClient* client);
+AaruPacketHeader* TestExpand(TestClient* client, AaruPacketHeader* pkt_hdr);
+int               TestOpen(TestClient* client, const char* path);
+void              TestClose(TestClient* client);
+int               TestWriteImage(const char* path, uint64_t size, uint32_t seed);
+uint8_t           TestImageByte(uint64_t offset, uint32_t seed);
+int               TestWaitLog(const char* log_path, const char* format, uint64_t* first, uint64_t* second);
+double            TestSeconds();
+
+#endif // AARUREMOTE_TESTS_CLIENT_H_
@@ -0,0 +1,191 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../aaruremote.h"
+
+#define COMPRESS_MAX_SIZE (256 * 1024)
+
+// Worst case of a LZ4 block, all of it literals
+#define COMPRESS_BOUND(len) ((len) + (len) / 255 + 16)
+
+typedef enum
+{
+    COMPRESS_ZEROES,
+    COMPRESS_PATTERN,
+    COMPRESS_TEXT,
+    COMPRESS_NOISE,
+    COMPRESS_MIXED,
+    COMPRESS_FAR,
+    COMPRESS_KINDS
+} CompressKind;
+
+static const char* kind_names[] = {"zeroes", "pattern", "text", "noise", "mixed", "far matches"};
+
+static uint32_t seed = 1;
+
+static uint8_t Noise()
+{
+    seed = seed * 1103515245U + 12345U;
+    return (uint8_t)(seed >> 16);
+}
+
+static void Fill(uint8_t* buf, uint32_t len, CompressKind kind)
+{
+    static const char text[] = "The quick brown fox jumps over the lazy dog while the sectors spin. ";
+    uint32_t          n;
+
+    for(n = 0; n < len; n++)
+        switch(kind)
+        {
+            case COMPRESS_ZEROES: buf[n] = 0; break;
+            // Short periods make matches that overlap what they produce
+            case COMPRESS_PATTERN: buf[n] = (uint8_t)("abc"[n % 3]); break;
+            case COMPRESS_TEXT: buf[n] = (uint8_t)text[(n * 7 / 5) % (sizeof(text) - 1)]; break;
+            case COMPRESS_NOISE: buf[n] = Noise(); break;
+            case COMPRESS_MIXED: buf[n] = (n / 1000) % 2 ? Noise() : (uint8_t)(n / 1000); break;
+            // Repeats just under the largest offset a match can reach
+            default: buf[n] = n < 65000 ? Noise() : buf[n - 65000]; break;
+        }
+}
+
+static int RoundTrip(const uint8_t* in, uint32_t len, uint8_t* packed, uint8_t* out, uint32_t* table, uint32_t* size)
+{
+    int32_t packed_len;
+
+    packed_len = LzCompress(in, (int32_t)len, packed, COMPRESS_BOUND(len), table);
+
+    if(packed_len <= 0) return -1;
+
+    *size = (uint32_t)packed_len;
+
+    // Exactly the right room, one byte less must be refused rather than overrun
+    if(LzDecompress(packed, packed_len, out, (int32_t)len) != (int32_t)len || memcmp(in, out, len) != 0) return -1;
+
+    if(len > 0 && LzDecompress(packed, packed_len, out, (int32_t)len - 1) >= 0) return -1;
+
+    return 0;
+}
+
+static int CheckRoundTrips(uint8_t* in, uint8_t* packed, uint8_t* out, uint32_t* table)
+{
+    static const uint32_t lengths[] = {0, 1, 4, 5, 12, 13, 14, 15, 16, 19, 20, 270, 271, 4096, 65536, 65537,
+                                       COMPRESS_MAX_SIZE};
+    uint32_t              kind;
+    uint32_t              n;
+    uint32_t              size;
+    uint32_t              total;
+    uint32_t              total_packed;
+
+    for(kind = 0; kind < COMPRESS_KINDS; kind++)
+    {
+        total        = 0;
+        total_packed = 0;
+
+        for(n = 0; n < sizeof(lengths) / sizeof(uint32_t); n++)
+        {
+            Fill(in, lengths[n], kind);
+
+            if(RoundTrip(in, lengths[n], packed, out, table, &size) < 0)
+            {
+                printf("Round trip of %u bytes of %s failed\n", lengths[n], kind_names[kind]);
+                return -1;
+            }
+
+            total += lengths[n];
+            total_packed += size;
+        }
+
+        printf("%-11s %7u bytes packed to %7u\n", kind_names[kind], total, total_packed);
+    }
+
+    return 0;
+}
+
+// What other LZ4 block decoders produce for the same input, and inputs no encoder produces
+static int CheckDecoder(uint8_t* out)
+{
+    static const uint8_t block[]     = {0x36, 'a', 'b', 'c', 3, 0, 0x50, 'b', 'c', 'a', 'b', 'c'};
+    static const uint8_t no_offset[] = {0x14, 'a', 0, 0, 0x50, 'a', 'a', 'a', 'a', 'a'};
+    static const uint8_t far[]       = {0x14, 'a', 2, 0, 0x50, 'a', 'a', 'a', 'a', 'a'};
+    static const uint8_t truncated[] = {0xF0, 255};
+
+    if(LzDecompress(block, sizeof(block), out, 64) != 18 || memcmp(out, "abcabcabcabcabcabc", 18) != 0)
+    {
+        printf("A LZ4 block did not decode as expected\n");
+        return -1;
+    }
+
+    if(LzDecompress(no_offset, sizeof(no_offset), out, 64) >= 0 || LzDecompress(far, sizeof(far), out, 64) >= 0 ||
+       LzDecompress(truncated, sizeof(truncated), out, 64) >= 0)
+    {
+        printf("A malformed block was decoded\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Data that does not shrink by a sixteenth is sent raw, compressing it must give up instead of overrunning
+static int CheckIncompressible(uint8_t* in, uint8_t* packed, uint32_t* table)
+{
+    Fill(in, COMPRESS_MAX_SIZE, COMPRESS_NOISE);
+
+    if(LzCompress(in, COMPRESS_MAX_SIZE, packed, COMPRESS_MAX_SIZE - COMPRESS_MAX_SIZE / 16, table) != 0)
+    {
+        printf("Noise was compressed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main()
+{
+    uint8_t*  in;
+    uint8_t*  packed;
+    uint8_t*  out;
+    uint32_t* table;
+    int       failed;
+
+    in     = malloc(COMPRESS_MAX_SIZE);
+    packed = malloc(COMPRESS_BOUND(COMPRESS_MAX_SIZE));
+    out    = malloc(COMPRESS_MAX_SIZE);
+    table  = malloc(sizeof(uint32_t) << AARUREMOTE_LZ_HASH_BITS);
+
+    if(!in || !packed || !out || !table)
+    {
+        printf("Could not allocate the buffers\n");
+        return 1;
+    }
+
+    failed = CheckDecoder(out) < 0 || CheckRoundTrips(in, packed, out, table) < 0 ||
+             CheckIncompressible(in, packed, table) < 0;
+
+    free(in);
+    free(packed);
+    free(out);
+    free(table);
+
+    printf(failed ? "Compression does not round trip\n" : "Compression round trips\n");
+
+    return failed;
+}
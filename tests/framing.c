@@ -0,0 +1,116 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "../endian.h"
+#include "client.h"
+
+#define FRAMING_COMMANDS 1000
+
+// Small commands sent back to back, like a client polling registers, all of them in a single write
+static int SendBurst(TestClient* client)
+{
+    AaruPacketHeader* pkt_hdr;
+    char*             burst;
+    uint32_t          n;
+    int               ret;
+
+    burst = calloc(FRAMING_COMMANDS, sizeof(AaruPacketHeader));
+
+    if(!burst) return -1;
+
+    for(n = 0; n < FRAMING_COMMANDS; n++)
+    {
+        pkt_hdr              = (AaruPacketHeader*)burst + n;
+        pkt_hdr->remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+        pkt_hdr->packet_id   = htole32(AARUREMOTE_PACKET_ID);
+        pkt_hdr->len         = htole32(sizeof(AaruPacketHeader));
+        pkt_hdr->version     = AARUREMOTE_PACKET_VERSION;
+        pkt_hdr->packet_type = AARUREMOTE_PACKET_TYPE_COMMAND_AM_I_ROOT;
+        pkt_hdr->tag         = htole16((uint16_t)n);
+    }
+
+    ret = send(client->fd, burst, FRAMING_COMMANDS * sizeof(AaruPacketHeader), 0) ==
+                  (ssize_t)(FRAMING_COMMANDS * sizeof(AaruPacketHeader))
+              ? 0
+              : -1;
+
+    free(burst);
+    return ret;
+}
+
+static int RecvAnswers(TestClient* client, uint32_t count)
+{
+    AaruPacketHeader* pkt_hdr;
+
+    while(count-- > 0)
+    {
+        pkt_hdr = TestRecv(client);
+
+        if(!pkt_hdr || pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_AM_I_ROOT) return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    TestClient client;
+    pid_t      server;
+    uint64_t   packets;
+    uint64_t   calls;
+    int        failed = 1;
+
+    if(argc < 2)
+    {
+        printf("Usage: %s <aaruremote>\n", argv[0]);
+        return 1;
+    }
+
+    server = TestServerStart(argv[1], "framing.log");
+
+    if(server < 0) return 1;
+
+    if(TestConnect(&client, 0) == 0 && TestHello(&client, 0) == 0)
+        failed = SendBurst(&client) < 0 || RecvAnswers(&client, FRAMING_COMMANDS) < 0;
+
+    TestClose(&client);
+
+    if(failed) printf("Commands were not answered\n");
+    else if(TestWaitLog("framing.log", "Client 127.0.0.1 sent %llu packets using %llu receive calls.", &packets, &calls))
+        failed = 1;
+    else
+    {
+        printf("%llu packets in %llu receive calls, %.3f per packet\n",
+               (unsigned long long)packets,
+               (unsigned long long)calls,
+               (double)calls / (double)packets);
+
+        // Peeking at each header and then reading its packet took two calls for every one of them
+        failed = packets != FRAMING_COMMANDS + 1 || calls * 10 > packets;
+    }
+
+    TestServerStop(server);
+
+    printf(failed ? "Packets are not framed from buffered reads\n" : "Packets are framed from buffered reads\n");
+
+    return failed;
+}
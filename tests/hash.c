@@ -0,0 +1,150 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../aaruremote.h"
+
+#define ALL_HASHES                                                                                                     \
+    (AARUREMOTE_HASH_CRC32 | AARUREMOTE_HASH_CRC64 | AARUREMOTE_HASH_MD5 | AARUREMOTE_HASH_SHA1 | AARUREMOTE_HASH_SHA256)
+
+typedef struct
+{
+    const char* name;
+    uint32_t    length;
+    char        fill;
+    uint32_t    crc32;
+    uint64_t    crc64;
+    const char* md5;
+    const char* sha1;
+    const char* sha256;
+} HashVector;
+
+// Reference digests from zlib and Python's hashlib, the CRC64 is the ECMA-182 one used by xz
+static const HashVector vectors[] = {
+    {"123456789",
+     9,
+     0,
+     0xCBF43926,
+     0x995DC9BBDF1939FAULL,
+     "25f9e794323b453885f5181f1b624d0b",
+     "f7c3bc1d808e04732adf679965ccc34ca7ae3441",
+     "15e2b0d3c33891ebb0f1ef609ec419420c20e320ce94c65fbc8c3312448eb225"},
+    {"a million a",
+     1000000,
+     'a',
+     0xDC25BFBC,
+     0x7A0D29398112E1BAULL,
+     "7707d6ae4e027c70eea2a935c2296f21",
+     "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"}};
+
+// Odd sizes so updates straddle the 64 byte blocks and the folded CRC paths
+static const uint32_t pieces[] = {1, 3, 63, 64, 65, 4093, 65537};
+
+static int CheckDigest(const char* vector, const char* algorithm, const uint8_t* digest, uint32_t len, const char* hex)
+{
+    char     got[65];
+    uint32_t n;
+
+    for(n = 0; n < len; n++) sprintf(got + n * 2, "%02x", digest[n]);
+
+    if(strcmp(got, hex) == 0) return 0;
+
+    printf("%s of %s is %s, expected %s\n", algorithm, vector, got, hex);
+    return 1;
+}
+
+static int CheckVector(const HashVector* vector, const char* data, uint32_t piece)
+{
+    HashContext ctx;
+    uint32_t    crc32;
+    uint64_t    crc64;
+    uint8_t     md5[16];
+    uint8_t     sha1[20];
+    uint8_t     sha256[32];
+    uint32_t    off;
+    uint32_t    len;
+    int         failed = 0;
+
+    HashInit(&ctx, ALL_HASHES);
+
+    for(off = 0; off < vector->length; off += len)
+    {
+        len = vector->length - off < piece ? vector->length - off : piece;
+        HashUpdate(&ctx, data + off, len);
+    }
+
+    HashFinal(&ctx, &crc32, &crc64, md5, sha1, sha256);
+
+    if(crc32 != vector->crc32)
+    {
+        printf("CRC32 of %s is %08X, expected %08X\n", vector->name, crc32, vector->crc32);
+        failed = 1;
+    }
+
+    if(crc64 != vector->crc64)
+    {
+        printf("CRC64 of %s is %016llX, expected %016llX\n",
+               vector->name,
+               (unsigned long long)crc64,
+               (unsigned long long)vector->crc64);
+        failed = 1;
+    }
+
+    failed |= CheckDigest(vector->name, "MD5", md5, sizeof(md5), vector->md5);
+    failed |= CheckDigest(vector->name, "SHA1", sha1, sizeof(sha1), vector->sha1);
+    failed |= CheckDigest(vector->name, "SHA256", sha256, sizeof(sha256), vector->sha256);
+
+    return failed;
+}
+
+int main()
+{
+    char*    data;
+    uint32_t v;
+    uint32_t p;
+    int      failed = 0;
+
+    for(v = 0; v < sizeof(vectors) / sizeof(HashVector); v++)
+    {
+        data = malloc(vectors[v].length);
+
+        if(!data)
+        {
+            printf("Could not allocate %u bytes\n", vectors[v].length);
+            return 1;
+        }
+
+        if(vectors[v].fill) memset(data, vectors[v].fill, vectors[v].length);
+        else
+            memcpy(data, vectors[v].name, vectors[v].length);
+
+        failed |= CheckVector(&vectors[v], data, vectors[v].length);
+
+        for(p = 0; p < sizeof(pieces) / sizeof(uint32_t); p++) failed |= CheckVector(&vectors[v], data, pieces[p]);
+
+        free(data);
+    }
+
+    printf(failed ? "Hash digests do not match\n" : "Hash digests match\n");
+
+    return failed;
+}
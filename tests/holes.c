@@ -0,0 +1,223 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../endian.h"
+#include "client.h"
+
+#define HOLES_IMAGE "holes.img"
+#define HOLES_IMAGE_SIZE (64 * 1024 * 1024)
+#define HOLES_READ_SIZE AARUREMOTE_STREAM_CHUNK_SIZE
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t length;
+} HolesExtent;
+
+// The only data in the image, everything else is a hole, like a thin image of a mostly empty medium
+static const HolesExtent extents[] = {{0, 65536},
+                                      {1048576, 4096},
+                                      {3145728 + 8192, 262144},
+                                      {16777216 - 4096, 8192},
+                                      {33554432, 1048576},
+                                      {50331648 + 12288, 20480},
+                                      {HOLES_IMAGE_SIZE - 65536, 65536}};
+
+static uint8_t HolesByte(uint64_t offset)
+{
+    uint32_t n;
+
+    for(n = 0; n < sizeof(extents) / sizeof(HolesExtent); n++)
+        if(offset >= extents[n].offset && offset - extents[n].offset < extents[n].length)
+            return TestImageByte(offset, 0);
+
+    return 0;
+}
+
+// Returns how much of the image the filesystem allocated
+static int64_t WriteHolesImage()
+{
+    struct stat st;
+    char*       buf;
+    uint32_t    n;
+    uint32_t    i;
+    int         fd;
+    int         failed = 0;
+
+    fd = open(HOLES_IMAGE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(fd < 0) return -1;
+
+    buf = malloc(1048576);
+
+    if(!buf || ftruncate(fd, HOLES_IMAGE_SIZE) < 0) failed = 1;
+
+    for(n = 0; !failed && n < sizeof(extents) / sizeof(HolesExtent); n++)
+    {
+        for(i = 0; i < extents[n].length; i++) buf[i] = (char)TestImageByte(extents[n].offset + i, 0);
+
+        if(pwrite(fd, buf, extents[n].length, (off_t)extents[n].offset) != (ssize_t)extents[n].length) failed = 1;
+    }
+
+    free(buf);
+
+    if(fsync(fd) < 0 || fstat(fd, &st) < 0) failed = 1;
+
+    if(close(fd) < 0 || failed) return -1;
+
+    return (int64_t)st.st_blocks * 512;
+}
+
+// Reads the whole image, checking every byte, and returns how long it took
+static double ReadImage(TestClient* client, const char* expected)
+{
+    AaruPacketCmdOsRead  pkt_cmd_osread;
+    AaruPacketResOsRead* pkt_res_osread;
+    uint64_t             off;
+    double               start = TestSeconds();
+
+    for(off = 0; off < HOLES_IMAGE_SIZE; off += HOLES_READ_SIZE)
+    {
+        pkt_cmd_osread.offset = htole64(off);
+        pkt_cmd_osread.length = htole32(HOLES_READ_SIZE);
+
+        if(TestSend(client,
+                    AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD,
+                    0,
+                    (char*)&pkt_cmd_osread + sizeof(AaruPacketHeader),
+                    sizeof(AaruPacketCmdOsRead) - sizeof(AaruPacketHeader)) < 0)
+            return -1;
+
+        pkt_res_osread = (AaruPacketResOsRead*)TestExpand(client, TestRecv(client));
+
+        if(!pkt_res_osread || pkt_res_osread->hdr.packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD ||
+           pkt_res_osread->error_no != 0 ||
+           le32toh(pkt_res_osread->hdr.len) != sizeof(AaruPacketResOsRead) + HOLES_READ_SIZE)
+        {
+            printf("Bad response reading at %llu\n", (unsigned long long)off);
+            return -1;
+        }
+
+        if(memcmp(pkt_res_osread + 1, expected + off, HOLES_READ_SIZE) != 0)
+        {
+            printf("Wrong data reading at %llu\n", (unsigned long long)off);
+            return -1;
+        }
+    }
+
+    return TestSeconds() - start;
+}
+
+// Reads the image through a client of its own, and returns how many bytes it received
+static int64_t Transfer(const char* name, uint8_t flags, const char* expected)
+{
+    TestClient client;
+    double     elapsed = -1;
+
+    if(TestConnect(&client, 0) == 0 && TestHello(&client, flags) == 0 && TestOpen(&client, HOLES_IMAGE) == 0)
+    {
+        client.received = 0;
+        elapsed         = ReadImage(&client, expected);
+    }
+
+    TestClose(&client);
+
+    if(elapsed < 0)
+    {
+        printf("The %s client could not read the image\n", name);
+        return -1;
+    }
+
+    printf("%-7s client received %9llu bytes in %.3f seconds\n", name, (unsigned long long)client.received, elapsed);
+
+    return (int64_t)client.received;
+}
+
+int main(int argc, char** argv)
+{
+    char*    expected;
+    pid_t    server;
+    uint64_t off;
+    int64_t  allocated;
+    int64_t  data = 0;
+    int64_t  plain;
+    int64_t  sparse;
+    uint32_t n;
+    int      failed;
+
+    if(argc < 2)
+    {
+        printf("Usage: %s <aaruremote>\n", argv[0]);
+        return 1;
+    }
+
+    expected  = malloc(HOLES_IMAGE_SIZE);
+    allocated = expected ? WriteHolesImage() : -1;
+
+    if(allocated < 0)
+    {
+        printf("Could not write %s\n", HOLES_IMAGE);
+        free(expected);
+        unlink(HOLES_IMAGE);
+        return 1;
+    }
+
+    for(off = 0; off < HOLES_IMAGE_SIZE; off++) expected[off] = (char)HolesByte(off);
+
+    for(n = 0; n < sizeof(extents) / sizeof(HolesExtent); n++) data += extents[n].length;
+
+    server = TestServerStart(argv[1], "holes.log");
+
+    if(server < 0)
+    {
+        free(expected);
+        unlink(HOLES_IMAGE);
+        return 1;
+    }
+
+    plain  = Transfer("Plain", 0, expected);
+    sparse = Transfer("Sparse", AARUREMOTE_HELLO_FLAG_SPARSE, expected);
+
+    TestServerStop(server);
+    unlink(HOLES_IMAGE);
+    free(expected);
+
+    failed = plain < 0 || sparse < 0;
+
+    if(!failed)
+    {
+        printf("Image of %d bytes with %lld of data, %lld allocated, transfer shrunk %.1fx\n",
+               HOLES_IMAGE_SIZE,
+               (long long)data,
+               (long long)allocated,
+               (double)plain / (double)sparse);
+
+        // Past the data only the responses and their block maps are sent, a few dozen bytes for each read
+        failed = sparse > (allocated > data ? allocated : data) + 256 * (HOLES_IMAGE_SIZE / HOLES_READ_SIZE);
+    }
+
+    printf(failed ? "Holes were sent as data\n" : "Holes were left off the wire\n");
+
+    return failed;
+}
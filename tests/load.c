@@ -0,0 +1,161 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../endian.h"
+#include "client.h"
+
+#define LOAD_MAX_CLIENTS 8
+#define LOAD_IMAGE_SIZE (32 * 1024 * 1024)
+#define LOAD_READ_SIZE AARUREMOTE_STREAM_CHUNK_SIZE
+
+typedef struct
+{
+    uint32_t  index;
+    char      path[64];
+    pthread_t thread;
+    int       started;
+    int       failed;
+} LoadClient;
+
+// Reads a whole stand-in image of its own, checking every byte, like a client dumping one drive
+static void* LoadLoop(void* arguments)
+{
+    LoadClient*          load = arguments;
+    TestClient           client;
+    AaruPacketCmdOsRead  pkt_cmd_osread;
+    AaruPacketResOsRead* pkt_res_osread;
+    const uint8_t*       data;
+    uint64_t             off;
+    uint32_t             n;
+
+    if(TestConnect(&client, 0) < 0 || TestHello(&client, 0) < 0 || TestOpen(&client, load->path) < 0)
+    {
+        printf("Client %u could not open %s\n", load->index, load->path);
+        TestClose(&client);
+        return NULL;
+    }
+
+    for(off = 0; off < LOAD_IMAGE_SIZE; off += LOAD_READ_SIZE)
+    {
+        pkt_cmd_osread.offset = htole64(off);
+        pkt_cmd_osread.length = htole32(LOAD_READ_SIZE);
+
+        if(TestSend(&client,
+                    AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD,
+                    0,
+                    (char*)&pkt_cmd_osread + sizeof(AaruPacketHeader),
+                    sizeof(AaruPacketCmdOsRead) - sizeof(AaruPacketHeader)) < 0)
+            break;
+
+        pkt_res_osread = (AaruPacketResOsRead*)TestRecv(&client);
+
+        if(!pkt_res_osread || pkt_res_osread->hdr.packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD ||
+           pkt_res_osread->error_no != 0 ||
+           le32toh(pkt_res_osread->hdr.len) != sizeof(AaruPacketResOsRead) + LOAD_READ_SIZE)
+        {
+            printf("Client %u got a bad response reading at %llu\n", load->index, (unsigned long long)off);
+            break;
+        }
+
+        data = (const uint8_t*)(pkt_res_osread + 1);
+
+        for(n = 0; n < LOAD_READ_SIZE; n++)
+            if(data[n] != TestImageByte(off + n, load->index)) break;
+
+        if(n < LOAD_READ_SIZE)
+        {
+            printf("Client %u read wrong data at %llu\n", load->index, (unsigned long long)(off + n));
+            break;
+        }
+    }
+
+    load->failed = off < LOAD_IMAGE_SIZE;
+    TestClose(&client);
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    LoadClient clients[LOAD_MAX_CLIENTS];
+    pid_t      server;
+    double     start;
+    double     rate;
+    double     single = 0;
+    uint32_t   count;
+    uint32_t   n;
+    int        failed = 0;
+
+    if(argc < 2)
+    {
+        printf("Usage: %s <aaruremote>\n", argv[0]);
+        return 1;
+    }
+
+    for(n = 0; n < LOAD_MAX_CLIENTS; n++)
+    {
+        clients[n].index = n;
+        snprintf(clients[n].path, sizeof(clients[n].path), "load-%u.img", n);
+
+        if(TestWriteImage(clients[n].path, LOAD_IMAGE_SIZE, n) < 0)
+        {
+            printf("Could not write %s\n", clients[n].path);
+            return 1;
+        }
+    }
+
+    server = TestServerStart(argv[1], "load.log");
+
+    if(server < 0) return 1;
+
+    // Each client dumps its own stand-in drive at the same time as the others
+    for(count = 1; count <= LOAD_MAX_CLIENTS && !failed; count *= 2)
+    {
+        start = TestSeconds();
+
+        for(n = 0; n < count; n++)
+        {
+            clients[n].failed  = 1;
+            clients[n].started = pthread_create(&clients[n].thread, NULL, LoadLoop, &clients[n]) == 0;
+        }
+
+        for(n = 0; n < count; n++)
+        {
+            if(clients[n].started) pthread_join(clients[n].thread, NULL);
+
+            failed |= clients[n].failed;
+        }
+
+        rate = (double)count * LOAD_IMAGE_SIZE / 1048576.0 / (TestSeconds() - start);
+
+        if(count == 1) single = rate;
+
+        printf("%u client%s: %.0f MiB/s, %.2fx one client\n", count, count == 1 ? "" : "s", rate, rate / single);
+    }
+
+    TestServerStop(server);
+
+    for(n = 0; n < LOAD_MAX_CLIENTS; n++) unlink(clients[n].path);
+
+    printf(failed ? "Load test failed\n" : "All clients read their images\n");
+
+    return failed;
+}
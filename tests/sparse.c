@@ -0,0 +1,190 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../endian.h"
+#include "client.h"
+
+#define SPARSE_IMAGE "sparse.img"
+#define SPARSE_IMAGE_SIZE (16 * 1024 * 1024)
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t length;
+} SparseRange;
+
+// Unwritten areas of the stand-in medium, some on block boundaries and some not
+static const SparseRange zero_ranges[] = {{0, 65536},
+                                          {100000, 50000},
+                                          {1048576, 2097152},
+                                          {5242880 + 513, 511},
+                                          {6291456 - 1, 4097},
+                                          {8388608, 4194303},
+                                          {SPARSE_IMAGE_SIZE - 700, 700}};
+
+// Reads as a client dumping the medium would issue them, and a few that do not start or end on a block
+static const SparseRange reads[] = {{777, 100003}, {5242000, 4096}, {6291000, 1000}, {SPARSE_IMAGE_SIZE - 4000, 4000}};
+
+static uint8_t SparseByte(uint64_t offset)
+{
+    uint32_t n;
+
+    for(n = 0; n < sizeof(zero_ranges) / sizeof(SparseRange); n++)
+        if(offset >= zero_ranges[n].offset && offset - zero_ranges[n].offset < zero_ranges[n].length) return 0;
+
+    return TestImageByte(offset, 0);
+}
+
+static int WriteSparseImage()
+{
+    char*    zeroes;
+    uint32_t n;
+    int      fd;
+    int      failed = 0;
+
+    if(TestWriteImage(SPARSE_IMAGE, SPARSE_IMAGE_SIZE, 0) < 0) return -1;
+
+    zeroes = calloc(1, 4194304);
+    fd     = open(SPARSE_IMAGE, O_WRONLY);
+
+    for(n = 0; zeroes && fd >= 0 && n < sizeof(zero_ranges) / sizeof(SparseRange); n++)
+        if(pwrite(fd, zeroes, zero_ranges[n].length, (off_t)zero_ranges[n].offset) != (ssize_t)zero_ranges[n].length)
+            failed = 1;
+
+    free(zeroes);
+
+    if(fd < 0 || !zeroes || close(fd) < 0) failed = 1;
+
+    return failed ? -1 : 0;
+}
+
+static int ReadAndCheck(TestClient* client, uint64_t offset, uint32_t length, uint64_t* elided)
+{
+    AaruPacketCmdOsRead  pkt_cmd_osread;
+    AaruPacketResOsRead* pkt_res_osread;
+    AaruPacketHeader*    pkt_hdr;
+    const uint8_t*       data;
+    uint32_t             n;
+
+    pkt_cmd_osread.offset = htole64(offset);
+    pkt_cmd_osread.length = htole32(length);
+
+    if(TestSend(client,
+                AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD,
+                0,
+                (char*)&pkt_cmd_osread + sizeof(AaruPacketHeader),
+                sizeof(AaruPacketCmdOsRead) - sizeof(AaruPacketHeader)) < 0)
+        return -1;
+
+    pkt_hdr = TestRecv(client);
+
+    if(pkt_hdr && pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_RESPONSE_SPARSE) (*elided)++;
+
+    pkt_res_osread = (AaruPacketResOsRead*)TestExpand(client, pkt_hdr);
+
+    if(!pkt_res_osread || pkt_res_osread->hdr.packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD ||
+       pkt_res_osread->error_no != 0 || le32toh(pkt_res_osread->hdr.len) != sizeof(AaruPacketResOsRead) + length)
+    {
+        printf("Bad response reading %u bytes at %llu\n", length, (unsigned long long)offset);
+        return -1;
+    }
+
+    data = (const uint8_t*)(pkt_res_osread + 1);
+
+    for(n = 0; n < length; n++)
+        if(data[n] != SparseByte(offset + n))
+        {
+            printf("Wrong data at %llu\n", (unsigned long long)(offset + n));
+            return -1;
+        }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    TestClient client;
+    pid_t      server;
+    uint64_t   off;
+    uint64_t   raw    = 0;
+    uint64_t   elided = 0;
+    uint64_t   zeroes = 0;
+    uint32_t   n;
+    int        failed = 1;
+
+    if(argc < 2)
+    {
+        printf("Usage: %s <aaruremote>\n", argv[0]);
+        return 1;
+    }
+
+    if(WriteSparseImage() < 0)
+    {
+        printf("Could not write %s\n", SPARSE_IMAGE);
+        return 1;
+    }
+
+    for(off = 0; off < SPARSE_IMAGE_SIZE; off++)
+        if(!SparseByte(off)) zeroes++;
+
+    server = TestServerStart(argv[1], "sparse.log");
+
+    if(server < 0) return 1;
+
+    if(TestConnect(&client, 0) == 0 && TestHello(&client, AARUREMOTE_HELLO_FLAG_SPARSE) == 0 &&
+       TestOpen(&client, SPARSE_IMAGE) == 0)
+    {
+        client.received = 0;
+
+        for(off = 0; off < SPARSE_IMAGE_SIZE; off += AARUREMOTE_STREAM_CHUNK_SIZE)
+            if(ReadAndCheck(&client, off, AARUREMOTE_STREAM_CHUNK_SIZE, &elided) < 0) break;
+
+        raw    = off + (sizeof(AaruPacketResOsRead) * (off / AARUREMOTE_STREAM_CHUNK_SIZE));
+        failed = off < SPARSE_IMAGE_SIZE;
+
+        for(n = 0; !failed && n < sizeof(reads) / sizeof(SparseRange); n++)
+            failed = ReadAndCheck(&client, reads[n].offset, reads[n].length, &elided) < 0;
+    }
+
+    if(!failed)
+    {
+        printf("Read %llu bytes as %llu on the wire, %llu of them zeroes, %llu responses elided\n",
+               (unsigned long long)raw,
+               (unsigned long long)client.received,
+               (unsigned long long)zeroes,
+               (unsigned long long)elided);
+
+        // Only the zeroes in partial blocks, the maps and the headers are sent in place of the zero ranges
+        failed = client.received > raw - zeroes + raw / 50;
+    }
+
+    TestClose(&client);
+    TestServerStop(server);
+    unlink(SPARSE_IMAGE);
+
+    printf(failed ? "Zero blocks were not elided\n" : "Zero blocks were elided and read back\n");
+
+    return failed;
+}
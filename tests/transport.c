@@ -0,0 +1,294 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../endian.h"
+#include "client.h"
+
+#define TRANSPORT_IMAGE "transport.img"
+#define TRANSPORT_IMAGE_SIZE (64 * 1024 * 1024)
+#define TRANSPORT_READ_SIZE AARUREMOTE_STREAM_CHUNK_SIZE
+#define TRANSPORT_SHM_SIZE (4 * 1024 * 1024)
+
+typedef struct
+{
+    char*    map;
+    uint32_t size;
+    uint32_t data_offset;
+    int      fd;
+} TransportShm;
+
+// The descriptor comes with the first byte of the response, that a plain recv would drop
+static int RecvShmSetup(TestClient* client, TransportShm* shm)
+{
+    AaruPacketResShmSetup pkt_res_shm;
+    struct msghdr         msg;
+    struct iovec          iov;
+    struct cmsghdr*       cmsg;
+    char                  control[CMSG_SPACE(sizeof(int))];
+    uint32_t              got = 0;
+    ssize_t               ret;
+
+    shm->fd = -1;
+
+    while(got < sizeof(AaruPacketResShmSetup))
+    {
+        memset(&msg, 0, sizeof(msg));
+
+        iov.iov_base   = (char*)&pkt_res_shm + got;
+        iov.iov_len    = sizeof(AaruPacketResShmSetup) - got;
+        msg.msg_iov    = &iov;
+        msg.msg_iovlen = 1;
+
+        if(got == 0)
+        {
+            msg.msg_control    = control;
+            msg.msg_controllen = sizeof(control);
+        }
+
+        ret = recvmsg(client->fd, &msg, 0);
+
+        if(ret < 0 && errno == EINTR) continue;
+
+        if(ret <= 0) return -1;
+
+        cmsg = got == 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+
+        if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&shm->fd, CMSG_DATA(cmsg), sizeof(int));
+
+        got += (uint32_t)ret;
+        client->received += (uint64_t)ret;
+    }
+
+    if(shm->fd < 0 || pkt_res_shm.hdr.packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_SHM_SETUP) return -1;
+
+    shm->size        = le32toh(pkt_res_shm.size);
+    shm->data_offset = le32toh(pkt_res_shm.data_offset);
+    shm->map         = mmap(NULL, shm->data_offset + shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+
+    if(shm->map == MAP_FAILED)
+    {
+        shm->map = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int RequestShm(TestClient* client, TransportShm* shm)
+{
+    AaruPacketCmdShmSetup pkt_cmd_shm;
+
+    pkt_cmd_shm.size = htole32(TRANSPORT_SHM_SIZE);
+
+    if(TestSend(client,
+                AARUREMOTE_PACKET_TYPE_COMMAND_SHM_SETUP,
+                0,
+                (char*)&pkt_cmd_shm + sizeof(AaruPacketHeader),
+                sizeof(AaruPacketCmdShmSetup) - sizeof(AaruPacketHeader)) < 0)
+        return -1;
+
+    return RecvShmSetup(client, shm);
+}
+
+// Returns where the data of the response is, in the packet or in the ring
+static const char* ReadImage(TestClient* client, TransportShm* shm, uint64_t offset)
+{
+    AaruPacketCmdOsRead     pkt_cmd_osread;
+    AaruPacketResOsRead*    pkt_res_osread;
+    AaruPacketResOsReadShm* pkt_res_shm;
+    AaruPacketHeader*       pkt_hdr;
+
+    pkt_cmd_osread.offset = htole64(offset);
+    pkt_cmd_osread.length = htole32(TRANSPORT_READ_SIZE);
+
+    if(TestSend(client,
+                AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD,
+                0,
+                (char*)&pkt_cmd_osread + sizeof(AaruPacketHeader),
+                sizeof(AaruPacketCmdOsRead) - sizeof(AaruPacketHeader)) < 0)
+        return NULL;
+
+    pkt_hdr = TestRecv(client);
+
+    if(!pkt_hdr) return NULL;
+
+    if(shm->map && pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD_SHM)
+    {
+        pkt_res_shm = (AaruPacketResOsReadShm*)pkt_hdr;
+
+        if(pkt_res_shm->error_no != 0 || le32toh(pkt_res_shm->length) != TRANSPORT_READ_SIZE) return NULL;
+
+        // Consumed as soon as it is returned, the next read overwrites nothing that has not been checked yet
+        ((volatile AaruShmRing*)shm->map)->tail = htole64(le64toh(pkt_res_shm->position) + TRANSPORT_READ_SIZE);
+
+        return shm->map + shm->data_offset + le64toh(pkt_res_shm->position) % shm->size;
+    }
+
+    pkt_res_osread = (AaruPacketResOsRead*)pkt_hdr;
+
+    if(pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD || pkt_res_osread->error_no != 0 ||
+       le32toh(pkt_hdr->len) != sizeof(AaruPacketResOsRead) + TRANSPORT_READ_SIZE)
+        return NULL;
+
+    return (const char*)(pkt_res_osread + 1);
+}
+
+// A read running past the end of the image, what could not be read must come back as zeroes
+static int ReadPastEnd(TestClient* client, TransportShm* shm, const char* expected)
+{
+    const char* data;
+    uint32_t    n;
+
+    data = ReadImage(client, shm, TRANSPORT_IMAGE_SIZE - 4096);
+
+    if(!data || memcmp(data, expected + TRANSPORT_IMAGE_SIZE - 4096, 4096) != 0) return -1;
+
+    for(n = 4096; n < TRANSPORT_READ_SIZE; n++)
+        if(data[n] != 0) return -1;
+
+    return 0;
+}
+
+// Reads the whole image through one of the transports and returns its throughput, or 0 when anything went wrong
+static double Transfer(const char* name, uint8_t local, uint8_t use_shm, const char* expected)
+{
+    TestClient   client;
+    TransportShm shm;
+    const char*  data = NULL;
+    uint64_t     off;
+    double       start;
+    double       elapsed;
+
+    memset(&shm, 0, sizeof(TransportShm));
+    shm.fd = -1;
+
+    if(TestConnect(&client, local) < 0 || TestHello(&client, 0) < 0 || TestOpen(&client, TRANSPORT_IMAGE) < 0 ||
+       (use_shm && RequestShm(&client, &shm) < 0))
+    {
+        printf("Could not set up the %s client\n", name);
+        TestClose(&client);
+        return 0;
+    }
+
+    client.received = 0;
+    start           = TestSeconds();
+
+    for(off = 0; off < TRANSPORT_IMAGE_SIZE; off += TRANSPORT_READ_SIZE)
+    {
+        data = ReadImage(&client, &shm, off);
+
+        if(!data || memcmp(data, expected + off, TRANSPORT_READ_SIZE) != 0)
+        {
+            printf("The %s client got bad data at %llu\n", name, (unsigned long long)off);
+            break;
+        }
+    }
+
+    elapsed = TestSeconds() - start;
+
+    // The ring still holds the image's last reads where this one goes
+    if(off == TRANSPORT_IMAGE_SIZE && ReadPastEnd(&client, &shm, expected) < 0)
+    {
+        printf("The %s client got stale data past the end of the image\n", name);
+        off = 0;
+    }
+
+    printf("%-13s %7.0f MiB/s, %llu bytes on the socket\n",
+           name,
+           (double)off / 1048576.0 / elapsed,
+           (unsigned long long)client.received);
+
+    TestClose(&client);
+
+    if(shm.map) munmap(shm.map, shm.data_offset + shm.size);
+
+    if(shm.fd >= 0) close(shm.fd);
+
+    if(off < TRANSPORT_IMAGE_SIZE) return 0;
+
+    // The ring carries the data, the socket only the small responses pointing into it
+    if(use_shm && client.received >= TRANSPORT_IMAGE_SIZE / 64)
+    {
+        printf("The data went through the socket instead of the ring\n");
+        return 0;
+    }
+
+    return (double)off / 1048576.0 / elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    char*    expected;
+    pid_t    server;
+    uint64_t off;
+    double   tcp;
+    double   local;
+    double   ring;
+    int      failed;
+
+    if(argc < 2)
+    {
+        printf("Usage: %s <aaruremote>\n", argv[0]);
+        return 1;
+    }
+
+    expected = malloc(TRANSPORT_IMAGE_SIZE);
+
+    if(!expected || TestWriteImage(TRANSPORT_IMAGE, TRANSPORT_IMAGE_SIZE, 0) < 0)
+    {
+        printf("Could not write %s\n", TRANSPORT_IMAGE);
+        free(expected);
+        return 1;
+    }
+
+    for(off = 0; off < TRANSPORT_IMAGE_SIZE; off++) expected[off] = (char)TestImageByte(off, 0);
+
+    server = TestServerStart(argv[1], "transport.log");
+
+    if(server < 0)
+    {
+        free(expected);
+        unlink(TRANSPORT_IMAGE);
+        return 1;
+    }
+
+    tcp   = Transfer("TCP loopback", 0, 0, expected);
+    local = Transfer("Local socket", 1, 0, expected);
+    ring  = Transfer("Shared memory", 1, 1, expected);
+
+    TestServerStop(server);
+    unlink(TRANSPORT_IMAGE);
+    free(expected);
+
+    failed = tcp <= 0 || local <= 0 || ring <= 0;
+
+    if(!failed)
+        printf("Local socket is %.2fx and shared memory %.2fx the TCP loopback throughput\n", local / tcp, ring / tcp);
+
+    printf(failed ? "Same host transports failed\n" : "Same host transports read back the image\n");
+
+    return failed;
+}
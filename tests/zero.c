@@ -0,0 +1,146 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../aaruremote.h"
+
+#define ZERO_CHECK_SIZE (4 * AARUREMOTE_SPARSE_BLOCK_SIZE + 100)
+#define ZERO_BENCH_SIZE (16 * 1024 * 1024)
+#define ZERO_BENCH_ROUNDS 32
+
+// What the kernels must agree with, one byte at a time
+static uint32_t ZeroBlocksReference(const uint8_t* buf, uint32_t len, uint32_t block_size, uint8_t* map)
+{
+    uint32_t blocks = (len + block_size - 1) / block_size;
+    uint32_t zeroes = 0;
+    uint32_t n;
+    uint32_t i;
+
+    memset(map, 0, (blocks + 7) / 8);
+
+    for(n = 0; n < blocks; n++)
+    {
+        for(i = n * block_size; i < len && i < (n + 1) * block_size; i++)
+            if(buf[i]) break;
+
+        if(i < len && i < (n + 1) * block_size) continue;
+
+        map[n / 8] |= (uint8_t)(1 << (n % 8));
+        zeroes++;
+    }
+
+    return zeroes;
+}
+
+// A single byte set anywhere, at every alignment and length, must mark its block and only that one
+static int CheckZeroBlocks()
+{
+    uint8_t* buf;
+    uint8_t  map[16];
+    uint8_t  expected[16];
+    uint32_t align;
+    uint32_t len;
+    uint32_t pos;
+    uint32_t map_len;
+    int      failed = 0;
+
+    buf = calloc(1, ZERO_CHECK_SIZE + 64);
+
+    if(!buf) return 1;
+
+    for(align = 0; align < 64 && !failed; align += 7)
+        for(len = 1; len <= ZERO_CHECK_SIZE && !failed; len += len < 130 ? 1 : 37)
+            for(pos = 0; pos <= len && !failed; pos += pos < 70 ? 1 : 29)
+            {
+                // pos == len leaves the buffer all zeroes
+                if(pos < len) buf[align + pos] = 0xA5;
+
+                map_len = ((len + AARUREMOTE_SPARSE_BLOCK_SIZE - 1) / AARUREMOTE_SPARSE_BLOCK_SIZE + 7) / 8;
+
+                if(ZeroBlocks(buf + align, len, AARUREMOTE_SPARSE_BLOCK_SIZE, map) !=
+                       ZeroBlocksReference(buf + align, len, AARUREMOTE_SPARSE_BLOCK_SIZE, expected) ||
+                   memcmp(map, expected, map_len) != 0)
+                {
+                    printf("Wrong zero blocks with %u bytes at alignment %u, set at %u\n", len, align, pos);
+                    failed = 1;
+                }
+
+                if(pos < len) buf[align + pos] = 0;
+            }
+
+    free(buf);
+    return failed;
+}
+
+static double BenchZeroBlocks(uint32_t (*zero_blocks)(const uint8_t*, uint32_t, uint32_t, uint8_t*),
+                              const uint8_t* buf,
+                              uint8_t*       map)
+{
+    clock_t  start = clock();
+    uint32_t n;
+
+    for(n = 0; n < ZERO_BENCH_ROUNDS; n++)
+        if(zero_blocks(buf, ZERO_BENCH_SIZE, AARUREMOTE_SPARSE_BLOCK_SIZE, map) !=
+           ZERO_BENCH_SIZE / AARUREMOTE_SPARSE_BLOCK_SIZE)
+            return 0;
+
+    return (double)ZERO_BENCH_SIZE * ZERO_BENCH_ROUNDS / 1048576.0 / ((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+int main()
+{
+    uint8_t* buf;
+    uint8_t* map;
+    double   kernel;
+    double   reference;
+
+    if(CheckZeroBlocks())
+    {
+        printf("Zero block detection is wrong\n");
+        return 1;
+    }
+
+    // Zero blocks are the slow case, every byte of them has to be looked at
+    buf = calloc(1, ZERO_BENCH_SIZE);
+    map = malloc(ZERO_BENCH_SIZE / AARUREMOTE_SPARSE_BLOCK_SIZE / 8);
+
+    if(!buf || !map)
+    {
+        printf("Could not allocate the benchmark buffers\n");
+        return 1;
+    }
+
+    kernel    = BenchZeroBlocks(ZeroBlocks, buf, map);
+    reference = BenchZeroBlocks(ZeroBlocksReference, buf, map);
+
+    printf("Zero blocks scanned at %.0f MiB/s, %.1fx a byte loop at %.0f MiB/s\n",
+           kernel,
+           reference > 0 ? kernel / reference : 0,
+           reference);
+
+    free(buf);
+    free(map);
+
+    printf("Zero block detection is right\n");
+
+    return kernel > 0 ? 0 : 1;
+}
@@ -15,16 +15,36 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #include "../aaruremote.h"
 #include "unix.h"
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 int PrintNetworkAddresses()
 {
     int             ret;
@@ -57,11 +77,50 @@ int PrintNetworkAddresses()
 
 char* PrintIpv4Address(struct in_addr addr) { return inet_ntoa(addr); }
 
+// Device threads write to the same connection, the lock is recursive as writes flush and wait on the queue
+static NetworkContext* NetContextCreate()
+{
+    NetworkContext*     ctx;
+    pthread_mutexattr_t attr;
+
+    ctx = malloc(sizeof(NetworkContext));
+
+    if(!ctx) return NULL;
+
+    memset(ctx, 0, sizeof(NetworkContext));
+
+    if(pthread_mutexattr_init(&attr))
+    {
+        free(ctx);
+        return NULL;
+    }
+
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+    if(pthread_mutex_init(&ctx->out_lock, &attr))
+    {
+        pthread_mutexattr_destroy(&attr);
+        free(ctx);
+        return NULL;
+    }
+
+    pthread_mutexattr_destroy(&attr);
+
+    return ctx;
+}
+
+static void NetContextFree(NetworkContext* ctx)
+{
+    pthread_mutex_destroy(&ctx->out_lock);
+    free(ctx->out_queue);
+    free(ctx);
+}
+
 void* NetSocket(uint32_t domain, uint32_t type, uint32_t protocol)
 {
     NetworkContext* ctx;
 
-    ctx = malloc(sizeof(NetworkContext));
+    ctx = NetContextCreate();
 
     if(!ctx) return NULL;
 
@@ -69,7 +128,7 @@ void* NetSocket(uint32_t domain, uint32_t type, uint32_t protocol)
 
     if(ctx->fd < 0)
     {
-        free(ctx);
+        NetContextFree(ctx);
         return NULL;
     }
 
@@ -98,10 +157,12 @@ void* NetAccept(void* net_ctx, struct sockaddr* addr, socklen_t* addrlen)
 {
     NetworkContext* ctx = net_ctx;
     NetworkContext* cli_ctx;
+    int             flags;
+    int             on = 1;
 
     if(!ctx) return NULL;
 
-    cli_ctx = malloc(sizeof(NetworkContext));
+    cli_ctx = NetContextCreate();
 
     if(!cli_ctx) return NULL;
 
@@ -109,43 +170,445 @@ void* NetAccept(void* net_ctx, struct sockaddr* addr, socklen_t* addrlen)
 
     if(cli_ctx->fd < 0)
     {
-        free(cli_ctx);
+        NetContextFree(cli_ctx);
         return NULL;
     }
 
+    // Clients are non-blocking so a single event loop can service many of them, blocking is emulated with poll()
+    flags = fcntl(cli_ctx->fd, F_GETFL, 0);
+
+    if(flags >= 0) fcntl(cli_ctx->fd, F_SETFL, flags | O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE
+    setsockopt(cli_ctx->fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    // Responses that are not written at once, like a header followed by spliced data, must not wait for an ACK.
+    // Local sockets do not have this option, and do not need it.
+    setsockopt(cli_ctx->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
     return cli_ctx;
 }
 
-int32_t NetRecv(void* net_ctx, void* buf, int32_t len, uint32_t flags)
+static int32_t NetFlushLocked(void* net_ctx)
 {
     NetworkContext* ctx = net_ctx;
+    ssize_t         ret;
 
     if(!ctx) return -1;
 
-    int32_t got_once;
-    int32_t got_total = 0;
+    while(ctx->out_len > 0)
+    {
+        ret = send(ctx->fd, ctx->out_queue, ctx->out_len, MSG_NOSIGNAL);
 
-    while(len > 0)
+        if(ret < 0)
+        {
+            if(errno == EINTR) continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            return -1;
+        }
+
+        memmove(ctx->out_queue, ctx->out_queue + ret, ctx->out_len - ret);
+        ctx->out_len -= ret;
+    }
+
+    return (int32_t)ctx->out_len;
+}
+
+int32_t NetFlush(void* net_ctx)
+{
+    NetworkContext* ctx = net_ctx;
+    int32_t         ret;
+
+    if(!ctx) return -1;
+
+    pthread_mutex_lock(&ctx->out_lock);
+    ret = NetFlushLocked(ctx);
+    pthread_mutex_unlock(&ctx->out_lock);
+
+    return ret;
+}
+
+// Waits until the socket is ready for the requested events, flushing queued output meanwhile
+static int NetWait(NetworkContext* ctx, short events)
+{
+    struct pollfd pfd;
+    int           ret;
+
+    for(;;)
+    {
+        pfd.fd      = ctx->fd;
+        pfd.events  = events;
+        pfd.revents = 0;
+
+        if(ctx->out_len > 0) pfd.events |= POLLOUT;
+
+        ret = poll(&pfd, 1, -1);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR) continue;
+
+            return -1;
+        }
+
+        if(pfd.revents & (POLLERR | POLLNVAL)) return -1;
+
+        // Readers do not hold the output lock, NetFlush takes it
+        if((pfd.revents & POLLOUT) && ctx->out_len > 0 && NetFlush(ctx) < 0) return -1;
+
+        if(pfd.revents & (events | POLLHUP)) return 0;
+    }
+}
+
+int32_t NetRecvAvailable(void* net_ctx, void* buf, int32_t len, uint8_t wait)
+{
+    NetworkContext* ctx = net_ctx;
+    ssize_t         ret;
+
+    if(!ctx) return -1;
+
+    for(;;)
     {
-        got_once = recv(ctx->fd, buf, len, flags);
+        ret = recv(ctx->fd, buf, len, 0);
 
-        if(got_once <= 0) break;
+        if(ret >= 0) return (int32_t)ret;
 
-        buf += got_once;
-        got_total += got_once;
-        len -= got_once;
+        if(errno == EINTR) continue;
+
+        if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+        if(!wait) return -1;
+
+        if(NetWait(ctx, POLLIN) < 0) return -1;
     }
+}
+
+static int32_t NetWriteLocked(void* net_ctx, const void* buf, int32_t size)
+{
+    NetworkContext* ctx  = net_ctx;
+    const char*     data = buf;
+    size_t          left = size;
+    ssize_t         ret;
+    char*           new_queue;
+
+    if(!ctx) return -1;
+
+    if(NetFlushLocked(ctx) < 0) return -1;
+
+    while(left > 0)
+    {
+        // Data must go out in order, so only write directly when nothing is queued
+        if(ctx->out_len == 0)
+        {
+            ret = send(ctx->fd, data, left, MSG_NOSIGNAL);
+
+            if(ret > 0)
+            {
+                data += ret;
+                left -= ret;
+                continue;
+            }
 
-    return got_total;
+            if(ret < 0 && errno == EINTR) continue;
+
+            if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        }
+
+        // Queue what the socket did not take, it will be flushed when it becomes writable
+        if(ctx->out_len + left <= AARUREMOTE_NET_QUEUE_MAX)
+        {
+            if(ctx->out_len + left > ctx->out_size)
+            {
+                new_queue = realloc(ctx->out_queue, ctx->out_len + left);
+
+                if(!new_queue) return -1;
+
+                ctx->out_queue = new_queue;
+                ctx->out_size  = ctx->out_len + left;
+            }
+
+            memcpy(ctx->out_queue + ctx->out_len, data, left);
+            ctx->out_len += left;
+
+            return size;
+        }
+
+        // Too much pending for this connection, wait for the client to drain it
+        if(NetWait(ctx, POLLOUT) < 0) return -1;
+    }
+
+    return size;
 }
 
 int32_t NetWrite(void* net_ctx, const void* buf, int32_t size)
 {
     NetworkContext* ctx = net_ctx;
+    int32_t         ret;
+
+    if(!ctx) return -1;
+
+    pthread_mutex_lock(&ctx->out_lock);
+    ret = NetWriteLocked(ctx, buf, size);
+    pthread_mutex_unlock(&ctx->out_lock);
+
+    return ret;
+}
+
+static int32_t NetWritevLocked(void* net_ctx, const NetIoVec* iov, int32_t iov_count)
+{
+    NetworkContext* ctx   = net_ctx;
+    int32_t         total = 0;
+    int32_t         first = 0;
+    int32_t         skip  = 0;
+    int32_t         count;
+    int32_t         i;
+    ssize_t         ret;
+    struct iovec    vecs[AARUREMOTE_NET_IOV_BATCH];
+    struct msghdr   msg;
+
+    if(!ctx) return -1;
+
+    for(i = 0; i < iov_count; i++) total += iov[i].len;
+
+    if(NetFlushLocked(ctx) < 0) return -1;
+
+    // Send straight from the caller buffers while nothing is queued
+    while(ctx->out_len == 0 && first < iov_count)
+    {
+        for(count = 0; count < AARUREMOTE_NET_IOV_BATCH && first + count < iov_count; count++)
+        {
+            vecs[count].iov_base = (char*)iov[first + count].buf;
+            vecs[count].iov_len  = iov[first + count].len;
+        }
+
+        vecs[0].iov_base = (char*)vecs[0].iov_base + skip;
+        vecs[0].iov_len -= skip;
+
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_iov    = vecs;
+        msg.msg_iovlen = count;
+
+        ret = sendmsg(ctx->fd, &msg, MSG_NOSIGNAL);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR) continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            return -1;
+        }
+
+        while(first < iov_count && ret >= iov[first].len - skip)
+        {
+            ret -= iov[first].len - skip;
+            skip = 0;
+            first++;
+        }
+
+        skip += (int32_t)ret;
+    }
+
+    // Whatever the socket did not take is queued in order by NetWrite
+    for(; first < iov_count; first++)
+    {
+        if(NetWriteLocked(ctx, (const char*)iov[first].buf + skip, iov[first].len - skip) < 0) return -1;
+
+        skip = 0;
+    }
+
+    return total;
+}
+
+int32_t NetWritev(void* net_ctx, const NetIoVec* iov, int32_t iov_count)
+{
+    NetworkContext* ctx = net_ctx;
+    int32_t         ret;
+
+    if(!ctx) return -1;
+
+    pthread_mutex_lock(&ctx->out_lock);
+    ret = NetWritevLocked(ctx, iov, iov_count);
+    pthread_mutex_unlock(&ctx->out_lock);
+
+    return ret;
+}
+
+static int32_t NetDrainLocked(void* net_ctx)
+{
+    NetworkContext* ctx = net_ctx;
+
+    if(!ctx) return -1;
+
+    while(ctx->out_len > 0)
+        if(NetWait(ctx, POLLOUT) < 0) return -1;
+
+    return 0;
+}
+
+int32_t NetDrain(void* net_ctx)
+{
+    NetworkContext* ctx = net_ctx;
+    int32_t         ret;
+
+    if(!ctx) return -1;
+
+    pthread_mutex_lock(&ctx->out_lock);
+    ret = NetDrainLocked(ctx);
+    pthread_mutex_unlock(&ctx->out_lock);
+
+    return ret;
+}
+
+static int32_t NetSpliceLocked(void* net_ctx, int fd, uint32_t len)
+{
+#ifdef __linux__
+    NetworkContext* ctx = net_ctx;
+    ssize_t         ret;
+
+    // Spliced data bypasses the output queue, so it must be empty to keep the stream in order
+    if(NetDrainLocked(ctx) < 0) return -1;
+
+    while(len > 0)
+    {
+        // No SPLICE_F_MORE, it would leave the end of the response corked in the socket
+        ret = splice(fd, NULL, ctx->fd, NULL, len, SPLICE_F_MOVE);
+
+        if(ret > 0)
+        {
+            len -= ret;
+            continue;
+        }
+
+        if(ret < 0 && errno == EINTR) continue;
+
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if(NetWait(ctx, POLLOUT) < 0) return -1;
+
+            continue;
+        }
+
+        return -1;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int32_t NetSplice(void* net_ctx, int fd, uint32_t len)
+{
+    NetworkContext* ctx = net_ctx;
+    int32_t         ret;
+
+    if(!ctx) return -1;
+
+    pthread_mutex_lock(&ctx->out_lock);
+    ret = NetSpliceLocked(ctx, fd, len);
+    pthread_mutex_unlock(&ctx->out_lock);
+
+    return ret;
+}
+
+void* NetListenLocal(const char* path, uint32_t backlog)
+{
+    NetworkContext*    ctx;
+    struct sockaddr_un addr;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    ctx = NetSocket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(!ctx) return NULL;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // A previous instance may have left its socket behind
+    unlink(path);
+
+    // The server usually runs as root while clients do not
+    if(bind(ctx->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || chmod(path, 0666) < 0 ||
+       listen(ctx->fd, backlog) < 0)
+    {
+        NetClose(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+static int32_t NetSendFdLocked(void* net_ctx, const void* buf, int32_t len, int32_t fd)
+{
+    NetworkContext* ctx = net_ctx;
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr* cmsg;
+    char            control[CMSG_SPACE(sizeof(int))];
+    ssize_t         ret;
 
     if(!ctx) return -1;
 
-    return write(ctx->fd, buf, size);
+    // The descriptor travels with the first byte of the packet, so nothing may be queued before it
+    if(NetDrainLocked(ctx) < 0) return -1;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+
+    iov.iov_base       = (void*)buf;
+    iov.iov_len        = len;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg             = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    for(;;)
+    {
+        ret = sendmsg(ctx->fd, &msg, MSG_NOSIGNAL);
+
+        if(ret >= 0) break;
+
+        if(errno == EINTR) continue;
+
+        if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+        if(NetWait(ctx, POLLOUT) < 0) return -1;
+    }
+
+    if(ret == len) return len;
+
+    // The rest of the packet goes as usual
+    return NetWriteLocked(ctx, (const char*)buf + ret, len - (int32_t)ret) < 0 ? -1 : len;
+}
+
+int32_t NetSendFd(void* net_ctx, const void* buf, int32_t len, int32_t fd)
+{
+    NetworkContext* ctx = net_ctx;
+    int32_t         ret;
+
+    if(!ctx) return -1;
+
+    pthread_mutex_lock(&ctx->out_lock);
+    ret = NetSendFdLocked(ctx, buf, len, fd);
+    pthread_mutex_unlock(&ctx->out_lock);
+
+    return ret;
 }
 
 int32_t NetClose(void* net_ctx)
@@ -156,6 +619,112 @@ int32_t NetClose(void* net_ctx)
     if(!ctx) return -1;
 
     ret = close(ctx->fd);
-    free(ctx);
+    NetContextFree(ctx);
     return ret;
 }
+
+void* NetPollCreate()
+{
+#ifdef __linux__
+    PollContext* ctx;
+
+    ctx = malloc(sizeof(PollContext));
+
+    if(!ctx) return NULL;
+
+    ctx->fd = epoll_create(AARUREMOTE_LISTEN_BACKLOG);
+
+    if(ctx->fd < 0)
+    {
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+#else
+    return NULL;
+#endif
+}
+
+#ifdef __linux__
+static int32_t NetPollControl(PollContext* ctx, int op, NetworkContext* net_ctx, void* data)
+{
+    struct epoll_event event;
+
+    if(!ctx || !net_ctx) return -1;
+
+    memset(&event, 0, sizeof(struct epoll_event));
+
+    // One shot so only one thread at a time handles a connection, until it is rearmed
+    event.events   = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = data;
+
+    // A device handle thread may be queueing output at the same time
+    pthread_mutex_lock(&net_ctx->out_lock);
+    if(net_ctx->out_len > 0) event.events |= EPOLLOUT;
+    pthread_mutex_unlock(&net_ctx->out_lock);
+
+    return epoll_ctl(ctx->fd, op, net_ctx->fd, &event);
+}
+#endif
+
+int32_t NetPollAdd(void* poll_ctx, void* net_ctx, void* data)
+{
+#ifdef __linux__
+    return NetPollControl(poll_ctx, EPOLL_CTL_ADD, net_ctx, data);
+#else
+    return -1;
+#endif
+}
+
+int32_t NetPollRearm(void* poll_ctx, void* net_ctx, void* data)
+{
+#ifdef __linux__
+    return NetPollControl(poll_ctx, EPOLL_CTL_MOD, net_ctx, data);
+#else
+    return -1;
+#endif
+}
+
+int32_t NetPollRemove(void* poll_ctx, void* net_ctx)
+{
+#ifdef __linux__
+    PollContext*       ctx     = poll_ctx;
+    NetworkContext*    cli_ctx = net_ctx;
+    struct epoll_event event;
+
+    if(!ctx || !cli_ctx) return -1;
+
+    return epoll_ctl(ctx->fd, EPOLL_CTL_DEL, cli_ctx->fd, &event);
+#else
+    return -1;
+#endif
+}
+
+void* NetPollWait(void* poll_ctx, uint32_t* events)
+{
+#ifdef __linux__
+    PollContext*       ctx = poll_ctx;
+    struct epoll_event event;
+    int                ret;
+
+    if(!ctx) return NULL;
+
+    do
+    {
+        ret = epoll_wait(ctx->fd, &event, 1, -1);
+    } while(ret < 0 && errno == EINTR);
+
+    if(ret <= 0) return NULL;
+
+    *events = 0;
+
+    if(event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) *events |= AARUREMOTE_POLL_IN;
+
+    if(event.events & EPOLLOUT) *events |= AARUREMOTE_POLL_OUT;
+
+    return event.data.ptr;
+#else
+    return NULL;
+#endif
+}
@@ -15,9 +15,21 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../aaruremote.h"
+#include "unix.h"
 
 void Initialize()
 {
@@ -26,4 +38,228 @@ void Initialize()
 
 void PlatformLoop(AaruPacketHello* pkt_server_hello) { WorkingLoop(pkt_server_hello); }
 
-uint8_t AmIRoot() { return geteuid() == 0; }
\ No newline at end of file
+uint8_t AmIRoot() { return geteuid() == 0; }
+
+int32_t StartWorkerThread(void* (*thread_func)(void*), void* arguments)
+{
+    pthread_t thread;
+    int       ret;
+
+    ret = pthread_create(&thread, NULL, thread_func, arguments);
+
+    if(ret) return ret;
+
+    return pthread_detach(thread);
+}
+
+uint32_t GetProcessorCount()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+void* MutexCreate()
+{
+    pthread_mutex_t* mutex = malloc(sizeof(pthread_mutex_t));
+
+    if(!mutex) return NULL;
+
+    if(pthread_mutex_init(mutex, NULL))
+    {
+        free(mutex);
+        return NULL;
+    }
+
+    return mutex;
+}
+
+void MutexLock(void* mutex) { pthread_mutex_lock(mutex); }
+
+void MutexUnlock(void* mutex) { pthread_mutex_unlock(mutex); }
+
+void MutexFree(void* mutex)
+{
+    if(!mutex) return;
+
+    pthread_mutex_destroy(mutex);
+    free(mutex);
+}
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint32_t        count;
+} UnixSemaphore;
+
+void* SemaphoreCreate(uint32_t count)
+{
+    UnixSemaphore* semaphore = malloc(sizeof(UnixSemaphore));
+
+    if(!semaphore) return NULL;
+
+    if(pthread_mutex_init(&semaphore->mutex, NULL))
+    {
+        free(semaphore);
+        return NULL;
+    }
+
+    if(pthread_cond_init(&semaphore->cond, NULL))
+    {
+        pthread_mutex_destroy(&semaphore->mutex);
+        free(semaphore);
+        return NULL;
+    }
+
+    semaphore->count = count;
+
+    return semaphore;
+}
+
+void SemaphorePost(void* semaphore)
+{
+    UnixSemaphore* sem = semaphore;
+
+    pthread_mutex_lock(&sem->mutex);
+    sem->count++;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->mutex);
+}
+
+void SemaphoreWait(void* semaphore)
+{
+    UnixSemaphore* sem = semaphore;
+
+    pthread_mutex_lock(&sem->mutex);
+
+    while(sem->count == 0) pthread_cond_wait(&sem->cond, &sem->mutex);
+
+    sem->count--;
+    pthread_mutex_unlock(&sem->mutex);
+}
+
+void SemaphoreFree(void* semaphore)
+{
+    UnixSemaphore* sem = semaphore;
+
+    if(!sem) return;
+
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+}
+
+void SleepSeconds(uint32_t seconds) { sleep(seconds); }
+
+uint64_t GetMicroseconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+int32_t GetRandomBytes(void* buf, uint32_t len)
+{
+    int     fd;
+    ssize_t ret;
+
+    fd = open("/dev/urandom", O_RDONLY);
+
+    if(fd < 0) return -1;
+
+    ret = read(fd, buf, len);
+    close(fd);
+
+    return ret == (ssize_t)len ? 0 : -1;
+}
+
+void* ShmCreate(uint32_t size, int32_t* fd)
+{
+    void* shm;
+
+    // Anonymous, so nothing is left behind if the server dies
+#if defined(__linux__)
+    *fd = memfd_create("aaruremote", MFD_CLOEXEC);
+#elif defined(SHM_ANON)
+    *fd = shm_open(SHM_ANON, O_RDWR, 0600);
+#else
+    *fd = -1;
+#endif
+
+    if(*fd < 0) return NULL;
+
+    if(ftruncate(*fd, size) < 0)
+    {
+        close(*fd);
+        return NULL;
+    }
+
+    shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+
+    if(shm == MAP_FAILED)
+    {
+        close(*fd);
+        return NULL;
+    }
+
+    return shm;
+}
+
+void ShmFree(void* shm, uint32_t size, int32_t fd)
+{
+    munmap(shm, size);
+    close(fd);
+}
+
+// Extents come sorted by offset, the ones that follow each other are read together in a single call
+int32_t PreadExtents(int fd, OsReadExtent* extents, uint32_t count)
+{
+    struct iovec iov[AARUREMOTE_OSREAD_IOV_BATCH];
+    uint32_t     first;
+    uint32_t     end;
+    uint32_t     n;
+    uint64_t     total;
+    ssize_t      ret;
+
+    for(first = 0; first < count; first = end)
+    {
+        total = extents[first].length;
+
+        for(end = first + 1; end < count && end - first < AARUREMOTE_OSREAD_IOV_BATCH; end++)
+        {
+            if(extents[end].offset != extents[end - 1].offset + extents[end - 1].length ||
+               total + extents[end].length > 0x7FFFFFFF)
+                break;
+
+            total += extents[end].length;
+        }
+
+        for(n = first; n < end; n++)
+        {
+            iov[n - first].iov_base = extents[n].buffer;
+            iov[n - first].iov_len  = extents[n].length;
+        }
+
+        ret = preadv(fd, iov, (int)(end - first), (off_t)extents[first].offset);
+
+        // A short read stops at the end of the device, the extents past it get nothing
+        for(n = first; n < end; n++)
+        {
+            if(ret < 0)
+            {
+                extents[n].error_no = errno;
+                extents[n].read     = 0;
+                continue;
+            }
+
+            extents[n].error_no = 0;
+            extents[n].read     = (uint64_t)ret < extents[n].length ? (uint32_t)ret : extents[n].length;
+            ret -= extents[n].read;
+        }
+    }
+
+    return 0;
+}
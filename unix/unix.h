@@ -18,9 +18,27 @@
 #ifndef AARUREMOTE_UNIX_UNIX_H_
 #define AARUREMOTE_UNIX_UNIX_H_
 
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AARUREMOTE_NET_QUEUE_MAX (256 * 1024)
+
 typedef struct
 {
-    int fd;
+    int             fd;
+    char*           out_queue;
+    size_t          out_len;
+    size_t          out_size;
+    pthread_mutex_t out_lock;
 } NetworkContext;
 
+typedef struct
+{
+    int fd;
+} PollContext;
+
+int32_t NetSplice(void* net_ctx, int fd, uint32_t len);
+int32_t PreadExtents(int fd, OsReadExtent* extents, uint32_t count);
+
 #endif // AARUREMOTE_UNIX_UNIX_H_
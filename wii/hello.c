@@ -41,6 +41,7 @@ AaruPacketHello* GetHello()
     strncpy(pkt_server_hello->application, AARUREMOTE_NAME, sizeof(AARUREMOTE_NAME));
     strncpy(pkt_server_hello->version, AARUREMOTE_VERSION, sizeof(AARUREMOTE_VERSION));
     pkt_server_hello->max_protocol = AARUREMOTE_PROTOCOL_MAX;
+    pkt_server_hello->flags        = AARUREMOTE_HELLO_FLAG_COMPRESSION | AARUREMOTE_HELLO_FLAG_SPARSE;
     snprintf(pkt_server_hello->sysname, 255, "Nintendo Wii IOS %d", IOS_GetVersion());
     snprintf(pkt_server_hello->release, 255, "%d", IOS_GetRevision());
     strncpy(pkt_server_hello->machine, "ppc", 255);
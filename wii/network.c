@@ -99,27 +99,13 @@ void* NetAccept(void* net_ctx, struct sockaddr* addr, socklen_t* addrlen)
     return cli_ctx;
 }
 
-int32_t NetRecv(void* net_ctx, void* buf, int32_t len, uint32_t flags)
+int32_t NetRecvAvailable(void* net_ctx, void* buf, int32_t len, uint8_t wait)
 {
     NetworkContext* ctx = net_ctx;
 
     if(!ctx) return -1;
 
-    int32_t got_once;
-    int32_t got_total = 0;
-
-    while(len > 0)
-    {
-        got_once = net_recv(ctx->fd, buf, len, flags);
-
-        if(got_once <= 0) break;
-
-        buf += got_once;
-        got_total += got_once;
-        len -= got_once;
-    }
-
-    return got_total;
+    return net_recv(ctx->fd, buf, len, 0);
 }
 
 int32_t NetWrite(void* net_ctx, const void* buf, int32_t size)
@@ -131,6 +117,26 @@ int32_t NetWrite(void* net_ctx, const void* buf, int32_t size)
     return net_write(ctx->fd, buf, size);
 }
 
+int32_t NetWritev(void* net_ctx, const NetIoVec* iov, int32_t iov_count)
+{
+    int32_t i;
+    int32_t ret;
+    int32_t total = 0;
+
+    for(i = 0; i < iov_count; i++)
+    {
+        if(iov[i].len == 0) continue;
+
+        ret = NetWrite(net_ctx, iov[i].buf, iov[i].len);
+
+        if(ret < 0) return -1;
+
+        total += ret;
+    }
+
+    return total;
+}
+
 int32_t NetClose(void* net_ctx)
 {
     int             ret;
@@ -141,4 +147,22 @@ int32_t NetClose(void* net_ctx)
     ret = net_close(ctx->fd);
     free(ctx);
     return ret;
-}
\ No newline at end of file
+}
+
+int32_t NetFlush(void* net_ctx) { return 0; }
+
+int32_t NetDrain(void* net_ctx) { return 0; }
+
+void* NetPollCreate() { return NULL; }
+
+int32_t NetPollAdd(void* poll_ctx, void* net_ctx, void* data) { return -1; }
+
+int32_t NetPollRearm(void* poll_ctx, void* net_ctx, void* data) { return -1; }
+
+int32_t NetPollRemove(void* poll_ctx, void* net_ctx) { return -1; }
+
+void* NetPollWait(void* poll_ctx, uint32_t* events) { return NULL; }
+
+void* NetListenLocal(const char* path, uint32_t backlog) { return NULL; }
+
+int32_t NetSendFd(void* net_ctx, const void* buf, int32_t len, int32_t fd) { return -1; }
\ No newline at end of file
@@ -71,4 +71,21 @@ int32_t ReOpen(void* device_ctx, uint32_t* closeFailed)
     return -1;
 }
 
-int32_t OsRead(void* device_ctx, char* buffer, uint64_t offset, uint32_t length, uint32_t* duration) { return -1; }
\ No newline at end of file
+int32_t OsRead(void* device_ctx, char* buffer, uint64_t offset, uint32_t length, uint32_t* duration) { return -1; }
+
+int32_t OsReadv(void* device_ctx, OsReadExtent* extents, uint32_t count) { return -1; }
+
+int32_t OsReadToNet(void* device_ctx, void* net_ctx, AaruPacketResOsRead* pkt_res, uint64_t offset, uint32_t length)
+{
+    return 0;
+}
+
+uint32_t OsReadToNetMaximum() { return 0; }
+
+uint64_t OsGetSize(void* device_ctx) { return 0; }
+
+uint32_t GetMaxTransfer(int32_t device_type) { return 0; }
+
+void* ShmCreate(uint32_t size, int32_t* fd) { return NULL; }
+
+void ShmFree(void* shm, uint32_t size, int32_t fd) {}
\ No newline at end of file
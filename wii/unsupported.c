@@ -77,7 +77,7 @@ uint8_t GetPcmciaData(void* device_ctx, uint16_t* cis_len, char* cis) { return 0
 int32_t SendScsiCommand(void*     device_ctx,
                         char*     cdb,
                         char*     buffer,
-                        char**    sense_buffer,
+                        char*     sense_buffer,
                         uint32_t  timeout,
                         int32_t   direction,
                         uint32_t* duration,
@@ -89,6 +89,8 @@ int32_t SendScsiCommand(void*     device_ctx,
     return -1;
 }
 
+void ScsiDirectStats(void* device_ctx, uint64_t* transfers, uint64_t* direct) {}
+
 uint8_t GetUsbData(void*     device_ctx,
                    uint16_t* desc_len,
                    char*     descriptors,
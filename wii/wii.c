@@ -18,6 +18,8 @@
 #include <debug.h>
 #include <errno.h>
 #include <gccore.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <wiiuse/wpad.h>
 
 #include "../aaruremote.h"
@@ -64,4 +66,88 @@ void PlatformLoop(AaruPacketHello* pkt_server_hello)
     }
 }
 
-uint8_t AmIRoot() { return 1; }
\ No newline at end of file
+uint8_t AmIRoot() { return 1; }
+
+int32_t StartWorkerThread(void* (*thread_func)(void*), void* arguments)
+{
+    lwp_t thread = (lwp_t)NULL;
+
+    return LWP_CreateThread(&thread,     /* thread handle */
+                            thread_func, /* code */
+                            arguments,   /* arg pointer for thread */
+                            NULL,        /* stack base */
+                            16 * 1024,   /* stack size */
+                            50 /* thread priority */);
+}
+
+uint32_t GetProcessorCount() { return 1; }
+
+void* MutexCreate()
+{
+    mutex_t* mutex = malloc(sizeof(mutex_t));
+
+    if(!mutex) return NULL;
+
+    if(LWP_MutexInit(mutex, false))
+    {
+        free(mutex);
+        return NULL;
+    }
+
+    return mutex;
+}
+
+void MutexLock(void* mutex) { LWP_MutexLock(*(mutex_t*)mutex); }
+
+void MutexUnlock(void* mutex) { LWP_MutexUnlock(*(mutex_t*)mutex); }
+
+void MutexFree(void* mutex)
+{
+    if(!mutex) return;
+
+    LWP_MutexDestroy(*(mutex_t*)mutex);
+    free(mutex);
+}
+
+void* SemaphoreCreate(uint32_t count)
+{
+    sem_t* semaphore = malloc(sizeof(sem_t));
+
+    if(!semaphore) return NULL;
+
+    if(LWP_SemInit(semaphore, count, 0xFFFFFFFF))
+    {
+        free(semaphore);
+        return NULL;
+    }
+
+    return semaphore;
+}
+
+void SemaphorePost(void* semaphore) { LWP_SemPost(*(sem_t*)semaphore); }
+
+void SemaphoreWait(void* semaphore) { LWP_SemWait(*(sem_t*)semaphore); }
+
+void SemaphoreFree(void* semaphore)
+{
+    if(!semaphore) return;
+
+    LWP_SemDestroy(*(sem_t*)semaphore);
+    free(semaphore);
+}
+
+void SleepSeconds(uint32_t seconds) { sleep(seconds); }
+
+uint64_t GetMicroseconds() { return ticks_to_microsecs(gettime()); }
+
+int32_t GetRandomBytes(void* buf, uint32_t len)
+{
+    uint32_t i;
+
+    // There is no entropy source, the time base is the best there is
+    srand((unsigned int)gettime());
+
+    for(i = 0; i < len; i++) ((unsigned char*)buf)[i] = (unsigned char)rand();
+
+    return 0;
+}
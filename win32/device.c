@@ -161,4 +161,64 @@ int32_t OsRead(void* device_ctx, char* buffer, uint64_t offset, uint32_t length,
     ret = ReadFile(ctx->handle, buffer, length, &nNumberOfBytesRead, NULL);
 
     return !ret ? GetLastError() : 0;
-}
\ No newline at end of file
+}
+
+// Without a vectored read each extent is read on its own, in offset order
+int32_t OsReadv(void* device_ctx, OsReadExtent* extents, uint32_t count)
+{
+    DeviceContext* ctx = device_ctx;
+    LARGE_INTEGER  liDistanceToMove;
+    DWORD          nNumberOfBytesRead;
+    uint32_t       n;
+
+    if(!ctx) return -1;
+
+    for(n = 0; n < count; n++)
+    {
+        liDistanceToMove.QuadPart = extents[n].offset;
+        nNumberOfBytesRead        = 0;
+        extents[n].error_no       = 0;
+
+        if(!SetFilePointerEx(ctx->handle, liDistanceToMove, NULL, FILE_BEGIN) ||
+           !ReadFile(ctx->handle, extents[n].buffer, extents[n].length, &nNumberOfBytesRead, NULL))
+            extents[n].error_no = GetLastError();
+
+        extents[n].read = nNumberOfBytesRead;
+    }
+
+    return 0;
+}
+
+int32_t OsReadToNet(void* device_ctx, void* net_ctx, AaruPacketResOsRead* pkt_res, uint64_t offset, uint32_t length)
+{
+    // Not supported, the response is read into memory
+    return 0;
+}
+
+uint32_t OsReadToNetMaximum() { return 0; }
+
+// Files know their size, disks have to be asked. 0 when neither applies.
+uint64_t OsGetSize(void* device_ctx)
+{
+    DeviceContext*         ctx = device_ctx;
+    GET_LENGTH_INFORMATION length_info;
+    LARGE_INTEGER          size;
+    DWORD                  returned;
+
+    if(!ctx) return 0;
+
+    if(DeviceIoControl(ctx->handle,
+                       IOCTL_DISK_GET_LENGTH_INFO,
+                       NULL,
+                       0,
+                       &length_info,
+                       sizeof(GET_LENGTH_INFORMATION),
+                       &returned,
+                       NULL))
+        return (uint64_t)length_info.Length.QuadPart;
+
+    return GetFileSizeEx(ctx->handle, &size) ? (uint64_t)size.QuadPart : 0;
+}
+
+// Depends on the host adapter
+uint32_t GetMaxTransfer(int32_t device_type) { return 0; }
@@ -72,6 +72,8 @@ AaruPacketHello* GetHello()
     strncpy(pkt_server_hello->application, AARUREMOTE_NAME, sizeof(AARUREMOTE_NAME));
     strncpy(pkt_server_hello->version, AARUREMOTE_VERSION, sizeof(AARUREMOTE_VERSION));
     pkt_server_hello->max_protocol = AARUREMOTE_PROTOCOL_MAX;
+    pkt_server_hello->flags =
+        AARUREMOTE_HELLO_FLAG_COMPRESSION | AARUREMOTE_HELLO_FLAG_SPARSE | AARUREMOTE_HELLO_FLAG_SCSI_CACHE;
 
     ZeroMemory(&osvi, sizeof(OSVERSIONINFO));
     osvi.dwOSVersionInfoSize = sizeof(OSVERSIONINFO);
@@ -148,36 +148,50 @@ void* NetAccept(void* net_ctx, struct sockaddr* addr, socklen_t* addrlen)
     return cli_ctx;
 }
 
-int32_t NetRecv(void* net_ctx, void* buf, int32_t len, uint32_t flags)
+int32_t NetRecvAvailable(void* net_ctx, void* buf, int32_t len, uint8_t wait)
 {
-    NetworkContext* ctx     = net_ctx;
-    char*           charbuf = buf;
-    int32_t         got_once;
-    int32_t         got_total = 0;
+    NetworkContext* ctx = net_ctx;
 
     if(!ctx) return -1;
 
-    while(len > 0)
-    {
-        got_once = recv(ctx->socket, charbuf, len, flags);
+    return recv(ctx->socket, buf, len, 0);
+}
 
-        if(got_once <= 0) break;
+int32_t NetWrite(void* net_ctx, const void* buf, int32_t size)
+{
+    NetworkContext* ctx = net_ctx;
 
-        charbuf += got_once;
-        got_total += got_once;
-        len -= got_once;
-    }
+    if(!ctx) return -1;
 
-    return got_total;
+    return send(ctx->socket, buf, size, 0);
 }
 
-int32_t NetWrite(void* net_ctx, const void* buf, int32_t size)
+int32_t NetWritev(void* net_ctx, const NetIoVec* iov, int32_t iov_count)
 {
     NetworkContext* ctx = net_ctx;
+    WSABUF*         bufs;
+    DWORD           sent;
+    int32_t         i;
+    int             ret;
 
     if(!ctx) return -1;
 
-    return send(ctx->socket, buf, size, 0);
+    bufs = malloc(sizeof(WSABUF) * iov_count);
+
+    if(!bufs) return -1;
+
+    for(i = 0; i < iov_count; i++)
+    {
+        bufs[i].buf = (CHAR*)iov[i].buf;
+        bufs[i].len = iov[i].len;
+    }
+
+    ret = WSASend(ctx->socket, bufs, iov_count, &sent, 0, NULL, NULL);
+    free(bufs);
+
+    if(ret == SOCKET_ERROR) return -1;
+
+    return sent;
 }
 
 int32_t NetClose(void* net_ctx)
@@ -190,4 +204,22 @@ int32_t NetClose(void* net_ctx)
     ret = closesocket(ctx->socket);
     free(ctx);
     return ret;
-}
\ No newline at end of file
+}
+
+int32_t NetFlush(void* net_ctx) { return 0; }
+
+int32_t NetDrain(void* net_ctx) { return 0; }
+
+void* NetPollCreate() { return NULL; }
+
+int32_t NetPollAdd(void* poll_ctx, void* net_ctx, void* data) { return -1; }
+
+int32_t NetPollRearm(void* poll_ctx, void* net_ctx, void* data) { return -1; }
+
+int32_t NetPollRemove(void* poll_ctx, void* net_ctx) { return -1; }
+
+void* NetPollWait(void* poll_ctx, uint32_t* events) { return NULL; }
+
+void* NetListenLocal(const char* path, uint32_t backlog) { return NULL; }
+
+int32_t NetSendFd(void* net_ctx, const void* buf, int32_t len, int32_t fd) { return -1; }
\ No newline at end of file
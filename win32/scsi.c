@@ -21,10 +21,17 @@
 #include "../aaruremote.h"
 #include "ntioctl.h"
 
+// Lives on the stack, the sense data follows the request as the driver expects it
+typedef struct
+{
+    SCSI_PASS_THROUGH_DIRECT sptd;
+    UCHAR                    sense[AARUREMOTE_SENSE_BUFFER_SIZE];
+} SptdWithSense;
+
 int32_t SendScsiCommand(void*     device_ctx,
                         char*     cdb,
                         char*     buffer,
-                        char**    sense_buffer,
+                        char*     sense_buffer,
                         uint32_t  timeout,
                         int32_t   direction,
                         uint32_t* duration,
@@ -35,7 +42,7 @@ int32_t SendScsiCommand(void*     device_ctx,
 {
     DeviceContext*            ctx = device_ctx;
     PSCSI_PASS_THROUGH_DIRECT sptd;
-    PVOID                     sptd_and_sense;
+    SptdWithSense             sptd_and_sense;
     UCHAR                     dir;
     DWORD                     sptd_and_sense_len;
     DWORD                     k     = 0;
@@ -46,25 +53,16 @@ int32_t SendScsiCommand(void*     device_ctx,
     LARGE_INTEGER             end;
     DOUBLE                    interval;
 
-    *duration          = 0;
-    *sense_len         = 32;
-    sptd_and_sense_len = *sense_len + sizeof(SCSI_PASS_THROUGH_DIRECT);
+    *duration = 0;
 
     if(!ctx) return -1;
 
-    sptd_and_sense = malloc(sptd_and_sense_len);
-
-    if(!sptd_and_sense) return -1;
-
-    memset(sptd_and_sense, 0, sptd_and_sense_len);
+    // The caller owns the sense buffer, the request carries at most as much as it can take
+    if(*sense_len > AARUREMOTE_SENSE_BUFFER_SIZE) *sense_len = AARUREMOTE_SENSE_BUFFER_SIZE;
 
-    *sense_buffer = malloc(*sense_len);
+    sptd_and_sense_len = *sense_len + sizeof(SCSI_PASS_THROUGH_DIRECT);
 
-    if(!*sense_buffer)
-    {
-        free(sptd_and_sense);
-        return -1;
-    }
+    memset(&sptd_and_sense, 0, sptd_and_sense_len);
 
     switch(direction)
     {
@@ -76,9 +74,9 @@ int32_t SendScsiCommand(void*     device_ctx,
         default: dir = SCSI_IOCTL_DATA_UNSPECIFIED; break;
     }
 
-    memset(*sense_buffer, 0, *sense_len);
+    memset(sense_buffer, 0, *sense_len);
 
-    sptd = sptd_and_sense;
+    sptd = &sptd_and_sense.sptd;
 
     QueryPerformanceFrequency(&frequency);
 
@@ -92,14 +90,14 @@ int32_t SendScsiCommand(void*     device_ctx,
     sptd->TimeOutValue       = timeout;
     sptd->DataBuffer         = buffer;
     sptd->Length             = sizeof(SCSI_PASS_THROUGH_DIRECT);
-    sptd->SenseInfoOffset    = sizeof(SCSI_PASS_THROUGH_DIRECT);
+    sptd->SenseInfoOffset    = FIELD_OFFSET(SptdWithSense, sense);
 
     QueryPerformanceCounter(&start);
     hasError = !DeviceIoControl(ctx->handle,
                                 IOCTL_SCSI_PASS_THROUGH_DIRECT,
-                                sptd_and_sense,
+                                &sptd_and_sense,
                                 sptd_and_sense_len,
-                                sptd_and_sense,
+                                &sptd_and_sense,
                                 sptd_and_sense_len,
                                 &k,
                                 NULL);
@@ -111,8 +109,10 @@ int32_t SendScsiCommand(void*     device_ctx,
     if(hasError) error = GetLastError();
 
     *sense = sptd->ScsiStatus != 0;
-    memcpy(*sense_buffer, (char*)sptd_and_sense + sizeof(SCSI_PASS_THROUGH_DIRECT), *sense_len);
+    memcpy(sense_buffer, sptd_and_sense.sense, *sense_len);
 
-    free(sptd_and_sense);
     return error;
-}
\ No newline at end of file
+}
+
+// There is no fallback to copying to count, the buffer is always handed to the device as it is
+void ScsiDirectStats(void* device_ctx, uint64_t* transfers, uint64_t* direct) {}
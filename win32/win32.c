@@ -15,12 +15,24 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _CRT_RAND_S
 #include <windows.h>
+#include <stdlib.h>
 
 #include "win32.h"
 
 #include "../aaruremote.h"
 
+DWORD WINAPI WorkerThreadProc(LPVOID parameter)
+{
+    WorkerThreadArguments args = *(WorkerThreadArguments*)parameter;
+
+    free(parameter);
+    args.thread_func(args.arguments);
+
+    return 0;
+}
+
 void Initialize()
 {
     // Do nothing
@@ -44,4 +56,106 @@ uint8_t AmIRoot()
     }
 
     return b;
-}
\ No newline at end of file
+}
+
+int32_t StartWorkerThread(void* (*thread_func)(void*), void* arguments)
+{
+    WorkerThreadArguments* args;
+    HANDLE                 thread;
+
+    args = malloc(sizeof(WorkerThreadArguments));
+
+    if(!args) return -1;
+
+    args->thread_func = thread_func;
+    args->arguments   = arguments;
+
+    thread = CreateThread(NULL, 0, WorkerThreadProc, args, 0, NULL);
+
+    if(thread == NULL)
+    {
+        free(args);
+        return GetLastError();
+    }
+
+    CloseHandle(thread);
+
+    return 0;
+}
+
+uint32_t GetProcessorCount()
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors;
+}
+
+void* MutexCreate()
+{
+    CRITICAL_SECTION* mutex = malloc(sizeof(CRITICAL_SECTION));
+
+    if(!mutex) return NULL;
+
+    InitializeCriticalSection(mutex);
+
+    return mutex;
+}
+
+void MutexLock(void* mutex) { EnterCriticalSection(mutex); }
+
+void MutexUnlock(void* mutex) { LeaveCriticalSection(mutex); }
+
+void MutexFree(void* mutex)
+{
+    if(!mutex) return;
+
+    DeleteCriticalSection(mutex);
+    free(mutex);
+}
+
+void* SemaphoreCreate(uint32_t count) { return CreateSemaphore(NULL, count, MAXLONG, NULL); }
+
+void SemaphorePost(void* semaphore) { ReleaseSemaphore(semaphore, 1, NULL); }
+
+void SemaphoreWait(void* semaphore) { WaitForSingleObject(semaphore, INFINITE); }
+
+void SemaphoreFree(void* semaphore)
+{
+    if(semaphore) CloseHandle(semaphore);
+}
+
+void SleepSeconds(uint32_t seconds) { Sleep(seconds * 1000); }
+
+uint64_t GetMicroseconds()
+{
+    LARGE_INTEGER now;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+
+    return (uint64_t)(now.QuadPart / frequency.QuadPart * 1000000 +
+                      now.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
+
+int32_t GetRandomBytes(void* buf, uint32_t len)
+{
+    unsigned int value;
+    uint32_t     i;
+
+    for(i = 0; i < len; i++)
+    {
+        if(rand_s(&value)) return -1;
+
+        ((unsigned char*)buf)[i] = (unsigned char)value;
+    }
+
+    return 0;
+}
+
+// Shared memory needs a descriptor to pass over a local socket
+void* ShmCreate(uint32_t size, int32_t* fd) { return NULL; }
+
+void ShmFree(void* shm, uint32_t size, int32_t fd) {}
@@ -56,6 +56,12 @@ typedef struct
     char   device_path[4096];
 } DeviceContext;
 
+typedef struct
+{
+    void* (*thread_func)(void*);
+    void* arguments;
+} WorkerThreadArguments;
+
 #ifndef SM_SERVERR2
 #define SM_SERVERR2 89
 #endif
@@ -33,62 +33,283 @@
 #include "aaruremote.h"
 #include "endian.h"
 
+static void*          session_mutex;
+static OrphanSession* orphan_sessions;
+static uint32_t       resume_grace;
+static uint32_t       scsi_cache_size;
+static uint8_t        read_ahead_enabled;
+static void*          ready_mutex;
+static void*          ready_wake;
+static ClientContext* ready_head;
+static ClientContext* ready_tail;
+static uint32_t       ready_idle;
+
+// Stops the prefetchers before the device they read from is closed, reopened or replaced
+static void DropDeviceCaches(ClientContext* client)
+{
+    if(client->scsi_cache)
+    {
+        ScsiCacheStats(
+            client->scsi_cache, &client->scsi_cache_hits, &client->scsi_cache_misses, &client->scsi_cache_prefetched);
+        ScsiCacheFree(client->scsi_cache);
+        client->scsi_cache = NULL;
+    }
+
+    if(client->read_ahead)
+    {
+        ReadAheadStats(
+            client->read_ahead, &client->read_ahead_hits, &client->read_ahead_misses, &client->read_ahead_stalls);
+        ReadAheadFree(client->read_ahead);
+        client->read_ahead = NULL;
+    }
+
+    ScsiDirectStats(client->device_ctx, &client->scsi_transfers, &client->scsi_direct_transfers);
+}
+
+static uint8_t AtaProtocolReads(uint8_t protocol)
+{
+    return protocol == AARUREMOTE_ATA_PROTOCOL_PIO_IN || protocol == AARUREMOTE_ATA_PROTOCOL_UDMA_IN;
+}
+
+// Data goes to the device from a page aligned buffer, that the kernel can map instead of copying through its own.
+// Reads only need it cleared, as clients send it, for whatever the device transfers short of the length.
+static char* ClientDmaBuffer(ClientContext* client, char* data, uint32_t len, uint8_t read)
+{
+    char* new_buf;
+
+    if(!data || len == 0) return data;
+
+    if(len > client->dma_size)
+    {
+        new_buf = DmaAlloc(len);
+
+        // Without it the command runs from the packet, as it always did
+        if(!new_buf) return data;
+
+        DmaFree(client->dma_buf);
+        client->dma_buf  = new_buf;
+        client->dma_size = len;
+    }
+
+    if(read) memset(client->dma_buf, 0, len);
+    else
+        memcpy(client->dma_buf, data, len);
+
+    return client->dma_buf;
+}
+
+static void* ClientReadAhead(ClientContext* client)
+{
+    if(!client->read_ahead && client->device_ctx && read_ahead_enabled)
+        client->read_ahead = ReadAheadCreate(client->device_ctx);
+
+    return client->read_ahead;
+}
+
+static int32_t ClientOsRead(ClientContext* client, char* buffer, uint64_t offset, uint32_t length, uint32_t* duration)
+{
+    if(!ClientReadAhead(client)) return OsRead(client->device_ctx, buffer, offset, length, duration);
+
+    return ReadAheadRead(client->read_ahead, buffer, offset, length, duration);
+}
+
+static int32_t ClientScsiCommand(ClientContext* client,
+                                 char*          cdb,
+                                 char*          buffer,
+                                 char*          sense_buffer,
+                                 uint32_t       timeout,
+                                 int32_t        direction,
+                                 uint32_t*      duration,
+                                 uint32_t*      sense,
+                                 uint32_t       cdb_len,
+                                 uint32_t*      buf_len,
+                                 uint32_t*      sense_len)
+{
+    if(!client->scsi_cache && client->device_ctx && client->scsi_cache_enabled)
+        client->scsi_cache = ScsiCacheCreate(client->device_ctx, scsi_cache_size);
+
+    if(!client->scsi_cache)
+        return SendScsiCommand(client->device_ctx,
+                               cdb,
+                               buffer,
+                               sense_buffer,
+                               timeout,
+                               direction,
+                               duration,
+                               sense,
+                               cdb_len,
+                               buf_len,
+                               sense_len);
+
+    return ScsiCacheCommand(client->scsi_cache,
+                            cdb,
+                            buffer,
+                            sense_buffer,
+                            timeout,
+                            direction,
+                            duration,
+                            sense,
+                            cdb_len,
+                            buf_len,
+                            sense_len);
+}
+
+static void StopDeviceHandle(ClientContext* handle_client)
+{
+    // Posting without a packet stops the thread once it has run what was queued before
+    SemaphorePost(handle_client->queue->ready);
+    SemaphoreWait(handle_client->queue->stopped);
+
+    // The connection belongs to the client that opened the handle
+    handle_client->net_ctx = NULL;
+    FreeClient(handle_client);
+}
+
+void FreeClient(ClientContext* client)
+{
+    uint32_t n;
+
+    if(!client) return;
+
+    // Device handle threads write to the connection, they must be done before it is closed
+    if(client->handles)
+    {
+        for(n = 0; n < AARUREMOTE_MAX_DEVICE_HANDLES; n++)
+            if(client->handles[n]) StopDeviceHandle(client->handles[n]);
+
+        free(client->handles);
+    }
+
+    DropDeviceCaches(client);
+
+    // Keep the device open for a while so the client can resume after a dropped connection
+    if(client->device_ctx && ParkSession(client) != 0) DeviceClose(client->device_ctx);
+
+    if(client->net_ctx) NetClose(client->net_ctx);
+
+    if(client->packets > 0 && !client->queue)
+        printf("Client %s sent %llu packets using %llu receive calls.\n",
+               client->address,
+               (unsigned long long)client->packets,
+               (unsigned long long)client->recv_calls);
+
+    if(client->packets > 0)
+        printf("Client %s needed %llu heap allocations to process its packets.\n",
+               client->address,
+               (unsigned long long)client->arena.mallocs);
+
+    if(client->scsi_cache_hits + client->scsi_cache_misses > 0)
+        printf("Client %s had %llu SCSI reads served from cache and %llu from the device, %llu sectors prefetched.\n",
+               client->address,
+               (unsigned long long)client->scsi_cache_hits,
+               (unsigned long long)client->scsi_cache_misses,
+               (unsigned long long)client->scsi_cache_prefetched);
+
+    if(client->scsi_transfers > 0)
+        printf("Client %s had %llu of %llu SCSI transfers mapped straight to its buffers.\n",
+               client->address,
+               (unsigned long long)client->scsi_direct_transfers,
+               (unsigned long long)client->scsi_transfers);
+
+    if(client->read_ahead_hits > 0)
+        printf("Client %s had %llu OS reads served by read-ahead, %llu from the device, %llu waited for the disk.\n",
+               client->address,
+               (unsigned long long)client->read_ahead_hits,
+               (unsigned long long)client->read_ahead_misses,
+               (unsigned long long)client->read_ahead_stalls);
+
+    if(client->compress)
+        printf("Client %s was sent %llu bytes raw and %llu bytes compressed into %llu bytes.\n",
+               client->address,
+               (unsigned long long)client->raw_bytes,
+               (unsigned long long)client->compressed_in_bytes,
+               (unsigned long long)client->compressed_out_bytes);
+
+    if(client->shm)
+        printf("Client %s was sent %llu bytes through shared memory.\n",
+               client->address,
+               (unsigned long long)client->shm_bytes);
+
+    if(client->sparse)
+        printf("Client %s was spared %llu bytes of zeroes.\n",
+               client->address,
+               (unsigned long long)client->sparse_bytes);
+
+    free(client->rx_buf);
+    free(client->lz_table);
+    free(client->lz_in);
+    free(client->lz_out);
+    free(client->pkt_res_sparse);
+    free(client->sparse_map);
+    free(client->sparse_iov);
+    DmaFree(client->stream_buf);
+    DmaFree(client->dma_buf);
+    ArenaFree(&client->arena);
+
+    if(client->queue)
+    {
+        MutexFree(client->queue->mutex);
+        SemaphoreFree(client->queue->ready);
+        SemaphoreFree(client->queue->stopped);
+        free(client->queue);
+    }
+    // Handles share the lock of the client that opened them
+    else
+        MutexFree(client->send_mutex);
+
+    if(client->shm) ShmFree(client->shm, AARUREMOTE_SHM_HEADER_SIZE + client->shm_size, client->shm_fd);
+    free(client->pkt_nop);
+    free(client);
+}
+
+ClientContext* CreateClient(void* net_ctx, AaruPacketHello* pkt_server_hello)
+{
+    ClientContext* client;
+
+    client = malloc(sizeof(ClientContext));
+
+    if(!client) return NULL;
+
+    memset(client, 0, sizeof(ClientContext));
+
+    client->net_ctx          = net_ctx;
+    client->pkt_server_hello = pkt_server_hello;
+    client->pkt_nop          = malloc(sizeof(AaruPacketNop));
+    client->rx_buf           = malloc(AARUREMOTE_RX_BUFFER_SIZE);
+    client->rx_size          = AARUREMOTE_RX_BUFFER_SIZE;
+
+    if(!client->pkt_nop || !client->rx_buf)
+    {
+        client->net_ctx = NULL;
+        FreeClient(client);
+        return NULL;
+    }
+
+    memset(client->pkt_nop, 0, sizeof(AaruPacketNop));
+
+    client->pkt_nop->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    client->pkt_nop->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    client->pkt_nop->hdr.len         = htole32(sizeof(AaruPacketNop));
+    client->pkt_nop->hdr.version     = AARUREMOTE_PACKET_VERSION;
+    client->pkt_nop->hdr.packet_type = AARUREMOTE_PACKET_TYPE_NOP;
+
+    return client;
+}
+
 void* WorkingLoop(void* arguments)
 {
-    AtaErrorRegistersChs            ata_chs_error_regs;
-    AtaErrorRegistersLba28          ata_lba28_error_regs;
-    AtaErrorRegistersLba48          ata_lba48_error_regs;
-    char*                           buffer;
-    char*                           cdb_buf;
-    char*                           cid;
-    char*                           csd;
-    char*                           in_buf;
-    char*                           ocr;
-    char*                           out_buf;
-    char*                           scr;
-    char*                           sense_buf;
-    AaruPacketCmdAtaChs*            pkt_cmd_ata_chs;
-    AaruPacketCmdAtaLba28*          pkt_cmd_ata_lba28;
-    AaruPacketCmdAtaLba48*          pkt_cmd_ata_lba48;
-    AaruPacketCmdOpen*              pkt_dev_open;
-    AaruPacketCmdScsi*              pkt_cmd_scsi;
-    AaruPacketCmdSdhci*             pkt_cmd_sdhci;
-    AaruPacketMultiCmdSdhci*        pkt_cmd_multi_sdhci;
-    AaruPacketHeader*               pkt_hdr;
-    AaruPacketHello*                pkt_server_hello;
-    AaruPacketHello*                pkt_client_hello;
-    AaruPacketNop*                  pkt_nop;
-    AaruPacketResAmIRoot*           pkt_res_am_i_root;
-    AaruPacketResAtaChs*            pkt_res_ata_chs;
-    AaruPacketResAtaLba28*          pkt_res_ata_lba28;
-    AaruPacketResAtaLba48*          pkt_res_ata_lba48;
-    AaruPacketResGetDeviceType*     pkt_dev_type;
-    AaruPacketResGetFireWireData*   pkt_res_firewire;
-    AaruPacketResGetPcmciaData*     pkt_res_pcmcia;
-    AaruPacketResGetSdhciRegisters* pkt_res_sdhci_registers;
-    AaruPacketResGetUsbData*        pkt_res_usb;
-    AaruPacketResListDevs*          pkt_res_devinfo;
-    AaruPacketResScsi*              pkt_res_scsi;
-    AaruPacketResSdhci*             pkt_res_sdhci;
-    AaruPacketMultiResSdhci*        pkt_res_multi_sdhci;
-    AaruPacketCmdOsRead*            pkt_cmd_osread;
-    AaruPacketResOsRead*            pkt_res_osread;
-    int                             skip_next_hdr;
-    int                             ret;
-    socklen_t                       cli_len;
-    ssize_t                         recv_size;
-    struct DeviceInfoList*          device_info_list;
-    struct sockaddr_in              cli_addr, serv_addr;
-    uint32_t                        duration;
-    uint32_t                        sdhci_response[4];
-    uint32_t                        sense;
-    uint32_t                        sense_len;
-    uint32_t                        n;
-    void*                           device_ctx = NULL;
-    void*                           net_ctx    = NULL;
-    void*                           cli_ctx    = NULL;
-    long                            off;
-    MmcSingleCommand*               multi_sdhci_commands;
+    int                    ret;
+    struct sockaddr_in     serv_addr;
+    void*                  net_ctx  = NULL;
+    void*                  poll_ctx = NULL;
+    AaruPacketHello*       pkt_server_hello;
+    uint32_t               n;
+    char*                  grace;
+    char*                  cache_size;
+    char*                  read_ahead;
+    char*                  local_path;
+    static ListenerContext tcp_listener;
+    static ListenerContext local_listener;
 
     if(!arguments)
     {
@@ -98,6 +319,35 @@ void* WorkingLoop(void* arguments)
 
     pkt_server_hello = (AaruPacketHello*)arguments;
 
+    grace        = getenv("AARUREMOTE_RESUME_GRACE");
+    resume_grace = grace ? (uint32_t)strtoul(grace, NULL, 10) : AARUREMOTE_RESUME_GRACE;
+
+    // Largest cache a client can ask for in its hello, 0 refuses it to all of them
+    cache_size      = getenv("AARUREMOTE_SCSI_CACHE");
+    scsi_cache_size = cache_size ? (uint32_t)strtoul(cache_size, NULL, 10) : AARUREMOTE_SCSI_CACHE_SIZE / 1048576;
+
+    if(scsi_cache_size > 1024) scsi_cache_size = 1024;
+
+    scsi_cache_size *= 1048576;
+
+    if(scsi_cache_size == 0) pkt_server_hello->flags &= ~AARUREMOTE_HELLO_FLAG_SCSI_CACHE;
+
+    read_ahead         = getenv("AARUREMOTE_READ_AHEAD");
+    read_ahead_enabled = read_ahead ? strtoul(read_ahead, NULL, 10) != 0 : 1;
+
+    if(resume_grace > 0)
+    {
+        session_mutex = MutexCreate();
+
+        if(!session_mutex || StartWorkerThread(ReaperLoop, NULL) != 0)
+        {
+            printf("Error %d starting session reaper, sessions will not be resumable.\n", errno);
+            resume_grace = 0;
+        }
+        else
+            printf("Sessions can be resumed for %u seconds after a disconnection.\n", resume_grace);
+    }
+
     printf("Opening socket.\n");
     net_ctx = NetSocket(AF_INET, SOCK_STREAM, 0);
     if(!net_ctx)
@@ -117,7 +367,7 @@ void* WorkingLoop(void* arguments)
         return NULL;
     }
 
-    ret = NetListen(net_ctx, 1);
+    ret = NetListen(net_ctx, AARUREMOTE_LISTEN_BACKLOG);
 
     if(ret)
     {
@@ -126,22 +376,63 @@ void* WorkingLoop(void* arguments)
         return NULL;
     }
 
-    pkt_nop = malloc(sizeof(AaruPacketNop));
+    // When the platform has an event loop a few threads wait on all clients, otherwise one thread per client
+    ready_mutex = MutexCreate();
+    ready_wake  = SemaphoreCreate(0);
+    poll_ctx    = ready_mutex && ready_wake ? NetPollCreate() : NULL;
 
-    if(!pkt_nop)
+    for(n = 0; poll_ctx && n < AARUREMOTE_POLL_WORKERS; n++)
     {
-        printf("Fatal error %d allocating memory.\n", errno);
-        NetClose(net_ctx);
-        return NULL;
+        ret = StartWorkerThread(PollLoop, poll_ctx);
+
+        if(ret)
+        {
+            printf("Error %d starting event loop worker.\n", ret);
+            NetClose(net_ctx);
+            return NULL;
+        }
+    }
+
+    // Clients on the same machine can skip the TCP stack, and get the shared memory data path
+    local_path = getenv("AARUREMOTE_LOCAL_SOCKET");
+
+    if(!local_path) local_path = AARUREMOTE_LOCAL_SOCKET;
+
+    if(local_path[0])
+    {
+        local_listener.net_ctx          = NetListenLocal(local_path, AARUREMOTE_LISTEN_BACKLOG);
+        local_listener.poll_ctx         = poll_ctx;
+        local_listener.pkt_server_hello = pkt_server_hello;
+        local_listener.local            = 1;
+
+        if(!local_listener.net_ctx)
+            printf("Error %d listening on %s, local clients will have to use TCP.\n", errno, local_path);
+        else if(StartWorkerThread(AcceptLoop, &local_listener) != 0)
+        {
+            printf("Error %d starting local listener, local clients will have to use TCP.\n", errno);
+            NetClose(local_listener.net_ctx);
+        }
+        else
+            printf("Local clients can connect to %s\n", local_path);
     }
 
-    memset(pkt_nop, 0, sizeof(AaruPacketNop));
+    tcp_listener.net_ctx          = net_ctx;
+    tcp_listener.poll_ctx         = poll_ctx;
+    tcp_listener.pkt_server_hello = pkt_server_hello;
+    tcp_listener.local            = 0;
+
+    return AcceptLoop(&tcp_listener);
+}
 
-    pkt_nop->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-    pkt_nop->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-    pkt_nop->hdr.len         = htole32(sizeof(AaruPacketNop));
-    pkt_nop->hdr.version     = AARUREMOTE_PACKET_VERSION;
-    pkt_nop->hdr.packet_type = AARUREMOTE_PACKET_TYPE_NOP;
+void* AcceptLoop(void* arguments)
+{
+    ListenerContext*   listener = arguments;
+    int                ret;
+    socklen_t          cli_len;
+    struct sockaddr_in cli_addr;
+    void*              cli_ctx;
+    ClientContext*     client;
+    const char*        address;
 
     for(;;)
     {
@@ -149,1171 +440,3100 @@ void* WorkingLoop(void* arguments)
         printf("Waiting for a client...\n");
 
         cli_len = sizeof(cli_addr);
-        cli_ctx = NetAccept(net_ctx, (struct sockaddr*)&cli_addr, &cli_len);
+        cli_ctx = listener->local ? NetAccept(listener->net_ctx, NULL, NULL)
+                                  : NetAccept(listener->net_ctx, (struct sockaddr*)&cli_addr, &cli_len);
 
         if(!cli_ctx)
         {
             printf("Error %d accepting incoming connection.\n", errno);
-            free(pkt_nop);
-            NetClose(net_ctx);
+            NetClose(listener->net_ctx);
             return NULL;
         }
 
-        printf("Client %s connected successfully.\n", PrintIpv4Address(cli_addr.sin_addr));
+        address = listener->local ? "local" : PrintIpv4Address(cli_addr.sin_addr);
 
-        NetWrite(cli_ctx, pkt_server_hello, sizeof(AaruPacketHello));
+        printf("Client %s connected successfully.\n", address);
 
-        pkt_hdr = malloc(sizeof(AaruPacketHeader));
+        client = CreateClient(cli_ctx, listener->pkt_server_hello);
 
-        if(!pkt_hdr)
+        if(!client)
         {
-            printf("Fatal error %d allocating memory.\n", errno);
+            printf("Error %d allocating memory for client, closing connection...\n", errno);
             NetClose(cli_ctx);
-            NetClose(net_ctx);
-            free(pkt_server_hello);
-            free(pkt_nop);
-            return NULL;
+            continue;
         }
 
-        recv_size = NetRecv(cli_ctx, pkt_hdr, sizeof(AaruPacketHeader), MSG_PEEK);
+        strncpy(client->address, address, sizeof(client->address) - 1);
+        client->local = listener->local;
 
-        if(recv_size < 0)
-        {
-            printf("Error %d reading response from client.\n", errno);
-            free(pkt_hdr);
-            NetClose(cli_ctx);
-            continue;
-        }
+        NetWrite(cli_ctx, listener->pkt_server_hello, sizeof(AaruPacketHello));
 
-        if(recv_size == 0)
+        client->poll_ctx = listener->poll_ctx;
+
+        if(listener->poll_ctx) ret = NetPollAdd(listener->poll_ctx, cli_ctx, client);
+        else
+            ret = StartWorkerThread(ClientLoop, client);
+
+        if(ret)
         {
-            printf("Client closed connection.\n");
-            free(pkt_hdr);
-            NetClose(cli_ctx);
+            printf("Error %d servicing client %s, closing connection...\n", ret, client->address);
+            FreeClient(client);
             continue;
         }
+    }
+}
+
+// Hands a ready client to an idle session thread, or to a new one when all are busy.
+// There is no limit, so a client stuck on its device or its socket never holds up another.
+static void QueueReadyClient(ClientContext* client, uint32_t events)
+{
+    uint8_t wake;
+
+    MutexLock(ready_mutex);
+
+    client->poll_events = events;
+    client->next_ready  = NULL;
+
+    if(ready_tail) ready_tail->next_ready = client;
+    else
+        ready_head = client;
+
+    ready_tail = client;
+    wake       = ready_idle > 0;
+
+    if(wake) ready_idle--;
+
+    MutexUnlock(ready_mutex);
 
-        if(pkt_hdr->remote_id != htole32(AARUREMOTE_REMOTE_ID) || pkt_hdr->packet_id != htole32(AARUREMOTE_PACKET_ID))
+    if(wake) SemaphorePost(ready_wake);
+    else if(StartWorkerThread(SessionLoop, NULL) != 0)
+        printf("Error %d starting session thread, client %s waits for a busy one.\n", errno, client->address);
+}
+
+// Only waits for clients to become ready, so it never blocks on any of them
+void* PollLoop(void* arguments)
+{
+    void*          poll_ctx = arguments;
+    ClientContext* client;
+    uint32_t       events;
+
+    for(;;)
+    {
+        client = NetPollWait(poll_ctx, &events);
+
+        if(!client)
         {
-            printf("Received data is not a correct aaruremote packet, closing connection...\n");
-            free(pkt_hdr);
-            NetClose(cli_ctx);
-            continue;
+            printf("Error %d waiting for client events.\n", errno);
+            return NULL;
         }
 
-        if(pkt_hdr->version != AARUREMOTE_PACKET_VERSION)
+        // One shot, so the client is not reported again until its session thread rearms it
+        QueueReadyClient(client, events);
+    }
+}
+
+void* SessionLoop(void* arguments)
+{
+    ClientContext* client;
+    uint32_t       events = 0;
+    int32_t        ret;
+
+    (void)arguments;
+
+    for(;;)
+    {
+        MutexLock(ready_mutex);
+
+        client = ready_head;
+
+        if(client)
         {
-            printf("Unrecognized packet version, closing connection...\n");
-            free(pkt_hdr);
-            NetClose(cli_ctx);
-            continue;
+            ready_head = client->next_ready;
+            events     = client->poll_events;
+
+            if(!ready_head) ready_tail = NULL;
         }
+        else
+            ready_idle++;
+
+        MutexUnlock(ready_mutex);
 
-        if(pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_HELLO)
+        if(!client)
         {
-            printf("Expecting hello packet type, received type %d, closing connection...\n", pkt_hdr->packet_type);
-            free(pkt_hdr);
-            NetClose(cli_ctx);
+            SemaphoreWait(ready_wake);
             continue;
         }
 
-        pkt_client_hello = malloc(le32toh(pkt_hdr->len));
+        ret = 0;
+
+        if(events & AARUREMOTE_POLL_OUT) ret = NetFlush(client->net_ctx) < 0 ? -1 : 0;
 
-        if(!pkt_client_hello)
+        // Handle every complete packet already received, stopping when the rest has not arrived yet
+        while(ret == 0 && (events & AARUREMOTE_POLL_IN))
         {
-            printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-            free(pkt_hdr);
-            NetClose(cli_ctx);
-            continue;
+            ret = FillPacket(client, 0);
+
+            if(ret <= 0) break;
+
+            ret = client->hello_received ? ProcessPacket(client) : ReceiveClientHello(client);
         }
 
-        recv_size = NetRecv(cli_ctx, pkt_client_hello, le32toh(pkt_hdr->len), 0);
+        if(ret == 0) ret = NetPollRearm(client->poll_ctx, client->net_ctx, client);
 
-        if(recv_size != le32toh(pkt_hdr->len))
+        if(ret)
         {
-            printf("Expected %d bytes of packet, got %ld, closing connection...\n", le32toh(pkt_hdr->len), recv_size);
-            NetClose(cli_ctx);
-            free(pkt_hdr);
-            free(pkt_client_hello);
-            continue;
+            NetPollRemove(client->poll_ctx, client->net_ctx);
+            FreeClient(client);
         }
+    }
+}
 
-        printf("Client application: %s %s\n", pkt_client_hello->application, pkt_client_hello->version);
-        printf("Client operating system: %s %s (%s)\n",
-               pkt_client_hello->sysname,
-               pkt_client_hello->release,
-               pkt_client_hello->machine);
-        printf("Client maximum protocol: %d\n", pkt_client_hello->max_protocol);
+void* ClientLoop(void* arguments)
+{
+    ClientContext* client = arguments;
 
-        free(pkt_client_hello);
+    if(!client) return NULL;
 
-        skip_next_hdr = 0;
+    if(FillPacket(client, 1) > 0 && ReceiveClientHello(client) == 0)
+        while(FillPacket(client, 1) > 0 && ProcessPacket(client) == 0)
+            ;
 
-        for(;;)
-        {
-            if(skip_next_hdr)
-            {
-                in_buf = malloc(le32toh(pkt_hdr->len));
+    FreeClient(client);
+    return NULL;
+}
 
-                if(!in_buf)
-                {
-                    printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                    free(pkt_hdr);
-                    NetClose(cli_ctx);
-                    continue;
-                }
+int32_t FillPacket(ClientContext* client, uint8_t wait)
+{
+    AaruPacketHeader* pkt_hdr;
+    uint32_t          needed;
+    uint32_t          available;
+    int32_t           recv_size;
+    char*             new_buf;
 
-                NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                free(in_buf);
-                skip_next_hdr = 0;
-            }
+    for(;;)
+    {
+        // Throw away what has arrived of a packet too large to accept
+        if(client->rx_discard > 0)
+        {
+            available = client->rx_len - client->rx_off;
+            available = available < client->rx_discard ? available : client->rx_discard;
+            client->rx_off += available;
+            client->rx_discard -= available;
+        }
 
-            recv_size = NetRecv(cli_ctx, pkt_hdr, sizeof(AaruPacketHeader), MSG_PEEK);
+        available = client->rx_len - client->rx_off;
+        needed    = sizeof(AaruPacketHeader);
+
+        if(client->rx_discard == 0 && available >= sizeof(AaruPacketHeader))
+        {
+            pkt_hdr = (AaruPacketHeader*)(client->rx_buf + client->rx_off);
 
-            if(recv_size < 0)
+            if(pkt_hdr->remote_id != htole32(AARUREMOTE_REMOTE_ID) ||
+               pkt_hdr->packet_id != htole32(AARUREMOTE_PACKET_ID))
             {
-                printf("Error %d reading response from client, closing connection...\n", errno);
-                NetClose(cli_ctx);
-                free(pkt_hdr);
-                break;
+                printf("Received data is not a correct aaruremote packet, closing connection...\n");
+                return -1;
             }
 
-            if(recv_size == 0)
+            needed = le32toh(pkt_hdr->len);
+
+            if(needed < sizeof(AaruPacketHeader))
             {
-                printf("Client closed connection, closing connection...\n");
-                NetClose(cli_ctx);
-                free(pkt_hdr);
-                break;
+                printf("Received packet is too small, closing connection...\n");
+                return -1;
             }
 
-            if(pkt_hdr->remote_id != htole32(AARUREMOTE_REMOTE_ID) ||
-               pkt_hdr->packet_id != htole32(AARUREMOTE_PACKET_ID))
+            // Memory used per connection does not depend on what the client claims to send
+            if(needed > AARUREMOTE_MAX_PACKET_SIZE)
             {
-                printf("Received data is not a correct aaruremote packet, closing connection...\n");
-                NetClose(cli_ctx);
-                free(pkt_hdr);
-                break;
+                if(!client->hello_received)
+                {
+                    printf("Received packet is too large, closing connection...\n");
+                    return -1;
+                }
+
+                printf("Client %s sent a packet of %u bytes, skipping...\n", client->address, needed);
+
+                client->tag        = client->protocol >= AARUREMOTE_PROTOCOL_TAGS ? pkt_hdr->tag : 0;
+                client->rx_discard = needed;
+                client->packets++;
+
+                client->pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_TOO_LARGE;
+                client->pkt_nop->error_no    = 0;
+                memset(&client->pkt_nop->reason, 0, 256);
+                strncpy(client->pkt_nop->reason, "Received packet is too large, skipping...", 256);
+
+                if(SendResponse(client, client->pkt_nop, sizeof(AaruPacketNop)) < 0) return -1;
+
+                continue;
             }
 
-            if(pkt_hdr->version != AARUREMOTE_PACKET_VERSION)
+            if(available >= needed) return 1;
+        }
+
+        // Move what is left of the consumed packets to the start, growing the buffer if a packet does not fit
+        if(client->rx_off > 0)
+        {
+            memmove(client->rx_buf, client->rx_buf + client->rx_off, available);
+            client->rx_off = 0;
+            client->rx_len = available;
+        }
+
+        if(needed > client->rx_size)
+        {
+            new_buf = realloc(client->rx_buf, needed);
+
+            if(!new_buf)
             {
-                printf("Unrecognized packet version, skipping...\n");
-                skip_next_hdr = 1;
-                continue;
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
             }
 
-            switch(pkt_hdr->packet_type)
+            client->rx_buf  = new_buf;
+            client->rx_size = needed;
+        }
+        // Give back what a large packet needed once it is gone
+        else if(needed <= AARUREMOTE_RX_BUFFER_SIZE && available <= AARUREMOTE_RX_BUFFER_SIZE &&
+                client->rx_size > AARUREMOTE_RX_BUFFER_SIZE)
+        {
+            new_buf = realloc(client->rx_buf, AARUREMOTE_RX_BUFFER_SIZE);
+
+            if(new_buf)
             {
-                case AARUREMOTE_PACKET_TYPE_HELLO:
-                    pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_OOO;
-                    memset(&pkt_nop->reason, 0, 256);
-                    strncpy(pkt_nop->reason, "Received hello packet out of order, skipping...", 256);
-                    NetWrite(cli_ctx, pkt_nop, sizeof(AaruPacketNop));
-                    printf("%s...\n", pkt_nop->reason);
-                    skip_next_hdr = 1;
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_LIST_DEVICES:
-                    device_info_list = ListDevices();
-
-                    // Packet only contains header so, dummy
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                    free(in_buf);
-
-                    if(!device_info_list)
-                    {
-                        pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_ERROR_LIST_DEVICES;
-                        memset(&pkt_nop->reason, 0, 256);
-                        strncpy(pkt_nop->reason, "Could not get device list, continuing...", 256);
-                        NetWrite(cli_ctx, pkt_nop, sizeof(AaruPacketNop));
-                        printf("%s...\n", pkt_nop->reason);
-                        continue;
-                    }
-
-                    pkt_res_devinfo          = malloc(sizeof(AaruPacketResListDevs));
-                    pkt_res_devinfo->devices = htole16(DeviceInfoListCount(device_info_list));
-
-                    n      = sizeof(AaruPacketResListDevs) + le16toh(pkt_res_devinfo->devices) * sizeof(DeviceInfo);
-                    in_buf = malloc(n);
-                    ((AaruPacketResListDevs*)in_buf)->hdr.len = htole32(n);
-                    ((AaruPacketResListDevs*)in_buf)->devices = pkt_res_devinfo->devices;
-                    free(pkt_res_devinfo);
-                    pkt_res_devinfo = (AaruPacketResListDevs*)in_buf;
-
-                    pkt_res_devinfo->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_devinfo->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_devinfo->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_devinfo->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_LIST_DEVICES;
-
-                    // Save list start
-                    in_buf = (char*)device_info_list;
-                    off    = sizeof(AaruPacketResListDevs);
-
-                    while(device_info_list)
-                    {
-                        memcpy(((char*)pkt_res_devinfo) + off, &device_info_list->this, sizeof(DeviceInfo));
-                        device_info_list = device_info_list->next;
-                        off += sizeof(DeviceInfo);
-                    }
-
-                    device_info_list = (struct DeviceInfoList*)in_buf;
-                    FreeDeviceInfoList(device_info_list);
-
-                    NetWrite(cli_ctx, pkt_res_devinfo, le32toh(pkt_res_devinfo->hdr.len));
-                    free(pkt_res_devinfo);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_SDHCI_REGISTERS:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_LIST_DEVICES:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_CHS:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_28:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_48:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_SDHCI:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_DEVTYPE:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_USB_DATA:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_FIREWIRE_DATA:
-                case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_PCMCIA_DATA:
-                    pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_OOO;
-                    memset(&pkt_nop->reason, 0, 256);
-                    strncpy(pkt_nop->reason, "Received response packet?! You should certainly not do that...", 256);
-                    NetWrite(cli_ctx, pkt_nop, sizeof(AaruPacketNop));
-                    printf("%s...\n", pkt_nop->reason);
-                    skip_next_hdr = 1;
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_OPEN_DEVICE:
-                    pkt_dev_open = malloc(le32toh(pkt_hdr->len));
-
-                    if(!pkt_dev_open)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, pkt_dev_open, le32toh(pkt_hdr->len), 0);
-
-                    device_ctx = DeviceOpen(pkt_dev_open->device_path);
-
-                    pkt_nop->reason_code = device_ctx == NULL ? AARUREMOTE_PACKET_NOP_REASON_OPEN_ERROR
-                                                              : AARUREMOTE_PACKET_NOP_REASON_OPEN_OK;
-                    pkt_nop->error_no    = errno;
-                    memset(&pkt_nop->reason, 0, 256);
-                    NetWrite(cli_ctx, pkt_nop, sizeof(AaruPacketNop));
-
-                    free(pkt_dev_open);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_GET_DEVTYPE:
-                    // Packet only contains header so, dummy
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                    free(in_buf);
-
-                    pkt_dev_type = malloc(sizeof(AaruPacketResGetDeviceType));
-
-                    if(!pkt_dev_type)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(pkt_dev_type, 0, sizeof(AaruPacketResGetDeviceType));
-
-                    pkt_dev_type->hdr.len         = htole32(sizeof(AaruPacketResGetDeviceType));
-                    pkt_dev_type->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_DEVTYPE;
-                    pkt_dev_type->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_dev_type->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_dev_type->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_dev_type->device_type     = htole32(GetDeviceType(device_ctx));
-
-                    NetWrite(cli_ctx, pkt_dev_type, sizeof(AaruPacketResGetDeviceType));
-                    free(pkt_dev_type);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_SCSI:
-                    // Packet contains data after
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    pkt_cmd_scsi = (AaruPacketCmdScsi*)in_buf;
-
-                    // TODO: Check size of buffers + size of packet is not bigger than size in header
-
-                    if(le32toh(pkt_cmd_scsi->cdb_len) > 0)
-                    {
-                        cdb_buf = malloc(le32toh(pkt_cmd_scsi->cdb_len));
-                        memcpy(cdb_buf, in_buf + sizeof(AaruPacketCmdScsi), le32toh(pkt_cmd_scsi->cdb_len));
-                    }
-                    else
-                        cdb_buf = NULL;
-
-                    if(le32toh(pkt_cmd_scsi->buf_len) > 0)
-                    {
-                        buffer = malloc(le32toh(pkt_cmd_scsi->buf_len));
-                        memcpy(buffer,
-                               in_buf + le32toh(pkt_cmd_scsi->cdb_len) + sizeof(AaruPacketCmdScsi),
-                               le32toh(pkt_cmd_scsi->buf_len));
-                    }
-                    else
-                        buffer = NULL;
-
-                    // Swap buf_len
-                    pkt_cmd_scsi->buf_len = le32toh(pkt_cmd_scsi->buf_len);
-
-                    ret = SendScsiCommand(device_ctx,
-                                          cdb_buf,
-                                          buffer,
-                                          &sense_buf,
-                                          le32toh(pkt_cmd_scsi->timeout),
-                                          le32toh(pkt_cmd_scsi->direction),
-                                          &duration,
-                                          &sense,
-                                          le32toh(pkt_cmd_scsi->cdb_len),
-                                          &pkt_cmd_scsi->buf_len,
-                                          &sense_len);
-
-                    // Swap buf_len back
-                    pkt_cmd_scsi->buf_len = htole32(pkt_cmd_scsi->buf_len);
-
-                    out_buf = malloc(sizeof(AaruPacketResScsi) + sense_len + le32toh(pkt_cmd_scsi->buf_len));
-
-                    if(!out_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    pkt_res_scsi = (AaruPacketResScsi*)out_buf;
-                    if(sense_buf) memcpy(out_buf + sizeof(AaruPacketResScsi), sense_buf, sense_len);
-                    if(buffer)
-                        memcpy(out_buf + sizeof(AaruPacketResScsi) + sense_len, buffer, le32toh(pkt_cmd_scsi->buf_len));
-
-                    pkt_res_scsi->hdr.len =
-                        htole32(sizeof(AaruPacketResScsi) + sense_len + le32toh(pkt_cmd_scsi->buf_len));
-                    pkt_res_scsi->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI;
-                    pkt_res_scsi->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_scsi->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_scsi->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-
-                    pkt_res_scsi->sense_len = htole32(sense_len);
-                    pkt_res_scsi->buf_len   = pkt_cmd_scsi->buf_len;
-                    pkt_res_scsi->duration  = htole32(duration);
-                    pkt_res_scsi->sense     = htole32(sense);
-                    pkt_res_scsi->error_no  = htole32(ret);
-
-                    NetWrite(cli_ctx, pkt_res_scsi, le32toh(pkt_res_scsi->hdr.len));
-                    free(pkt_cmd_scsi);
-                    free(pkt_res_scsi);
-                    if(cdb_buf) free(cdb_buf);
-                    if(buffer) free(buffer);
-                    if(sense_buf) free(sense_buf);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_GET_SDHCI_REGISTERS:
-                    // Packet only contains header so, dummy
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                    free(in_buf);
-
-                    pkt_res_sdhci_registers = malloc(sizeof(AaruPacketResGetSdhciRegisters));
-                    if(!pkt_res_sdhci_registers)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(pkt_res_sdhci_registers, 0, sizeof(AaruPacketResGetSdhciRegisters));
-                    pkt_res_sdhci_registers->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_sdhci_registers->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_sdhci_registers->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_sdhci_registers->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_SDHCI_REGISTERS;
-                    pkt_res_sdhci_registers->hdr.len         = htole32(sizeof(AaruPacketResGetSdhciRegisters));
-                    pkt_res_sdhci_registers->is_sdhci        = GetSdhciRegisters(device_ctx,
-                                                                                 &csd,
-                                                                                 &cid,
-                                                                                 &ocr,
-                                                                                 &scr,
-                                                                                 &pkt_res_sdhci_registers->csd_len,
-                                                                                 &pkt_res_sdhci_registers->cid_len,
-                                                                                 &pkt_res_sdhci_registers->ocr_len,
-                                                                                 &pkt_res_sdhci_registers->scr_len);
-
-                    if(pkt_res_sdhci_registers->csd_len > 0 && csd != NULL)
-                    {
-                        if(pkt_res_sdhci_registers->csd_len > 16) pkt_res_sdhci_registers->csd_len = 16;
-
-                        memcpy(pkt_res_sdhci_registers->csd, csd, pkt_res_sdhci_registers->csd_len);
-                    }
-                    if(pkt_res_sdhci_registers->cid_len > 0 && cid != NULL)
-                    {
-                        if(pkt_res_sdhci_registers->cid_len > 16) pkt_res_sdhci_registers->cid_len = 16;
-
-                        memcpy(pkt_res_sdhci_registers->cid, cid, pkt_res_sdhci_registers->cid_len);
-                    }
-                    if(pkt_res_sdhci_registers->ocr_len > 0 && ocr != NULL)
-                    {
-                        if(pkt_res_sdhci_registers->ocr_len > 4) pkt_res_sdhci_registers->ocr_len = 4;
-
-                        memcpy(pkt_res_sdhci_registers->ocr, ocr, pkt_res_sdhci_registers->ocr_len);
-                    }
-                    if(pkt_res_sdhci_registers->scr_len > 0 && scr != NULL)
-                    {
-                        if(pkt_res_sdhci_registers->scr_len > 8) pkt_res_sdhci_registers->scr_len = 8;
-
-                        memcpy(pkt_res_sdhci_registers->scr, scr, pkt_res_sdhci_registers->scr_len);
-                    }
-
-                    // Swap lengths
-                    pkt_res_sdhci_registers->csd_len = htole32(pkt_res_sdhci_registers->csd_len);
-                    pkt_res_sdhci_registers->cid_len = htole32(pkt_res_sdhci_registers->cid_len);
-                    pkt_res_sdhci_registers->ocr_len = htole32(pkt_res_sdhci_registers->ocr_len);
-                    pkt_res_sdhci_registers->scr_len = htole32(pkt_res_sdhci_registers->scr_len);
-
-                    free(csd);
-                    free(cid);
-                    free(scr);
-                    free(ocr);
-
-                    NetWrite(cli_ctx, pkt_res_sdhci_registers, le32toh(pkt_res_sdhci_registers->hdr.len));
-                    free(pkt_res_sdhci_registers);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_GET_USB_DATA:
-                    // Packet only contains header so, dummy
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                    free(in_buf);
-
-                    pkt_res_usb = malloc(sizeof(AaruPacketResGetUsbData));
-                    if(!pkt_res_usb)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(pkt_res_usb, 0, sizeof(AaruPacketResGetUsbData));
-                    pkt_res_usb->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_usb->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_usb->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_usb->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_USB_DATA;
-                    pkt_res_usb->hdr.len         = htole32(sizeof(AaruPacketResGetUsbData));
-                    pkt_res_usb->is_usb          = GetUsbData(device_ctx,
-                                                              &pkt_res_usb->desc_len,
-                                                              pkt_res_usb->descriptors,
-                                                              &pkt_res_usb->id_vendor,
-                                                              &pkt_res_usb->id_product,
-                                                              pkt_res_usb->manufacturer,
-                                                              pkt_res_usb->product,
-                                                              pkt_res_usb->serial);
-
-                    // Swap parameters
-                    pkt_res_usb->desc_len = htole32(pkt_res_usb->desc_len);
-                    // TODO: Need to swap vendor, product?
-
-                    NetWrite(cli_ctx, pkt_res_usb, le32toh(pkt_res_usb->hdr.len));
-                    free(pkt_res_usb);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_GET_FIREWIRE_DATA:
-                    // Packet only contains header so, dummy
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                    free(in_buf);
-
-                    pkt_res_firewire = malloc(sizeof(AaruPacketResGetFireWireData));
-                    if(!pkt_res_firewire)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(pkt_res_firewire, 0, sizeof(AaruPacketResGetFireWireData));
-                    pkt_res_firewire->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_firewire->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_firewire->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_firewire->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_FIREWIRE_DATA;
-                    pkt_res_firewire->hdr.len         = htole32(sizeof(AaruPacketResGetFireWireData));
-                    pkt_res_firewire->is_firewire     = GetFireWireData(device_ctx,
-                                                                        &pkt_res_firewire->id_model,
-                                                                        &pkt_res_firewire->id_vendor,
-                                                                        &pkt_res_firewire->guid,
-                                                                        pkt_res_firewire->vendor,
-                                                                        pkt_res_firewire->model);
-
-                    // TODO: Need to swap IDs?
-
-                    NetWrite(cli_ctx, pkt_res_firewire, le32toh(pkt_res_firewire->hdr.len));
-                    free(pkt_res_firewire);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_GET_PCMCIA_DATA:
-                    // Packet only contains header so, dummy
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                    free(in_buf);
-
-                    pkt_res_pcmcia = malloc(sizeof(AaruPacketResGetPcmciaData));
-                    if(!pkt_res_pcmcia)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(pkt_res_pcmcia, 0, sizeof(AaruPacketResGetPcmciaData));
-                    pkt_res_pcmcia->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_pcmcia->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_pcmcia->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_pcmcia->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_PCMCIA_DATA;
-                    pkt_res_pcmcia->hdr.len         = htole32(sizeof(AaruPacketResGetPcmciaData));
-                    pkt_res_pcmcia->is_pcmcia =
-                        GetPcmciaData(device_ctx, &pkt_res_pcmcia->cis_len, pkt_res_pcmcia->cis);
-
-                    pkt_res_pcmcia->cis_len = htole32(pkt_res_pcmcia->cis_len);
-
-                    NetWrite(cli_ctx, pkt_res_pcmcia, le32toh(pkt_res_pcmcia->hdr.len));
-                    free(pkt_res_pcmcia);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_ATA_CHS:
-                    // Packet contains data after
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    pkt_cmd_ata_chs = (AaruPacketCmdAtaChs*)in_buf;
-
-                    // TODO: Check size of buffers + size of packet is not bigger than size in header
-
-                    if(le32toh(pkt_cmd_ata_chs->buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdAtaChs);
-                    else
-                        buffer = NULL;
-
-                    memset(&ata_chs_error_regs, 0, sizeof(AtaErrorRegistersChs));
-
-                    pkt_cmd_ata_chs->buf_len = le32toh(pkt_cmd_ata_chs->buf_len);
-
-                    duration = 0;
-                    sense    = 1;
-                    ret      = SendAtaChsCommand(device_ctx,
-                                                 pkt_cmd_ata_chs->registers,
-                                                 &ata_chs_error_regs,
-                                                 pkt_cmd_ata_chs->protocol,
-                                                 pkt_cmd_ata_chs->transfer_register,
-                                                 buffer,
-                                                 le32toh(pkt_cmd_ata_chs->timeout),
-                                                 pkt_cmd_ata_chs->transfer_blocks,
-                                                 &duration,
-                                                 &sense,
-                                                 &pkt_cmd_ata_chs->buf_len);
-
-                    out_buf = malloc(sizeof(AaruPacketResAtaChs) + pkt_cmd_ata_chs->buf_len);
-
-                    pkt_cmd_ata_chs->buf_len = htole32(pkt_cmd_ata_chs->buf_len);
-
-                    if(!out_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    pkt_res_ata_chs = (AaruPacketResAtaChs*)out_buf;
-                    if(buffer) memcpy(out_buf + sizeof(AaruPacketResAtaChs), buffer, htole32(pkt_cmd_ata_chs->buf_len));
-
-                    pkt_res_ata_chs->hdr.len = htole32(sizeof(AaruPacketResAtaChs) + htole32(pkt_cmd_ata_chs->buf_len));
-                    pkt_res_ata_chs->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_CHS;
-                    pkt_res_ata_chs->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_ata_chs->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_ata_chs->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-
-                    pkt_res_ata_chs->registers = ata_chs_error_regs;
-                    pkt_res_ata_chs->buf_len   = pkt_cmd_ata_chs->buf_len;
-                    pkt_res_ata_chs->duration  = htole32(duration);
-                    pkt_res_ata_chs->sense     = htole32(sense);
-                    pkt_res_ata_chs->error_no  = htole32(ret);
-
-                    NetWrite(cli_ctx, pkt_res_ata_chs, le32toh(pkt_res_ata_chs->hdr.len));
-                    free(pkt_cmd_ata_chs);
-                    free(pkt_res_ata_chs);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_ATA_LBA_28:
-                    // Packet contains data after
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    pkt_cmd_ata_lba28 = (AaruPacketCmdAtaLba28*)in_buf;
-
-                    // TODO: Check size of buffers + size of packet is not bigger than size in header
-
-                    if(le32toh(pkt_cmd_ata_lba28->buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdAtaLba28);
-                    else
-                        buffer = NULL;
-
-                    memset(&ata_lba28_error_regs, 0, sizeof(AtaErrorRegistersLba28));
-
-                    pkt_cmd_ata_lba28->buf_len = le32toh(pkt_cmd_ata_lba28->buf_len);
-
-                    duration = 0;
-                    sense    = 1;
-                    ret      = SendAtaLba28Command(device_ctx,
-                                                   pkt_cmd_ata_lba28->registers,
-                                                   &ata_lba28_error_regs,
-                                                   pkt_cmd_ata_lba28->protocol,
-                                                   pkt_cmd_ata_lba28->transfer_register,
-                                                   buffer,
-                                                   le32toh(pkt_cmd_ata_lba28->timeout),
-                                                   pkt_cmd_ata_lba28->transfer_blocks,
-                                                   &duration,
-                                                   &sense,
-                                                   &pkt_cmd_ata_lba28->buf_len);
-
-                    out_buf                    = malloc(sizeof(AaruPacketResAtaLba28) + pkt_cmd_ata_lba28->buf_len);
-                    pkt_cmd_ata_lba28->buf_len = htole32(pkt_cmd_ata_lba28->buf_len);
-
-                    if(!out_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    pkt_res_ata_lba28 = (AaruPacketResAtaLba28*)out_buf;
-                    if(buffer)
-                        memcpy(out_buf + sizeof(AaruPacketResAtaLba28), buffer, le32toh(pkt_cmd_ata_lba28->buf_len));
-
-                    pkt_res_ata_lba28->hdr.len =
-                        htole32(sizeof(AaruPacketResAtaLba28) + le32toh(pkt_cmd_ata_lba28->buf_len));
-                    pkt_res_ata_lba28->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_28;
-                    pkt_res_ata_lba28->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_ata_lba28->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_ata_lba28->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-
-                    pkt_res_ata_lba28->registers = ata_lba28_error_regs;
-                    pkt_res_ata_lba28->buf_len   = pkt_cmd_ata_lba28->buf_len;
-                    pkt_res_ata_lba28->duration  = le32toh(duration);
-                    pkt_res_ata_lba28->sense     = le32toh(sense);
-                    pkt_res_ata_lba28->error_no  = le32toh(ret);
-
-                    NetWrite(cli_ctx, pkt_res_ata_lba28, le32toh(pkt_res_ata_lba28->hdr.len));
-                    free(pkt_cmd_ata_lba28);
-                    free(pkt_res_ata_lba28);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_ATA_LBA_48:
-                    // Packet contains data after
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    pkt_cmd_ata_lba48 = (AaruPacketCmdAtaLba48*)in_buf;
-
-                    // TODO: Check size of buffers + size of packet is not bigger than size in header
-
-                    if(le32toh(pkt_cmd_ata_lba48->buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdAtaLba48);
-                    else
-                        buffer = NULL;
-
-                    memset(&ata_lba48_error_regs, 0, sizeof(AtaErrorRegistersLba48));
-                    pkt_cmd_ata_lba48->buf_len = le32toh(pkt_cmd_ata_lba48->buf_len);
-
-                    // Swapping
-                    pkt_cmd_ata_lba48->registers.sector_count = le16toh(pkt_cmd_ata_lba48->registers.sector_count);
-
-                    duration = 0;
-                    sense    = 1;
-                    ret      = SendAtaLba48Command(device_ctx,
-                                                   pkt_cmd_ata_lba48->registers,
-                                                   &ata_lba48_error_regs,
-                                                   pkt_cmd_ata_lba48->protocol,
-                                                   pkt_cmd_ata_lba48->transfer_register,
-                                                   buffer,
-                                                   le32toh(pkt_cmd_ata_lba48->timeout),
-                                                   pkt_cmd_ata_lba48->transfer_blocks,
-                                                   &duration,
-                                                   &sense,
-                                                   &pkt_cmd_ata_lba48->buf_len);
-
-                    out_buf                    = malloc(sizeof(AaruPacketResAtaLba48) + pkt_cmd_ata_lba48->buf_len);
-                    pkt_cmd_ata_lba48->buf_len = htole32(pkt_cmd_ata_lba48->buf_len);
-
-                    if(!out_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    pkt_res_ata_lba48 = (AaruPacketResAtaLba48*)out_buf;
-                    if(buffer)
-                        memcpy(out_buf + sizeof(AaruPacketResAtaLba48), buffer, le32toh(pkt_cmd_ata_lba48->buf_len));
-
-                    pkt_res_ata_lba48->hdr.len =
-                        htole32(sizeof(AaruPacketResAtaLba48) + le32toh(pkt_cmd_ata_lba48->buf_len));
-                    pkt_res_ata_lba48->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_48;
-                    pkt_res_ata_lba48->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_ata_lba48->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_ata_lba48->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-
-                    // Swapping
-                    ata_lba48_error_regs.sector_count = htole16(ata_lba48_error_regs.sector_count);
-
-                    pkt_res_ata_lba48->registers = ata_lba48_error_regs;
-                    pkt_res_ata_lba48->buf_len   = pkt_cmd_ata_lba48->buf_len;
-                    pkt_res_ata_lba48->duration  = le32toh(duration);
-                    pkt_res_ata_lba48->sense     = le32toh(sense);
-                    pkt_res_ata_lba48->error_no  = le32toh(ret);
-
-                    NetWrite(cli_ctx, pkt_res_ata_lba48, le32toh(pkt_res_ata_lba48->hdr.len));
-                    free(pkt_cmd_ata_lba48);
-                    free(pkt_res_ata_lba48);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_SDHCI:
-                    // Packet contains data after
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    pkt_cmd_sdhci = (AaruPacketCmdSdhci*)in_buf;
-
-                    // TODO: Check size of buffers + size of packet is not bigger than size in header
-
-                    if(le32toh(pkt_cmd_sdhci->command.buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdSdhci);
-                    else
-                        buffer = NULL;
-
-                    memset((char*)&sdhci_response, 0, sizeof(uint32_t) * 4);
-
-                    duration = 0;
-                    sense    = 1;
-                    ret      = SendSdhciCommand(device_ctx,
-                                                pkt_cmd_sdhci->command.command,
-                                                pkt_cmd_sdhci->command.write,
-                                                pkt_cmd_sdhci->command.application,
-                                                le32toh(pkt_cmd_sdhci->command.flags),
-                                                le32toh(pkt_cmd_sdhci->command.argument),
-                                                le32toh(pkt_cmd_sdhci->command.block_size),
-                                                le32toh(pkt_cmd_sdhci->command.blocks),
-                                                buffer,
-                                                le32toh(pkt_cmd_sdhci->command.buf_len),
-                                                le32toh(pkt_cmd_sdhci->command.timeout),
-                                                (uint32_t*)&sdhci_response,
-                                                &duration,
-                                                &sense);
-
-                    out_buf = malloc(sizeof(AaruPacketResSdhci) + le32toh(pkt_cmd_sdhci->command.buf_len));
-
-                    if(!out_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    pkt_res_sdhci = (AaruPacketResSdhci*)out_buf;
-                    if(buffer)
-                        memcpy(out_buf + sizeof(AaruPacketResSdhci), buffer, le32toh(pkt_cmd_sdhci->command.buf_len));
-
-                    pkt_res_sdhci->hdr.len =
-                        htole32(sizeof(AaruPacketResSdhci) + le32toh(pkt_cmd_sdhci->command.buf_len));
-                    pkt_res_sdhci->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SDHCI;
-                    pkt_res_sdhci->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_sdhci->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_sdhci->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-
-                    sdhci_response[0] = htole32(sdhci_response[0]);
-                    sdhci_response[1] = htole32(sdhci_response[1]);
-                    sdhci_response[2] = htole32(sdhci_response[2]);
-                    sdhci_response[3] = htole32(sdhci_response[3]);
-
-                    memcpy((char*)&pkt_res_sdhci->res.response, (char*)&sdhci_response, sizeof(uint32_t) * 4);
-                    pkt_res_sdhci->res.buf_len  = pkt_cmd_sdhci->command.buf_len;
-                    pkt_res_sdhci->res.duration = htole32(duration);
-                    pkt_res_sdhci->res.sense    = htole32(sense);
-                    pkt_res_sdhci->res.error_no = htole32(ret);
-
-                    NetWrite(cli_ctx, pkt_res_sdhci, le32toh(pkt_res_sdhci->hdr.len));
-                    free(pkt_cmd_sdhci);
-                    free(pkt_res_sdhci);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_CLOSE_DEVICE:
-                    DeviceClose(device_ctx);
-                    device_ctx    = NULL;
-                    skip_next_hdr = 1;
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_AM_I_ROOT:
-                    // Packet only contains header so, dummy
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-                    free(in_buf);
-
-                    pkt_res_am_i_root = malloc(sizeof(AaruPacketResAmIRoot));
-                    if(!pkt_res_am_i_root)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(pkt_res_am_i_root, 0, sizeof(AaruPacketResAmIRoot));
-                    pkt_res_am_i_root->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_am_i_root->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_am_i_root->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_am_i_root->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_AM_I_ROOT;
-                    pkt_res_am_i_root->hdr.len         = htole32(sizeof(AaruPacketResAmIRoot));
-                    pkt_res_am_i_root->am_i_root       = AmIRoot();
-
-                    NetWrite(cli_ctx, pkt_res_am_i_root, le32toh(pkt_res_am_i_root->hdr.len));
-                    free(pkt_res_am_i_root);
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_SDHCI:
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    pkt_cmd_multi_sdhci = (AaruPacketMultiCmdSdhci*)in_buf;
-
-                    pkt_cmd_multi_sdhci->cmd_count = le64toh(pkt_cmd_multi_sdhci->cmd_count);
-
-                    // TODO: Check size of buffers + size of packet is not bigger than size in header
-                    multi_sdhci_commands = malloc(sizeof(MmcSingleCommand) * pkt_cmd_multi_sdhci->cmd_count);
-
-                    if(!multi_sdhci_commands)
-                    {
-                        printf("Fatal error %d allocating memory for commands, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(multi_sdhci_commands, 0, sizeof(MmcSingleCommand) * pkt_cmd_multi_sdhci->cmd_count);
-
-                    for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
-                    {
-                        multi_sdhci_commands[n].argument    = le32toh(pkt_cmd_multi_sdhci->commands[n].argument);
-                        multi_sdhci_commands[n].block_size  = le32toh(pkt_cmd_multi_sdhci->commands[n].block_size);
-                        multi_sdhci_commands[n].blocks      = le32toh(pkt_cmd_multi_sdhci->commands[n].blocks);
-                        multi_sdhci_commands[n].command     = pkt_cmd_multi_sdhci->commands[n].command;
-                        multi_sdhci_commands[n].flags       = le32toh(pkt_cmd_multi_sdhci->commands[n].flags);
-                        multi_sdhci_commands[n].application = pkt_cmd_multi_sdhci->commands[n].application;
-                        multi_sdhci_commands[n].write       = pkt_cmd_multi_sdhci->commands[n].write;
-                        multi_sdhci_commands[n].buf_len     = le32toh(pkt_cmd_multi_sdhci->commands[n].buf_len);
-                    }
-
-                    off = (long)(sizeof(AaruPacketMultiCmdSdhci) +
-                                 (sizeof(AaruCmdSdhci) * pkt_cmd_multi_sdhci->cmd_count));
-
-                    for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
-                    {
-                        multi_sdhci_commands[n].buffer = (char*)pkt_cmd_multi_sdhci + off;
-                        off += multi_sdhci_commands[n].buf_len;
-                    }
-
-                    ret = SendMultiSdhciCommand(
-                        device_ctx, pkt_cmd_multi_sdhci->cmd_count, multi_sdhci_commands, &duration, &sense);
-
-                    off =
-                        (long)(sizeof(AaruPacketMultiResSdhci) + sizeof(AaruResSdhci) * pkt_cmd_multi_sdhci->cmd_count);
-
-                    for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++) off += multi_sdhci_commands[n].buf_len;
-
-                    out_buf = malloc(off);
-
-                    if(!out_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
-                        free(multi_sdhci_commands);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    pkt_res_multi_sdhci = (AaruPacketMultiResSdhci*)out_buf;
-
-                    pkt_res_multi_sdhci->hdr.len         = htole32(off);
-                    pkt_res_multi_sdhci->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_MULTI_SDHCI;
-                    pkt_res_multi_sdhci->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_multi_sdhci->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_multi_sdhci->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_multi_sdhci->cmd_count       = htole64(pkt_cmd_multi_sdhci->cmd_count);
-
-                    for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
-                    {
-                        pkt_res_multi_sdhci->responses[n].duration    = htole32(duration);
-                        pkt_res_multi_sdhci->responses[n].error_no    = htole32(ret);
-                        pkt_res_multi_sdhci->responses[n].sense       = htole32(sense);
-                        pkt_res_multi_sdhci->responses[n].buf_len     = htole32(multi_sdhci_commands[n].buf_len);
-                        pkt_res_multi_sdhci->responses[n].response[0] = htole32(multi_sdhci_commands[n].response[0]);
-                        pkt_res_multi_sdhci->responses[n].response[1] = htole32(multi_sdhci_commands[n].response[1]);
-                        pkt_res_multi_sdhci->responses[n].response[2] = htole32(multi_sdhci_commands[n].response[2]);
-                        pkt_res_multi_sdhci->responses[n].response[3] = htole32(multi_sdhci_commands[n].response[3]);
-                    }
-
-                    off =
-                        (long)(sizeof(AaruPacketMultiResSdhci) + sizeof(AaruResSdhci) * pkt_cmd_multi_sdhci->cmd_count);
-
-                    for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
-                    {
-                        memcpy(out_buf + off, multi_sdhci_commands[n].buffer, multi_sdhci_commands->buf_len);
-                        off += multi_sdhci_commands->buf_len;
-                    }
-
-                    NetWrite(cli_ctx, pkt_res_multi_sdhci, le32toh(pkt_res_multi_sdhci->hdr.len));
-                    free(multi_sdhci_commands);
-                    free(pkt_cmd_multi_sdhci);
-                    free(pkt_res_multi_sdhci);
-
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_REOPEN:
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    ret = ReOpen(device_ctx, &sense);
-                    memset(&pkt_nop->reason, 0, 256);
-
-                    if(ret)
-                    {
-                        pkt_nop->error_no = htole32(ret);
-
-                        // Error on close
-                        if(sense != 0) pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_CLOSE_ERROR;
-                        else
-                            pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_OPEN_ERROR;
-                    }
-                    else
-                    {
-                        pkt_nop->error_no    = 0;
-                        pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_REOPEN_OK;
-                    }
-
-                    NetWrite(cli_ctx, pkt_nop, sizeof(AaruPacketNop));
-
-                    free(in_buf);
-
-                    continue;
-                case AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD:
-                    in_buf = malloc(le32toh(pkt_hdr->len));
-
-                    if(!in_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    NetRecv(cli_ctx, in_buf, le32toh(pkt_hdr->len), 0);
-
-                    pkt_cmd_osread = (AaruPacketCmdOsRead*)in_buf;
-
-                    buffer = malloc(le32toh(pkt_cmd_osread->length));
-
-                    if(!buffer)
-                    {
-                        printf("Fatal error %d allocating memory for buffer, closing connection...\n", errno);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    memset(buffer, 0, le32toh(pkt_cmd_osread->length));
-
-                    ret = OsRead(device_ctx,
-                                 buffer,
-                                 le64toh(pkt_cmd_osread->offset),
-                                 le32toh(pkt_cmd_osread->length),
-                                 &duration);
-
-                    out_buf = malloc(sizeof(AaruPacketResOsRead) + le32toh(pkt_cmd_osread->length));
-
-                    if(!out_buf)
-                    {
-                        printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
-                        free(buffer);
-                        free(pkt_hdr);
-                        free(in_buf);
-                        NetClose(cli_ctx);
-                        continue;
-                    }
-
-                    pkt_res_osread = (AaruPacketResOsRead*)out_buf;
-
-                    pkt_res_osread->hdr.len = htole32(sizeof(AaruPacketResOsRead) + le32toh(pkt_cmd_osread->length));
-                    pkt_res_osread->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD;
-                    pkt_res_osread->hdr.version     = AARUREMOTE_PACKET_VERSION;
-                    pkt_res_osread->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
-                    pkt_res_osread->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
-                    pkt_res_osread->error_no        = htole32(ret);
-                    pkt_res_osread->duration        = htole32(duration);
-
-                    memcpy(out_buf + sizeof(AaruPacketResOsRead), buffer, le32toh(pkt_cmd_osread->length));
-
-                    NetWrite(cli_ctx, pkt_res_osread, le32toh(pkt_res_osread->hdr.len));
-                    free(buffer);
-                    free(pkt_cmd_osread);
-                    free(pkt_res_osread);
-
-                    continue;
-                default:
-                    pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_NOT_RECOGNIZED;
-                    memset(&pkt_nop->reason, 0, 256);
-#ifdef _WIN32
-                    sprintf_s(pkt_nop->reason,
-                              256,
-                              "Received unrecognized packet with type %d, skipping...",
-                              pkt_hdr->packet_type);
-#else
-                    snprintf(pkt_nop->reason,
-                             256,
-                             "Received unrecognized packet with type %d, skipping...",
-                             pkt_hdr->packet_type);
-#endif
-                    NetWrite(cli_ctx, pkt_nop, sizeof(AaruPacketNop));
-                    printf("%s...\n", pkt_nop->reason);
-                    skip_next_hdr = 1;
-                    continue;
+                client->rx_buf  = new_buf;
+                client->rx_size = AARUREMOTE_RX_BUFFER_SIZE;
             }
         }
+
+        // Read as much as the socket has, so small packets arrive together in a single call
+        recv_size =
+            NetRecvAvailable(client->net_ctx, client->rx_buf + client->rx_len, client->rx_size - client->rx_len, wait);
+        client->recv_calls++;
+
+        if(recv_size == 0)
+        {
+            printf("Client %s closed connection, closing connection...\n", client->address);
+            return -1;
+        }
+
+        if(recv_size < 0)
+        {
+            if(!wait && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+
+            printf("Error %d reading response from client %s, closing connection...\n", errno, client->address);
+            return -1;
+        }
+
+        client->rx_len += recv_size;
     }
+}
+
+int32_t ReceiveClientHello(ClientContext* client)
+{
+    AaruPacketHello* pkt_client_hello;
+
+    pkt_client_hello = (AaruPacketHello*)(client->rx_buf + client->rx_off);
+    client->rx_off += le32toh(pkt_client_hello->hdr.len);
+    client->packets++;
 
-    free(pkt_nop);
+    if(pkt_client_hello->hdr.version != AARUREMOTE_PACKET_VERSION)
+    {
+        printf("Unrecognized packet version, closing connection...\n");
+        return -1;
+    }
+
+    if(pkt_client_hello->hdr.packet_type != AARUREMOTE_PACKET_TYPE_HELLO)
+    {
+        printf("Expecting hello packet type, received type %d, closing connection...\n",
+               pkt_client_hello->hdr.packet_type);
+        return -1;
+    }
+
+    if(le32toh(pkt_client_hello->hdr.len) < sizeof(AaruPacketHello))
+    {
+        printf("Expected %d bytes of packet, got %d, closing connection...\n",
+               (int)sizeof(AaruPacketHello),
+               le32toh(pkt_client_hello->hdr.len));
+        return -1;
+    }
+
+    printf("Client %s application: %s %s\n",
+           client->address,
+           pkt_client_hello->application,
+           pkt_client_hello->version);
+    printf("Client %s operating system: %s %s (%s)\n",
+           client->address,
+           pkt_client_hello->sysname,
+           pkt_client_hello->release,
+           pkt_client_hello->machine);
+    printf("Client %s maximum protocol: %d\n", client->address, pkt_client_hello->max_protocol);
+
+    client->protocol = pkt_client_hello->max_protocol < client->pkt_server_hello->max_protocol
+                           ? pkt_client_hello->max_protocol
+                           : client->pkt_server_hello->max_protocol;
+
+    if(client->protocol >= AARUREMOTE_PROTOCOL_FLAGS &&
+       (pkt_client_hello->flags & client->pkt_server_hello->flags & AARUREMOTE_HELLO_FLAG_COMPRESSION))
+    {
+        client->lz_table = malloc(sizeof(uint32_t) << AARUREMOTE_LZ_HASH_BITS);
+        client->compress = client->lz_table != NULL;
+    }
+
+    if(client->protocol >= AARUREMOTE_PROTOCOL_FLAGS &&
+       (pkt_client_hello->flags & client->pkt_server_hello->flags & AARUREMOTE_HELLO_FLAG_SPARSE))
+    {
+        client->pkt_res_sparse = malloc(sizeof(AaruPacketResSparse));
+        client->sparse         = client->pkt_res_sparse != NULL;
+    }
+
+    // Cached reads report no duration, so only clients that ask for the cache get it
+    client->scsi_cache_enabled =
+        client->protocol >= AARUREMOTE_PROTOCOL_FLAGS && scsi_cache_size > 0 &&
+        (pkt_client_hello->flags & client->pkt_server_hello->flags & AARUREMOTE_HELLO_FLAG_SCSI_CACHE);
+
+    printf("Client %s uses protocol %d, compression %s, zero block elision %s, SCSI cache %s\n",
+           client->address,
+           client->protocol,
+           client->compress ? "on" : "off",
+           client->sparse ? "on" : "off",
+           client->scsi_cache_enabled ? "on" : "off");
+
+    client->hello_received = 1;
+
+    // Newer clients learn what this server can do before sending their first command
+    if(client->protocol >= AARUREMOTE_PROTOCOL_CAPABILITIES) return SendCapabilities(client);
+
+    return 0;
+}
+
+int32_t ParkSession(ClientContext* client)
+{
+    OrphanSession* session;
+
+    if(resume_grace == 0 || client->token == 0) return -1;
+
+    session = malloc(sizeof(OrphanSession));
+
+    if(!session) return -1;
+
+    session->token      = client->token;
+    session->device_ctx = client->device_ctx;
+    session->remaining  = resume_grace;
+
+    MutexLock(session_mutex);
+    session->next   = orphan_sessions;
+    orphan_sessions = session;
+    MutexUnlock(session_mutex);
+
+    printf("Client %s session kept open for %u seconds.\n", client->address, resume_grace);
+
+    return 0;
+}
+
+void* ResumeSession(uint64_t token)
+{
+    OrphanSession** link;
+    OrphanSession*  session;
+    void*           device_ctx = NULL;
+
+    if(resume_grace == 0 || token == 0) return NULL;
+
+    MutexLock(session_mutex);
+
+    for(link = &orphan_sessions; *link; link = &(*link)->next)
+    {
+        if((*link)->token != token) continue;
+
+        session    = *link;
+        *link      = session->next;
+        device_ctx = session->device_ctx;
+        free(session);
+        break;
+    }
+
+    MutexUnlock(session_mutex);
+
+    return device_ctx;
+}
+
+void* ReaperLoop(void* arguments)
+{
+    OrphanSession** link;
+    OrphanSession*  session;
+    OrphanSession*  expired;
+
+    (void)arguments;
+
+    for(;;)
+    {
+        SleepSeconds(1);
+
+        expired = NULL;
+
+        MutexLock(session_mutex);
+
+        for(link = &orphan_sessions; *link;)
+        {
+            session = *link;
+
+            if(--session->remaining > 0)
+            {
+                link = &session->next;
+                continue;
+            }
+
+            *link         = session->next;
+            session->next = expired;
+            expired       = session;
+        }
+
+        MutexUnlock(session_mutex);
+
+        // Closing a device can take a while, do not hold back resuming clients meanwhile
+        while(expired)
+        {
+            session = expired;
+            expired = session->next;
+
+            DeviceClose(session->device_ctx);
+            free(session);
+        }
+    }
+}
+
+static void* AddCapability(AaruPacketCapabilities* pkt_caps, uint32_t* off, uint16_t type, uint16_t len)
+{
+    AaruCapability* cap = (AaruCapability*)((char*)pkt_caps + *off);
+
+    cap->type = htole16(type);
+    cap->len  = htole16(len);
+    *off += sizeof(AaruCapability) + len;
+    pkt_caps->count++;
+
+    return cap + 1;
+}
+
+int32_t SendCapabilities(ClientContext* client)
+{
+    static const int32_t device_types[] = {AARUREMOTE_DEVICE_TYPE_ATA,
+                                           AARUREMOTE_DEVICE_TYPE_ATAPI,
+                                           AARUREMOTE_DEVICE_TYPE_SCSI,
+                                           AARUREMOTE_DEVICE_TYPE_SECURE_DIGITAL,
+                                           AARUREMOTE_DEVICE_TYPE_MMC,
+                                           AARUREMOTE_DEVICE_TYPE_NVME};
+    static const int8_t  batch_packets[] = {AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_SDHCI,
+                                            AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_SCSI};
+    AaruPacketCapabilities*    pkt_caps;
+    AaruCapabilityMaxTransfer* max_transfer;
+    AaruCapabilityZeroCopy*    zero_copy;
+    AaruCapabilityResume*      resume;
+    AaruCapabilityMaxPacket*   max_packet;
+    uint8_t                    codec = AARUREMOTE_COMPRESSION_LZ4;
+    uint32_t                   value;
+    uint32_t                   len;
+    uint32_t                   off;
+    uint32_t                   n;
+    int32_t                    ret;
+
+    // Each entry is a type, a length and a value, clients skip the types they do not know
+    len = sizeof(AaruPacketCapabilities) + 6 * sizeof(AaruCapability) + sizeof(AaruCapabilityMaxTransfer) *
+          (sizeof(device_types) / sizeof(int32_t)) + sizeof(uint32_t) + sizeof(batch_packets) + sizeof(uint8_t) +
+          sizeof(uint32_t) + sizeof(AaruCapabilityZeroCopy) + sizeof(AaruCapability) + sizeof(AaruCapabilityResume) +
+          sizeof(AaruCapability) + sizeof(AaruCapabilityMaxPacket) + sizeof(AaruCapability) + sizeof(uint32_t);
+
+    pkt_caps = malloc(len);
+
+    if(!pkt_caps)
+    {
+        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+        return -1;
+    }
+
+    memset(pkt_caps, 0, len);
+    off = sizeof(AaruPacketCapabilities);
+
+    // Zero means only the packet size limits it
+    max_transfer = AddCapability(pkt_caps,
+                                 &off,
+                                 AARUREMOTE_CAPABILITY_MAX_TRANSFER,
+                                 sizeof(AaruCapabilityMaxTransfer) * (sizeof(device_types) / sizeof(int32_t)));
+
+    for(n = 0; n < sizeof(device_types) / sizeof(int32_t); n++)
+    {
+        max_transfer[n].device_type  = htole32(device_types[n]);
+        max_transfer[n].max_transfer = htole32(GetMaxTransfer(device_types[n]));
+    }
+
+    value = htole32(AARUREMOTE_PIPELINE_DEPTH);
+    memcpy(
+        AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_PIPELINE_DEPTH, sizeof(uint32_t)), &value, sizeof(value));
+
+    memcpy(AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_BATCH_PACKETS, sizeof(batch_packets)),
+           batch_packets,
+           sizeof(batch_packets));
+
+    memcpy(AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_COMPRESSION, sizeof(uint8_t)), &codec, sizeof(codec));
+
+    value = htole32(GetProcessorCount());
+    memcpy(AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_PROCESSORS, sizeof(uint32_t)), &value, sizeof(value));
+
+    // Compressed and sparse responses never take the zero copy paths, local sockets have shared memory instead
+    value     = client->compress || client->sparse || client->local ? 0 : OsReadToNetMaximum();
+    zero_copy = AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_ZERO_COPY, sizeof(AaruCapabilityZeroCopy));
+
+    zero_copy->paths      = htole32(value > 0 ? AARUREMOTE_ZERO_COPY_OSREAD : 0);
+    zero_copy->max_length = htole32(value);
+
+    // Local clients can ask for a shared memory ring
+    if(client->local) zero_copy->paths |= htole32(AARUREMOTE_ZERO_COPY_SHM);
+
+    // The token lets a client that lost its connection take this session's device back
+    if(resume_grace > 0 && GetRandomBytes(&client->token, sizeof(client->token)) == 0 && client->token != 0)
+    {
+        resume = AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_RESUME, sizeof(AaruCapabilityResume));
+
+        resume->token = client->token;
+        resume->grace = htole32(resume_grace);
+    }
+    else
+        client->token = 0;
+
+    // Larger packets are skipped, larger reads are streamed in chunks when the protocol allows it
+    max_packet = AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_MAX_PACKET, sizeof(AaruCapabilityMaxPacket));
+
+    max_packet->max_packet = htole32(AARUREMOTE_MAX_PACKET_SIZE);
+    max_packet->chunk_size = htole32(client->protocol >= AARUREMOTE_PROTOCOL_STREAM ? AARUREMOTE_STREAM_CHUNK_SIZE : 0);
+
+    // Each handle runs its commands on its own thread, up to the pipeline depth queued at once
+    value = htole32(AARUREMOTE_MAX_DEVICE_HANDLES);
+    memcpy(
+        AddCapability(pkt_caps, &off, AARUREMOTE_CAPABILITY_DEVICE_HANDLES, sizeof(uint32_t)), &value, sizeof(value));
+
+    pkt_caps->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_caps->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_caps->hdr.len         = htole32(off);
+    pkt_caps->hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_caps->hdr.packet_type = AARUREMOTE_PACKET_TYPE_CAPABILITIES;
+    pkt_caps->count           = htole32(pkt_caps->count);
+
+    ret = NetWrite(client->net_ctx, pkt_caps, off);
+    free(pkt_caps);
+
+    return ret < 0 ? -1 : 0;
+}
+
+int32_t StreamOsRead(ClientContext* client, uint64_t offset, uint32_t length)
+{
+    AaruPacketResOsReadChunk pkt_res_chunk;
+    NetIoVec                 iov[2];
+    uint32_t                 chunk;
+    uint32_t                 duration;
+    int32_t                  ret;
+
+    // Only one chunk is ever in memory, whatever the size of the read
+    if(!client->stream_buf) client->stream_buf = DmaAlloc(AARUREMOTE_STREAM_CHUNK_SIZE);
+
+    if(!client->stream_buf)
+    {
+        printf("Fatal error %d allocating memory for buffer, closing connection...\n", errno);
+        return -1;
+    }
+
+    memset(&pkt_res_chunk, 0, sizeof(AaruPacketResOsReadChunk));
+
+    pkt_res_chunk.hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_chunk.hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_chunk.hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_chunk.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD_CHUNK;
+
+    do
+    {
+        chunk = length < AARUREMOTE_STREAM_CHUNK_SIZE ? length : AARUREMOTE_STREAM_CHUNK_SIZE;
+
+        memset(client->stream_buf, 0, chunk);
+
+        duration = 0;
+        ret      = ClientOsRead(client, client->stream_buf, offset, chunk, &duration);
+
+        // The stream ends at the first error, the client knows where from the offset
+        pkt_res_chunk.hdr.len  = htole32(sizeof(AaruPacketResOsReadChunk) + chunk);
+        pkt_res_chunk.offset   = htole64(offset);
+        pkt_res_chunk.length   = htole32(chunk);
+        pkt_res_chunk.error_no = htole32(ret);
+        pkt_res_chunk.duration = htole32(duration);
+        pkt_res_chunk.last     = chunk == length || ret != 0;
+
+        iov[0].buf = &pkt_res_chunk;
+        iov[0].len = sizeof(AaruPacketResOsReadChunk);
+        iov[1].buf = client->stream_buf;
+        iov[1].len = chunk;
+
+        if(SendResponsev(client, iov, 2) < 0) return -1;
+
+        offset += chunk;
+        length -= chunk;
+    } while(!pkt_res_chunk.last);
+
+    return 0;
+}
+
+int32_t MultiScsiCommand(ClientContext* client, AaruPacketMultiCmdScsi* pkt_cmd_multi_scsi)
+{
+    AaruPacketMultiResScsi* pkt_res_multi_scsi;
+    AaruCmdScsi*            command;
+    NetIoVec*               iov;
+    char*                   data;
+    char*                   senses;
+    uint64_t                off;
+    uint32_t                len = le32toh(pkt_cmd_multi_scsi->hdr.len);
+    uint32_t                cmd_count;
+    uint32_t                buf_len;
+    uint32_t                sense_len;
+    uint32_t                duration;
+    uint32_t                sense;
+    uint32_t                res_len;
+    uint32_t                n;
+    int32_t                 ret;
+
+    cmd_count = le32toh(pkt_cmd_multi_scsi->cmd_count);
+
+    // Buffers are used in place, they must not overrun into the next packet
+    if(len < sizeof(AaruPacketMultiCmdScsi) ||
+       cmd_count > (len - sizeof(AaruPacketMultiCmdScsi)) / sizeof(AaruCmdScsi))
+    {
+        printf("Packet is smaller than its commands, closing connection...\n");
+        return -1;
+    }
+
+    off = sizeof(AaruPacketMultiCmdScsi) + (uint64_t)sizeof(AaruCmdScsi) * cmd_count;
+
+    for(n = 0; n < cmd_count; n++)
+        off += (uint64_t)le32toh(pkt_cmd_multi_scsi->commands[n].cdb_len) +
+               le32toh(pkt_cmd_multi_scsi->commands[n].buf_len);
+
+    if(off > len)
+    {
+        printf("Packet is smaller than its buffers, closing connection...\n");
+        return -1;
+    }
+
+    res_len            = sizeof(AaruPacketMultiResScsi) + sizeof(AaruResScsi) * cmd_count;
+    pkt_res_multi_scsi = ArenaAlloc(&client->arena, res_len);
+    senses             = ArenaAlloc(&client->arena, AARUREMOTE_SENSE_BUFFER_SIZE * cmd_count);
+    iov                = ArenaAlloc(&client->arena, sizeof(NetIoVec) * (cmd_count * 2 + 1));
+
+    if(!pkt_res_multi_scsi || !senses || !iov)
+    {
+        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+        return -1;
+    }
+
+    memset(pkt_res_multi_scsi, 0, res_len);
+
+    data = (char*)pkt_cmd_multi_scsi + sizeof(AaruPacketMultiCmdScsi) + sizeof(AaruCmdScsi) * cmd_count;
+
+    for(n = 0; n < cmd_count; n++)
+    {
+        command   = &pkt_cmd_multi_scsi->commands[n];
+        buf_len   = le32toh(command->buf_len);
+        sense_len = AARUREMOTE_SENSE_BUFFER_SIZE;
+        duration  = 0;
+        sense     = 0;
+
+        ret = ClientScsiCommand(client,
+                                le32toh(command->cdb_len) > 0 ? data : NULL,
+                                buf_len > 0 ? data + le32toh(command->cdb_len) : NULL,
+                                senses + AARUREMOTE_SENSE_BUFFER_SIZE * n,
+                                le32toh(command->timeout),
+                                (int32_t)le32toh(command->direction),
+                                &duration,
+                                &sense,
+                                le32toh(command->cdb_len),
+                                &buf_len,
+                                &sense_len);
+
+        // The reply cannot carry more than the client sent room for
+        if(buf_len > le32toh(command->buf_len)) buf_len = le32toh(command->buf_len);
+
+        pkt_res_multi_scsi->responses[n].sense_len = htole32(sense_len);
+        pkt_res_multi_scsi->responses[n].buf_len   = htole32(buf_len);
+        pkt_res_multi_scsi->responses[n].duration  = htole32(duration);
+        pkt_res_multi_scsi->responses[n].sense     = htole32(sense);
+        pkt_res_multi_scsi->responses[n].error_no  = htole32(ret);
+
+        iov[n * 2 + 1].buf = senses + AARUREMOTE_SENSE_BUFFER_SIZE * n;
+        iov[n * 2 + 1].len = sense_len;
+        iov[n * 2 + 2].buf = data + le32toh(command->cdb_len);
+        iov[n * 2 + 2].len = buf_len;
+        res_len += sense_len + buf_len;
+
+        data += le32toh(command->cdb_len) + le32toh(command->buf_len);
+
+        if((le32toh(pkt_cmd_multi_scsi->flags) & AARUREMOTE_MULTI_SCSI_FLAG_STOP_ON_ERROR) && (ret != 0 || sense))
+        {
+            n++;
+            break;
+        }
+    }
+
+    // Commands that did not run are left out, their entries in the array were never filled
+    res_len -= sizeof(AaruResScsi) * (cmd_count - n);
+
+    pkt_res_multi_scsi->hdr.len         = htole32(res_len);
+    pkt_res_multi_scsi->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_MULTI_SCSI;
+    pkt_res_multi_scsi->hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_multi_scsi->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_multi_scsi->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_multi_scsi->cmd_count       = htole32(n);
+
+    iov[0].buf = pkt_res_multi_scsi;
+    iov[0].len = sizeof(AaruPacketMultiResScsi) + sizeof(AaruResScsi) * n;
+
+    return SendResponsev(client, iov, (int32_t)(n * 2 + 1)) < 0 ? -1 : 0;
+}
+
+static int CompareOsReadExtents(const void* a, const void* b)
+{
+    const OsReadExtent* extent_a = a;
+    const OsReadExtent* extent_b = b;
+
+    if(extent_a->offset != extent_b->offset) return extent_a->offset < extent_b->offset ? -1 : 1;
+
+    return extent_a->index < extent_b->index ? -1 : extent_a->index > extent_b->index;
+}
+
+int32_t MultiOsRead(ClientContext* client, AaruPacketMultiCmdOsRead* pkt_cmd_multi_osread)
+{
+    AaruPacketMultiResOsRead* pkt_res_multi_osread;
+    AaruPacketNop*            pkt_nop = client->pkt_nop;
+    OsReadExtent*             extents;
+    NetIoVec                  iov[2];
+    char*                     data;
+    uint64_t                  data_len = 0;
+    uint32_t                  len      = le32toh(pkt_cmd_multi_osread->hdr.len);
+    uint32_t                  extent_count;
+    uint32_t                  res_len;
+    uint32_t                  n;
+    int32_t                   ret;
+
+    extent_count = le32toh(pkt_cmd_multi_osread->extent_count);
+
+    if(len < sizeof(AaruPacketMultiCmdOsRead) ||
+       extent_count > (len - sizeof(AaruPacketMultiCmdOsRead)) / sizeof(AaruOsReadExtent))
+    {
+        printf("Packet is smaller than its extents, closing connection...\n");
+        return -1;
+    }
+
+    for(n = 0; n < extent_count; n++) data_len += le32toh(pkt_cmd_multi_osread->extents[n].length);
+
+    res_len = sizeof(AaruPacketMultiResOsRead) + sizeof(AaruResOsRead) * extent_count;
+
+    if(data_len > AARUREMOTE_MAX_PACKET_SIZE - res_len)
+    {
+        pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_TOO_LARGE;
+        pkt_nop->error_no    = 0;
+        memset(&pkt_nop->reason, 0, 256);
+        strncpy(pkt_nop->reason, "Requested reads are too large, skipping...", 256);
+        printf("%s...\n", pkt_nop->reason);
+        return SendResponse(client, pkt_nop, sizeof(AaruPacketNop)) < 0 ? -1 : 0;
+    }
+
+    pkt_res_multi_osread = ArenaAlloc(&client->arena, res_len);
+    extents              = ArenaAlloc(&client->arena, sizeof(OsReadExtent) * extent_count);
+    data                 = ArenaAlloc(&client->arena, (uint32_t)data_len);
+
+    if(!pkt_res_multi_osread || !extents || !data)
+    {
+        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+        return -1;
+    }
+
+    memset(pkt_res_multi_osread, 0, res_len);
+    memset(data, 0, (size_t)data_len);
+
+    // Each extent reads straight into its place in the response
+    for(n = 0, data_len = 0; n < extent_count; n++)
+    {
+        extents[n].offset   = le64toh(pkt_cmd_multi_osread->extents[n].offset);
+        extents[n].length   = le32toh(pkt_cmd_multi_osread->extents[n].length);
+        extents[n].index    = n;
+        extents[n].buffer   = data + data_len;
+        extents[n].read     = 0;
+        extents[n].error_no = 0;
+        data_len += extents[n].length;
+    }
+
+    qsort(extents, extent_count, sizeof(OsReadExtent), CompareOsReadExtents);
+
+    ReadAheadCancel(client->read_ahead);
+
+    ret = extent_count > 0 ? OsReadv(client->device_ctx, extents, extent_count) : 0;
+
+    for(n = 0; n < extent_count; n++)
+    {
+        pkt_res_multi_osread->responses[extents[n].index].error_no = htole32(ret != 0 ? ret : extents[n].error_no);
+        pkt_res_multi_osread->responses[extents[n].index].length   = htole32(ret != 0 ? 0 : extents[n].read);
+    }
+
+    pkt_res_multi_osread->hdr.len         = htole32(res_len + (uint32_t)data_len);
+    pkt_res_multi_osread->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_MULTI_OSREAD;
+    pkt_res_multi_osread->hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_multi_osread->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_multi_osread->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_multi_osread->extent_count    = htole32(extent_count);
+
+    iov[0].buf = pkt_res_multi_osread;
+    iov[0].len = (int32_t)res_len;
+    iov[1].buf = data;
+    iov[1].len = (int32_t)data_len;
+
+    return SendResponsev(client, iov, 2) < 0 ? -1 : 0;
+}
+
+// Fills a READ(10), READ(12) or READ(16) CDB and returns its length, or 0 when the opcode cannot express the read
+uint32_t BuildScsiRead(unsigned char* cdb, uint8_t opcode, uint64_t lba, uint32_t count)
+{
+    memset(cdb, 0, 16);
+    cdb[0] = opcode;
+
+    switch(opcode)
+    {
+        case 0x28:
+            if(lba + count > 0x100000000ULL || count > 0xFFFF) return 0;
+
+            cdb[2] = (unsigned char)(lba >> 24);
+            cdb[3] = (unsigned char)(lba >> 16);
+            cdb[4] = (unsigned char)(lba >> 8);
+            cdb[5] = (unsigned char)lba;
+            cdb[7] = (unsigned char)(count >> 8);
+            cdb[8] = (unsigned char)count;
+            return 10;
+        case 0xA8:
+            if(lba + count > 0x100000000ULL) return 0;
+
+            cdb[2] = (unsigned char)(lba >> 24);
+            cdb[3] = (unsigned char)(lba >> 16);
+            cdb[4] = (unsigned char)(lba >> 8);
+            cdb[5] = (unsigned char)lba;
+            cdb[6] = (unsigned char)(count >> 24);
+            cdb[7] = (unsigned char)(count >> 16);
+            cdb[8] = (unsigned char)(count >> 8);
+            cdb[9] = (unsigned char)count;
+            return 12;
+        case 0x88:
+            cdb[2]  = (unsigned char)(lba >> 56);
+            cdb[3]  = (unsigned char)(lba >> 48);
+            cdb[4]  = (unsigned char)(lba >> 40);
+            cdb[5]  = (unsigned char)(lba >> 32);
+            cdb[6]  = (unsigned char)(lba >> 24);
+            cdb[7]  = (unsigned char)(lba >> 16);
+            cdb[8]  = (unsigned char)(lba >> 8);
+            cdb[9]  = (unsigned char)lba;
+            cdb[10] = (unsigned char)(count >> 24);
+            cdb[11] = (unsigned char)(count >> 16);
+            cdb[12] = (unsigned char)(count >> 8);
+            cdb[13] = (unsigned char)count;
+            return 16;
+        default: return 0;
+    }
+}
+
+int32_t StreamScsiRead(ClientContext* client, AaruPacketCmdScsiReadStream* pkt_cmd_read_stream)
+{
+    AaruPacketResScsiReadChunk pkt_res_chunk;
+    NetIoVec                   iov[3];
+    unsigned char              cdb[16];
+    char                       sense_buf[AARUREMOTE_SENSE_BUFFER_SIZE];
+    const char*                invalid    = NULL;
+    uint64_t                   lba        = le64toh(pkt_cmd_read_stream->lba);
+    uint32_t                   blocks     = le32toh(pkt_cmd_read_stream->blocks);
+    uint32_t                   block_size = le32toh(pkt_cmd_read_stream->block_size);
+    uint32_t                   chunk_blocks;
+    uint32_t                   cdb_len;
+    uint32_t                   count;
+    uint32_t                   buf_len;
+    uint32_t                   sense_len;
+    uint32_t                   duration;
+    uint32_t                   sense;
+    int32_t                    ret;
+
+    if(block_size == 0 || block_size > AARUREMOTE_STREAM_CHUNK_SIZE) invalid = "Invalid block size, skipping...";
+    else if(blocks == 0)
+        invalid = "Nothing to read, skipping...";
+    else if(BuildScsiRead(cdb, pkt_cmd_read_stream->opcode, lba + blocks - 1, 1) == 0)
+        invalid = "Unsupported read opcode or blocks out of its reach, skipping...";
+
+    if(invalid)
+    {
+        client->pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_INVALID_ARGUMENT;
+        client->pkt_nop->error_no    = 0;
+        memset(&client->pkt_nop->reason, 0, 256);
+        strncpy(client->pkt_nop->reason, invalid, 256);
+        printf("%s\n", client->pkt_nop->reason);
+        return SendResponse(client, client->pkt_nop, sizeof(AaruPacketNop)) < 0 ? -1 : 0;
+    }
+
+    // Chunks are read into the stream buffer, so they are shrunk to fit it and the transfer length field
+    chunk_blocks = le32toh(pkt_cmd_read_stream->chunk_blocks);
+
+    if(chunk_blocks == 0 || chunk_blocks > AARUREMOTE_STREAM_CHUNK_SIZE / block_size)
+        chunk_blocks = AARUREMOTE_STREAM_CHUNK_SIZE / block_size;
+
+    if(pkt_cmd_read_stream->opcode == 0x28 && chunk_blocks > 0xFFFF) chunk_blocks = 0xFFFF;
+
+    if(!client->stream_buf) client->stream_buf = DmaAlloc(AARUREMOTE_STREAM_CHUNK_SIZE);
+
+    if(!client->stream_buf)
+    {
+        printf("Fatal error %d allocating memory for buffer, closing connection...\n", errno);
+        return -1;
+    }
+
+    memset(&pkt_res_chunk, 0, sizeof(AaruPacketResScsiReadChunk));
+
+    pkt_res_chunk.hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_chunk.hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_chunk.hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_chunk.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI_READ_CHUNK;
+
+    do
+    {
+        count = blocks < chunk_blocks ? blocks : chunk_blocks;
+
+        cdb_len = BuildScsiRead(cdb, pkt_cmd_read_stream->opcode, lba, count);
+
+        buf_len   = count * block_size;
+        sense_len = sizeof(sense_buf);
+        duration  = 0;
+        sense     = 0;
+
+        // The whole chunk is sent, so what the device transfers short of it must not be the previous chunk's data
+        memset(client->stream_buf, 0, buf_len);
+
+        ret = ClientScsiCommand(client,
+                                (char*)cdb,
+                                client->stream_buf,
+                                sense_buf,
+                                le32toh(pkt_cmd_read_stream->timeout),
+                                AARUREMOTE_SCSI_DIRECTION_IN,
+                                &duration,
+                                &sense,
+                                cdb_len,
+                                &buf_len,
+                                &sense_len);
+
+        // A failed chunk only carries its status and sense, the client decides whether to retry it
+        buf_len = ret != 0 || sense ? 0 : count * block_size;
+
+        pkt_res_chunk.hdr.len   = htole32(sizeof(AaruPacketResScsiReadChunk) + sense_len + buf_len);
+        pkt_res_chunk.lba       = htole64(lba);
+        pkt_res_chunk.blocks    = htole32(count);
+        pkt_res_chunk.buf_len   = htole32(buf_len);
+        pkt_res_chunk.sense_len = htole32(sense_len);
+        pkt_res_chunk.duration  = htole32(duration);
+        pkt_res_chunk.sense     = htole32(sense);
+        pkt_res_chunk.error_no  = htole32(ret);
+        pkt_res_chunk.last =
+            count == blocks ||
+            (buf_len == 0 && (pkt_cmd_read_stream->flags & AARUREMOTE_SCSI_READ_STREAM_FLAG_STOP_ON_ERROR));
+
+        iov[0].buf = &pkt_res_chunk;
+        iov[0].len = sizeof(AaruPacketResScsiReadChunk);
+        iov[1].buf = sense_buf;
+        iov[1].len = sense_len;
+        iov[2].buf = client->stream_buf;
+        iov[2].len = buf_len;
+
+        if(SendResponsev(client, iov, 3) < 0) return -1;
+
+        lba += count;
+        blocks -= count;
+    } while(!pkt_res_chunk.last);
+
+    return 0;
+}
+
+// Tries a read once, leaving its status in the bad range entry it would become if it fails
+static int32_t RecoverRead(ClientContext*    client,
+                           uint8_t           opcode,
+                           uint64_t          lba,
+                           uint32_t          count,
+                           uint32_t          block_size,
+                           uint32_t          timeout,
+                           char*             buffer,
+                           AaruScsiBadRange* status,
+                           uint32_t*         duration)
+{
+    unsigned char cdb[16];
+    uint32_t      cdb_len;
+    uint32_t      buf_len = count * block_size;
+    uint32_t      elapsed = 0;
+    int32_t       ret;
+
+    status->error_no  = (uint32_t)-1;
+    status->sense     = 0;
+    status->sense_len = 0;
+
+    cdb_len = BuildScsiRead(cdb, opcode, lba, count);
+
+    if(cdb_len == 0) return -1;
+
+    status->sense_len = AARUREMOTE_SENSE_BUFFER_SIZE;
+
+    ret = ClientScsiCommand(client,
+                            (char*)cdb,
+                            buffer,
+                            status->sense_data,
+                            timeout,
+                            AARUREMOTE_SCSI_DIRECTION_IN,
+                            &elapsed,
+                            &status->sense,
+                            cdb_len,
+                            &buf_len,
+                            &status->sense_len);
+
+    status->error_no = (uint32_t)ret;
+    *duration += elapsed;
+
+    return ret != 0 || status->sense ? -1 : 0;
+}
+
+int32_t RecoverScsiRead(ClientContext* client, AaruPacketCmdScsiRecover* pkt_cmd_recover)
+{
+    AaruPacketResScsiRecover pkt_res_recover;
+    AaruScsiBadRange*        bad;
+    AaruScsiBadRange         status;
+    NetIoVec                 iov[3];
+    unsigned char            cdb[16];
+    const char*              invalid    = NULL;
+    char*                    data;
+    uint64_t                 lba        = le64toh(pkt_cmd_recover->lba);
+    uint32_t                 blocks     = le32toh(pkt_cmd_recover->blocks);
+    uint32_t                 block_size = le32toh(pkt_cmd_recover->block_size);
+    uint32_t                 retries    = le32toh(pkt_cmd_recover->retries);
+    uint32_t                 min_split  = le32toh(pkt_cmd_recover->min_split);
+    uint32_t                 max_bad;
+    uint32_t                 bad_count = 0;
+    uint32_t                 commands  = 0;
+    uint32_t                 duration  = 0;
+    uint32_t                 attempt;
+    uint32_t                 half;
+    uint32_t                 leaf;
+    uint32_t                 n;
+    int32_t                  ok;
+    int32_t                  depth;
+    uint64_t                 stack_lba[64];
+    uint32_t                 stack_blocks[64];
+
+    if(min_split == 0) min_split = 1;
+
+    // Halving leaves at most twice as many ranges as the smallest split fits
+    max_bad = blocks / min_split + 1;
+    max_bad = max_bad * 2 > blocks ? blocks : max_bad * 2;
+
+    if(block_size == 0 || blocks == 0) invalid = "Nothing to recover, skipping...";
+    else if(sizeof(AaruPacketResScsiRecover) + (uint64_t)max_bad * sizeof(AaruScsiBadRange) +
+                (uint64_t)blocks * block_size >
+            AARUREMOTE_MAX_PACKET_SIZE)
+        invalid = "Range to recover is too large, skipping...";
+    else if(BuildScsiRead(cdb, pkt_cmd_recover->opcodes[0], lba + blocks - 1, 1) == 0)
+        invalid = "Unsupported read opcode or blocks out of its reach, skipping...";
+
+    if(invalid)
+    {
+        client->pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_INVALID_ARGUMENT;
+        client->pkt_nop->error_no    = 0;
+        memset(&client->pkt_nop->reason, 0, 256);
+        strncpy(client->pkt_nop->reason, invalid, 256);
+        printf("%s\n", client->pkt_nop->reason);
+        return SendResponse(client, client->pkt_nop, sizeof(AaruPacketNop)) < 0 ? -1 : 0;
+    }
+
+    data = ArenaAlloc(&client->arena, blocks * block_size);
+    bad  = ArenaAlloc(&client->arena, max_bad * sizeof(AaruScsiBadRange));
+
+    if(!data || !bad)
+    {
+        printf("Fatal error %d allocating memory for buffer, closing connection...\n", errno);
+        return -1;
+    }
+
+    memset(data, 0, blocks * block_size);
+
+    stack_lba[0]    = lba;
+    stack_blocks[0] = blocks;
+    depth           = 1;
+
+    // Ranges are taken in order, so the unreadable ones come out sorted and neighbours can be merged
+    while(depth > 0)
+    {
+        depth--;
+        leaf = stack_blocks[depth] <= min_split;
+        ok   = 0;
+
+        // Larger ranges get a single try, only the smallest ones go through the retries and alternate opcodes
+        for(attempt = 0; !ok && attempt <= (leaf ? retries : 0); attempt++)
+            for(n = 0; !ok && n < (leaf ? 4 : 1) && pkt_cmd_recover->opcodes[n] != 0; n++)
+            {
+                commands++;
+                ok = RecoverRead(client,
+                                 pkt_cmd_recover->opcodes[n],
+                                 stack_lba[depth],
+                                 stack_blocks[depth],
+                                 block_size,
+                                 le32toh(pkt_cmd_recover->timeout),
+                                 data + (stack_lba[depth] - lba) * block_size,
+                                 &status,
+                                 &duration) == 0;
+            }
+
+        if(ok) continue;
+
+        if(!leaf)
+        {
+            half                    = stack_blocks[depth] / 2;
+            stack_lba[depth + 1]    = stack_lba[depth];
+            stack_blocks[depth + 1] = half;
+            stack_lba[depth] += half;
+            stack_blocks[depth] -= half;
+            depth += 2;
+            continue;
+        }
+
+        memset(data + (stack_lba[depth] - lba) * block_size, 0, stack_blocks[depth] * block_size);
+
+        if(bad_count > 0 && bad[bad_count - 1].lba + bad[bad_count - 1].blocks == stack_lba[depth] &&
+           bad[bad_count - 1].error_no == status.error_no && bad[bad_count - 1].sense_len == status.sense_len &&
+           memcmp(bad[bad_count - 1].sense_data, status.sense_data, status.sense_len) == 0)
+        {
+            bad[bad_count - 1].blocks += stack_blocks[depth];
+            continue;
+        }
+
+        bad[bad_count]        = status;
+        bad[bad_count].lba    = stack_lba[depth];
+        bad[bad_count].blocks = stack_blocks[depth];
+        bad_count++;
+    }
+
+    for(n = 0; n < bad_count; n++)
+    {
+        bad[n].lba       = htole64(bad[n].lba);
+        bad[n].blocks    = htole32(bad[n].blocks);
+        bad[n].error_no  = htole32(bad[n].error_no);
+        bad[n].sense     = htole32(bad[n].sense);
+        bad[n].sense_len = htole32(bad[n].sense_len);
+    }
+
+    memset(&pkt_res_recover, 0, sizeof(AaruPacketResScsiRecover));
+
+    pkt_res_recover.hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_recover.hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_recover.hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_recover.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI_RECOVER;
+    pkt_res_recover.hdr.len =
+        htole32(sizeof(AaruPacketResScsiRecover) + bad_count * sizeof(AaruScsiBadRange) + blocks * block_size);
+    pkt_res_recover.lba        = htole64(lba);
+    pkt_res_recover.blocks     = htole32(blocks);
+    pkt_res_recover.block_size = htole32(block_size);
+    pkt_res_recover.bad_count  = htole32(bad_count);
+    pkt_res_recover.commands   = htole32(commands);
+    pkt_res_recover.duration   = htole32(duration);
+
+    iov[0].buf = &pkt_res_recover;
+    iov[0].len = sizeof(AaruPacketResScsiRecover);
+    iov[1].buf = bad;
+    iov[1].len = bad_count * sizeof(AaruScsiBadRange);
+    iov[2].buf = data;
+    iov[2].len = blocks * block_size;
+
+    return SendResponsev(client, iov, 3) < 0 ? -1 : 0;
+}
+
+typedef struct
+{
+    HashContext hash;
+    void*       full;
+    void*       free;
+    void*       done;
+    char*       buffers[2];
+    uint32_t    lengths[2];
+} HashJob;
+
+// Hashes the buffers the reader fills, in turns, until it hands over an empty one
+static void* HashLoop(void* arguments)
+{
+    HashJob* job = arguments;
+    uint32_t n;
+
+    for(n = 0;; n ^= 1)
+    {
+        SemaphoreWait(job->full);
+
+        if(job->lengths[n] == 0) break;
+
+        HashUpdate(&job->hash, job->buffers[n], job->lengths[n]);
+        SemaphorePost(job->free);
+    }
+
+    SemaphorePost(job->done);
+
+    return NULL;
+}
+
+int32_t HashRead(ClientContext* client, AaruPacketCmdHash* pkt_cmd_hash)
+{
+    AaruPacketResHash          pkt_res_hash;
+    AaruPacketResOsReadChunk   pkt_res_os_chunk;
+    AaruPacketResScsiReadChunk pkt_res_scsi_chunk;
+    HashJob                    job;
+    NetIoVec                   iov[3];
+    unsigned char              cdb[16];
+    char                       sense_buf[AARUREMOTE_SENSE_BUFFER_SIZE];
+    const char*                invalid    = NULL;
+    uint64_t                   offset     = le64toh(pkt_cmd_hash->offset);
+    uint64_t                   remaining  = le64toh(pkt_cmd_hash->length);
+    uint64_t                   hashed     = 0;
+    uint64_t                   size;
+    uint32_t                   block_size = le32toh(pkt_cmd_hash->block_size);
+    uint32_t                   chunk;
+    uint32_t                   count;
+    uint32_t                   cdb_len;
+    uint32_t                   buf_len;
+    uint32_t                   sense_len;
+    uint32_t                   duration;
+    uint32_t                   total_duration = 0;
+    uint32_t                   sense          = 0;
+    int32_t                    ret            = 0;
+    uint8_t                    threaded;
+    uint8_t                    verify_only = pkt_cmd_hash->flags & AARUREMOTE_HASH_FLAG_VERIFY_ONLY;
+    uint8_t                    last;
+    uint8_t                    broken = 0;
+    uint32_t                   n;
+
+    if(remaining == 0) invalid = "Nothing to hash, skipping...";
+    else if(pkt_cmd_hash->source == AARUREMOTE_HASH_SOURCE_SCSI)
+    {
+        if(block_size == 0 || block_size > AARUREMOTE_STREAM_CHUNK_SIZE) invalid = "Invalid block size, skipping...";
+        else if(remaining > 0xFFFFFFFF || BuildScsiRead(cdb, pkt_cmd_hash->opcode, offset + remaining - 1, 1) == 0)
+            invalid = "Unsupported read opcode or blocks out of its reach, skipping...";
+    }
+    else if(pkt_cmd_hash->source != AARUREMOTE_HASH_SOURCE_OS)
+        invalid = "Unknown source to hash, skipping...";
+    else
+    {
+        // Reads past the end come back as zeroes, that would be hashed as if they were data
+        size = OsGetSize(client->device_ctx);
+
+        if(size > 0 && (offset >= size || remaining > size - offset))
+            invalid = "Range is past the end of the device, skipping...";
+    }
+
+    if(invalid)
+    {
+        client->pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_INVALID_ARGUMENT;
+        client->pkt_nop->error_no    = 0;
+        memset(&client->pkt_nop->reason, 0, 256);
+        strncpy(client->pkt_nop->reason, invalid, 256);
+        printf("%s\n", client->pkt_nop->reason);
+        return SendResponse(client, client->pkt_nop, sizeof(AaruPacketNop)) < 0 ? -1 : 0;
+    }
+
+    // SCSI reads go in whole blocks, that fit the chunk and the transfer length field
+    if(pkt_cmd_hash->source == AARUREMOTE_HASH_SOURCE_SCSI)
+    {
+        chunk = AARUREMOTE_STREAM_CHUNK_SIZE / block_size;
+
+        if(pkt_cmd_hash->opcode == 0x28 && chunk > 0xFFFF) chunk = 0xFFFF;
+    }
+    else
+    {
+        block_size = 1;
+        chunk      = AARUREMOTE_STREAM_CHUNK_SIZE;
+    }
+
+    HashInit(&job.hash, pkt_cmd_hash->algorithms);
+
+    job.buffers[0] = ArenaAlloc(&client->arena, AARUREMOTE_STREAM_CHUNK_SIZE);
+    job.buffers[1] = ArenaAlloc(&client->arena, AARUREMOTE_STREAM_CHUNK_SIZE);
+
+    if(!job.buffers[0] || !job.buffers[1])
+    {
+        printf("Fatal error %d allocating memory for buffer, closing connection...\n", errno);
+        return -1;
+    }
+
+    // Digests are computed on their own thread, while the next chunk is read. Without it they are computed in turn.
+    job.full = SemaphoreCreate(0);
+    job.free = SemaphoreCreate(2);
+    job.done = SemaphoreCreate(0);
+    threaded = job.full && job.free && job.done && StartWorkerThread(HashLoop, &job) == 0;
+
+    memset(&pkt_res_os_chunk, 0, sizeof(AaruPacketResOsReadChunk));
+    memset(&pkt_res_scsi_chunk, 0, sizeof(AaruPacketResScsiReadChunk));
+
+    pkt_res_os_chunk.hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_os_chunk.hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_os_chunk.hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_os_chunk.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD_CHUNK;
+
+    pkt_res_scsi_chunk.hdr             = pkt_res_os_chunk.hdr;
+    pkt_res_scsi_chunk.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI_READ_CHUNK;
+
+    for(n = 0, last = 0; !last;)
+    {
+        if(threaded) SemaphoreWait(job.free);
+
+        count     = remaining < chunk ? (uint32_t)remaining : chunk;
+        buf_len   = count * block_size;
+        sense_len = 0;
+        duration  = 0;
+
+        if(pkt_cmd_hash->source == AARUREMOTE_HASH_SOURCE_SCSI)
+        {
+            cdb_len   = BuildScsiRead(cdb, pkt_cmd_hash->opcode, offset, count);
+            sense_len = sizeof(sense_buf);
+
+            ret = ClientScsiCommand(client,
+                                    (char*)cdb,
+                                    job.buffers[n],
+                                    sense_buf,
+                                    le32toh(pkt_cmd_hash->timeout),
+                                    AARUREMOTE_SCSI_DIRECTION_IN,
+                                    &duration,
+                                    &sense,
+                                    cdb_len,
+                                    &buf_len,
+                                    &sense_len);
+
+            buf_len = ret != 0 || sense ? 0 : count * block_size;
+        }
+        else
+        {
+            memset(job.buffers[n], 0, buf_len);
+            ret = ClientOsRead(client, job.buffers[n], offset, buf_len, &duration);
+        }
+
+        total_duration += duration;
+        last = count == remaining || ret != 0 || sense;
+
+        // A chunk that failed is sent, so the client knows why, but it is not hashed
+        job.lengths[n] = ret != 0 || sense ? 0 : buf_len;
+
+        if(job.lengths[n] > 0)
+        {
+            hashed += job.lengths[n];
+
+            if(threaded) SemaphorePost(job.full);
+            else
+                HashUpdate(&job.hash, job.buffers[n], job.lengths[n]);
+        }
+        else if(threaded)
+            SemaphorePost(job.free);
+
+        if(!verify_only)
+        {
+            if(pkt_cmd_hash->source == AARUREMOTE_HASH_SOURCE_SCSI)
+            {
+                pkt_res_scsi_chunk.hdr.len   = htole32(sizeof(AaruPacketResScsiReadChunk) + sense_len + buf_len);
+                pkt_res_scsi_chunk.lba       = htole64(offset);
+                pkt_res_scsi_chunk.blocks    = htole32(count);
+                pkt_res_scsi_chunk.buf_len   = htole32(buf_len);
+                pkt_res_scsi_chunk.sense_len = htole32(sense_len);
+                pkt_res_scsi_chunk.duration  = htole32(duration);
+                pkt_res_scsi_chunk.sense     = htole32(sense);
+                pkt_res_scsi_chunk.error_no  = htole32(ret);
+                pkt_res_scsi_chunk.last      = last;
+
+                iov[0].buf = &pkt_res_scsi_chunk;
+                iov[0].len = sizeof(AaruPacketResScsiReadChunk);
+            }
+            else
+            {
+                pkt_res_os_chunk.hdr.len  = htole32(sizeof(AaruPacketResOsReadChunk) + buf_len);
+                pkt_res_os_chunk.offset   = htole64(offset);
+                pkt_res_os_chunk.length   = htole32(buf_len);
+                pkt_res_os_chunk.error_no = htole32(ret);
+                pkt_res_os_chunk.duration = htole32(duration);
+                pkt_res_os_chunk.last     = last;
+
+                iov[0].buf = &pkt_res_os_chunk;
+                iov[0].len = sizeof(AaruPacketResOsReadChunk);
+            }
+
+            iov[1].buf = sense_buf;
+            iov[1].len = sense_len;
+            iov[2].buf = job.buffers[n];
+            iov[2].len = buf_len;
+
+            if(SendResponsev(client, iov, 3) < 0)
+            {
+                last   = 1;
+                broken = 1;
+            }
+        }
+
+        // The hash thread takes the buffers in turns, a failed chunk leaves its buffer to be filled again
+        if(job.lengths[n] > 0) n ^= 1;
+
+        offset += count;
+        remaining -= count;
+    }
+
+    // Nothing may still be hashing when the buffers go back to the arena. The next buffer in turn is handed over
+    // empty once the thread is done with it.
+    if(threaded)
+    {
+        SemaphoreWait(job.free);
+        job.lengths[n] = 0;
+        SemaphorePost(job.full);
+        SemaphoreWait(job.done);
+    }
+
+    SemaphoreFree(job.full);
+    SemaphoreFree(job.free);
+    SemaphoreFree(job.done);
+
+    if(broken) return -1;
+
+    memset(&pkt_res_hash, 0, sizeof(AaruPacketResHash));
+
+    HashFinal(&job.hash,
+              &pkt_res_hash.crc32,
+              &pkt_res_hash.crc64,
+              pkt_res_hash.md5,
+              pkt_res_hash.sha1,
+              pkt_res_hash.sha256);
+
+    pkt_res_hash.hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_hash.hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_hash.hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_hash.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_HASH;
+    pkt_res_hash.hdr.len         = htole32(sizeof(AaruPacketResHash));
+    pkt_res_hash.length          = htole64(hashed);
+    pkt_res_hash.error_no        = htole32(ret);
+    pkt_res_hash.sense           = htole32(sense);
+    pkt_res_hash.duration        = htole32(total_duration);
+    pkt_res_hash.algorithms      = pkt_cmd_hash->algorithms;
+    pkt_res_hash.crc32           = htole32(pkt_res_hash.crc32);
+    pkt_res_hash.crc64           = htole64(pkt_res_hash.crc64);
+
+    return SendResponse(client, &pkt_res_hash, sizeof(AaruPacketResHash)) < 0 ? -1 : 0;
+}
+
+static ClientContext* OpenDeviceHandle(ClientContext* client, uint32_t handle)
+{
+    ClientContext* handle_client;
+    DeviceQueue*   queue;
+
+    if(!client->handles)
+    {
+        client->handles = malloc(sizeof(ClientContext*) * AARUREMOTE_MAX_DEVICE_HANDLES);
+
+        if(!client->handles) return NULL;
+
+        memset(client->handles, 0, sizeof(ClientContext*) * AARUREMOTE_MAX_DEVICE_HANDLES);
+    }
+
+    // From now on responses come from several threads, and each one must reach the socket whole
+    if(!client->send_mutex) client->send_mutex = MutexCreate();
+
+    if(!client->send_mutex) return NULL;
+
+    handle_client = CreateClient(client->net_ctx, client->pkt_server_hello);
+
+    if(!handle_client) return NULL;
+
+    queue = malloc(sizeof(DeviceQueue));
+
+    if(queue)
+    {
+        memset(queue, 0, sizeof(DeviceQueue));
+
+        queue->mutex   = MutexCreate();
+        queue->ready   = SemaphoreCreate(0);
+        queue->stopped = SemaphoreCreate(0);
+    }
+
+    handle_client->queue              = queue;
+    handle_client->send_mutex         = client->send_mutex;
+    handle_client->protocol           = client->protocol;
+    handle_client->local              = client->local;
+    handle_client->scsi_cache_enabled = client->scsi_cache_enabled;
+    handle_client->hello_received     = 1;
+
+    // Addresses fill the same buffer, so leave room for the handle
+#ifdef _WIN32
+    sprintf_s(handle_client->address, sizeof(handle_client->address), "%.40s handle %u", client->address, handle);
+#else
+    snprintf(handle_client->address, sizeof(handle_client->address), "%.40s handle %u", client->address, handle);
+#endif
+
+    // Each thread compresses and elides into its own buffers
+    if(client->compress)
+    {
+        handle_client->lz_table = malloc(sizeof(uint32_t) << AARUREMOTE_LZ_HASH_BITS);
+        handle_client->compress = handle_client->lz_table != NULL;
+    }
+
+    if(client->sparse)
+    {
+        handle_client->pkt_res_sparse = malloc(sizeof(AaruPacketResSparse));
+        handle_client->sparse         = handle_client->pkt_res_sparse != NULL;
+    }
+
+    if(!queue || !queue->mutex || !queue->ready || !queue->stopped ||
+       StartWorkerThread(DeviceHandleLoop, handle_client) != 0)
+    {
+        handle_client->net_ctx    = NULL;
+        handle_client->send_mutex = NULL;
+        FreeClient(handle_client);
+        return NULL;
+    }
+
+    client->handles[handle - 1] = handle_client;
+
+    printf("Client %s opened device handle %u.\n", client->address, handle);
+
+    return handle_client;
+}
+
+int32_t DeviceHandleCommand(ClientContext* client, AaruPacketCmdDevice* pkt_cmd_device)
+{
+    AaruPacketHeader* pkt_hdr = (AaruPacketHeader*)(pkt_cmd_device + 1);
+    ClientContext*    handle_client;
+    DeviceQueue*      queue;
+    DevicePacket*     packet;
+    const char*       reason = NULL;
+    uint32_t          handle = le32toh(pkt_cmd_device->handle);
+    uint32_t          len;
+    uint32_t          queued = 0;
+    uint8_t           failed = 0;
+
+    if(le32toh(pkt_cmd_device->hdr.len) < sizeof(AaruPacketCmdDevice) + sizeof(AaruPacketHeader))
+    {
+        printf("Packet is smaller than its buffers, closing connection...\n");
+        return -1;
+    }
+
+    len = le32toh(pkt_cmd_device->hdr.len) - sizeof(AaruPacketCmdDevice);
+
+    if(pkt_hdr->remote_id != htole32(AARUREMOTE_REMOTE_ID) || pkt_hdr->packet_id != htole32(AARUREMOTE_PACKET_ID) ||
+       le32toh(pkt_hdr->len) != len)
+    {
+        printf("Packet for device handle %u is not a correct aaruremote packet, closing connection...\n", handle);
+        return -1;
+    }
+
+    handle_client = client->handles && handle >= 1 && handle <= AARUREMOTE_MAX_DEVICE_HANDLES
+                        ? client->handles[handle - 1]
+                        : NULL;
+
+    if(handle_client)
+    {
+        MutexLock(handle_client->queue->mutex);
+        queued = handle_client->queue->count;
+        failed = handle_client->queue->failed;
+        MutexUnlock(handle_client->queue->mutex);
+    }
+
+    if(failed)
+    {
+        printf("Device handle %u could not send its responses, closing connection...\n", handle);
+        return -1;
+    }
+
+    // Responses from different handles arrive in any order, only tags tell them apart
+    if(client->protocol < AARUREMOTE_PROTOCOL_TAGS)
+        reason = "Device handles need tagged packets, skipping";
+    else if(handle < 1 || handle > AARUREMOTE_MAX_DEVICE_HANDLES)
+        reason = "Device handle is out of range, skipping";
+    else if(pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_HELLO ||
+            pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_COMMAND_DEVICE ||
+            pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_COMMAND_RESUME ||
+            pkt_hdr->packet_type == AARUREMOTE_PACKET_TYPE_COMMAND_SHM_SETUP)
+        reason = "Packet cannot be sent to a device handle, skipping";
+    else if(!handle_client && pkt_hdr->packet_type != AARUREMOTE_PACKET_TYPE_COMMAND_OPEN_DEVICE)
+        reason = "Device handle is not open, skipping";
+    else if(queued >= AARUREMOTE_PIPELINE_DEPTH)
+        reason = "Too many packets queued for device handle, skipping";
+
+    if(reason)
+    {
+        client->pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_INVALID_ARGUMENT;
+        client->pkt_nop->error_no    = 0;
+        memset(&client->pkt_nop->reason, 0, 256);
+        strncpy(client->pkt_nop->reason, reason, 256);
+        printf("%s...\n", reason);
+
+        return SendResponse(client, client->pkt_nop, sizeof(AaruPacketNop)) < 0 ? -1 : 0;
+    }
+
+    // The device is opened on its own thread, as any other command for it
+    if(!handle_client) handle_client = OpenDeviceHandle(client, handle);
+
+    if(!handle_client)
+    {
+        printf("Fatal error %d creating device handle, closing connection...\n", errno);
+        return -1;
+    }
+
+    queue = handle_client->queue;
+
+    // The receive buffer is reused for the next packets, so the handle gets its own copy
+    packet = malloc(sizeof(DevicePacket) + len);
+
+    if(!packet)
+    {
+        printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+        return -1;
+    }
+
+    packet->next = NULL;
+    packet->len  = len;
+    memcpy(packet + 1, pkt_hdr, len);
+
+    MutexLock(queue->mutex);
+
+    if(queue->tail)
+        queue->tail->next = packet;
+    else
+        queue->head = packet;
+
+    queue->tail = packet;
+    queue->count++;
+
+    MutexUnlock(queue->mutex);
+
+    SemaphorePost(queue->ready);
+
+    return 0;
+}
+
+void* DeviceHandleLoop(void* arguments)
+{
+    ClientContext* client = arguments;
+    DeviceQueue*   queue  = client->queue;
+    DevicePacket*  packet;
+    char*          new_buf;
+    int32_t        ret = 0;
+
+    for(;;)
+    {
+        SemaphoreWait(queue->ready);
+
+        MutexLock(queue->mutex);
+
+        packet = queue->head;
+
+        if(packet)
+        {
+            queue->head = packet->next;
+
+            if(!queue->head) queue->tail = NULL;
+        }
+
+        MutexUnlock(queue->mutex);
+
+        // A wake up without a packet means the connection is closing
+        if(!packet) break;
+
+        if(ret == 0 && packet->len > client->rx_size)
+        {
+            new_buf = realloc(client->rx_buf, packet->len);
+
+            if(new_buf)
+            {
+                client->rx_buf  = new_buf;
+                client->rx_size = packet->len;
+            }
+            else
+                ret = -1;
+        }
+
+        if(ret == 0)
+        {
+            memcpy(client->rx_buf, packet + 1, packet->len);
+            client->rx_off = 0;
+            client->rx_len = packet->len;
+
+            ret = ProcessPacket(client);
+
+            // The connection's own thread does not know this thread queued output, so nothing may stay behind
+            if(ret == 0) ret = NetDrain(client->net_ctx) < 0 ? -1 : 0;
+
+            if(ret != 0) printf("Error servicing client %s, dropping its packets...\n", client->address);
+        }
+
+        free(packet);
+
+        MutexLock(queue->mutex);
+        queue->count--;
+        queue->failed = ret != 0;
+        MutexUnlock(queue->mutex);
+    }
+
+    SemaphorePost(queue->stopped);
+
+    return NULL;
+}
+
+int32_t SetupShm(ClientContext* client, uint32_t size)
+{
+    AaruPacketResShmSetup pkt_res_shm;
+    void*                 shm;
+    int32_t               fd;
+
+    if(!client->local || client->shm) return -1;
+
+    if(size == 0) size = AARUREMOTE_SHM_DEFAULT_SIZE;
+
+    if(size > AARUREMOTE_SHM_MAX_SIZE) size = AARUREMOTE_SHM_MAX_SIZE;
+
+    // Keep the data page aligned
+    size = (size + AARUREMOTE_SHM_HEADER_SIZE - 1) & ~(uint32_t)(AARUREMOTE_SHM_HEADER_SIZE - 1);
+
+    shm = ShmCreate(AARUREMOTE_SHM_HEADER_SIZE + size, &fd);
+
+    if(!shm) return -1;
+
+    memset(&pkt_res_shm, 0, sizeof(AaruPacketResShmSetup));
+
+    pkt_res_shm.hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_shm.hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_shm.hdr.len         = htole32(sizeof(AaruPacketResShmSetup));
+    pkt_res_shm.hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_shm.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SHM_SETUP;
+    pkt_res_shm.hdr.tag         = client->tag;
+    pkt_res_shm.size            = htole32(size);
+    pkt_res_shm.data_offset     = htole32(AARUREMOTE_SHM_HEADER_SIZE);
+
+    if(NetSendFd(client->net_ctx, &pkt_res_shm, sizeof(AaruPacketResShmSetup), fd) < 0)
+    {
+        ShmFree(shm, AARUREMOTE_SHM_HEADER_SIZE + size, fd);
+        return -1;
+    }
+
+    client->shm      = shm;
+    client->shm_size = size;
+    client->shm_fd   = fd;
+    client->shm_head = 0;
+
+    printf("Client %s uses a shared memory ring of %u bytes.\n", client->address, size);
+
+    return 0;
+}
+
+int32_t ShmOsRead(ClientContext* client, uint64_t offset, uint32_t length)
+{
+    AaruPacketResOsReadShm pkt_res_shm;
+    uint64_t               position = client->shm_head;
+    uint64_t               tail;
+    char*                  slot;
+    uint32_t               duration = 0;
+    int32_t                ret;
+
+    if(length > client->shm_size) return 1;
+
+    // Data never wraps around, it starts over from the beginning of the ring instead
+    if(position % client->shm_size + length > client->shm_size)
+        position += client->shm_size - position % client->shm_size;
+
+    // The client moves the tail past what it has consumed, what it has not cannot be overwritten
+    tail = ((volatile AaruShmRing*)client->shm)->tail;
+
+    if(le64toh(tail) > client->shm_head || position + length - le64toh(tail) > client->shm_size) return 1;
+
+    slot = (char*)client->shm + AARUREMOTE_SHM_HEADER_SIZE + position % client->shm_size;
+
+    // Like the socket path, what a short or failed read leaves behind must be zeroes, not an earlier read's data
+    memset(slot, 0, length);
+
+    ret = ClientOsRead(client, slot, offset, length, &duration);
+
+    client->shm_head = position + length;
+    client->shm_bytes += length;
+    ((volatile AaruShmRing*)client->shm)->head = htole64(client->shm_head);
+
+    memset(&pkt_res_shm, 0, sizeof(AaruPacketResOsReadShm));
+
+    pkt_res_shm.hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_shm.hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_shm.hdr.len         = htole32(sizeof(AaruPacketResOsReadShm));
+    pkt_res_shm.hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_shm.hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD_SHM;
+    pkt_res_shm.error_no        = htole32(ret);
+    pkt_res_shm.duration        = htole32(duration);
+    pkt_res_shm.position        = htole64(position);
+    pkt_res_shm.length          = htole32(length);
+
+    return SendResponse(client, &pkt_res_shm, sizeof(AaruPacketResOsReadShm)) < 0 ? -1 : 0;
+}
+
+int32_t SendResponse(ClientContext* client, void* pkt, int32_t len)
+{
+    NetIoVec iov;
+
+    iov.buf = pkt;
+    iov.len = len;
+
+    return SendResponsev(client, &iov, 1);
+}
+
+// Device handles write from their own threads, and platforms may write a vector in several calls
+static int32_t WriteResponsev(ClientContext* client, NetIoVec* iov, int32_t iov_count)
+{
+    int32_t ret;
+
+    if(!client->send_mutex) return NetWritev(client->net_ctx, iov, iov_count);
+
+    MutexLock(client->send_mutex);
+    ret = NetWritev(client->net_ctx, iov, iov_count);
+    MutexUnlock(client->send_mutex);
+
+    return ret;
+}
+
+// Like the receive buffer, the compression buffers go back to the size of a streamed chunk after a larger packet
+static void ShrinkLzBuffers(ClientContext* client)
+{
+    char* new_in;
+    char* new_out;
+
+    if(client->lz_size <= AARUREMOTE_LZ_BUFFER_SIZE) return;
+
+    new_in  = realloc(client->lz_in, AARUREMOTE_LZ_BUFFER_SIZE);
+    new_out = realloc(client->lz_out, sizeof(AaruPacketResCompressed) + AARUREMOTE_LZ_BUFFER_SIZE);
+
+    // Either one that could not shrink is still larger than needed
+    if(new_in) client->lz_in = new_in;
+    if(new_out) client->lz_out = new_out;
+
+    client->lz_size = AARUREMOTE_LZ_BUFFER_SIZE;
+}
+
+int32_t SendResponsev(ClientContext* client, NetIoVec* iov, int32_t iov_count)
+{
+    AaruPacketResCompressed* pkt_res_compressed;
+    NetIoVec                 compressed_iov;
+    uint32_t                 len = 0;
+    uint32_t                 off;
+    int32_t                  packed;
+    int32_t                  ret;
+    int32_t                  i;
+    char*                    new_in;
+    char*                    new_out;
+
+    // Responses carry the tag of the command they answer, the first vector always starts with the header
+    ((AaruPacketHeader*)iov[0].buf)->tag = client->tag;
+
+    // The data buffer is always the last vector
+    if(client->sparse && iov_count >= 2 && iov[iov_count - 1].len >= AARUREMOTE_SPARSE_THRESHOLD)
+        iov_count = SparseResponse(client, &iov, iov_count);
+
+    for(i = 0; i < iov_count; i++) len += iov[i].len;
+
+    packed = 0;
+
+    if(client->compress && len >= AARUREMOTE_COMPRESSION_THRESHOLD)
+    {
+        if(len > client->lz_size)
+        {
+            new_in  = realloc(client->lz_in, len);
+            new_out = new_in ? realloc(client->lz_out, sizeof(AaruPacketResCompressed) + len) : NULL;
+
+            if(new_in) client->lz_in = new_in;
+            if(new_out)
+            {
+                client->lz_out  = new_out;
+                client->lz_size = len;
+            }
+        }
+
+        if(len <= client->lz_size)
+        {
+            for(i = 0, off = 0; i < iov_count; i++)
+            {
+                if(iov[i].len > 0) memcpy(client->lz_in + off, iov[i].buf, iov[i].len);
+
+                off += iov[i].len;
+            }
+
+            // Only worth it when it saves at least a sixteenth, otherwise this packet goes raw
+            packed = LzCompress((uint8_t*)client->lz_in,
+                                len,
+                                (uint8_t*)client->lz_out + sizeof(AaruPacketResCompressed),
+                                len - len / 16,
+                                client->lz_table);
+        }
+    }
+
+    if(packed <= 0)
+    {
+        client->raw_bytes += len;
+        ret = WriteResponsev(client, iov, iov_count);
+
+        ShrinkLzBuffers(client);
+        return ret;
+    }
+
+    pkt_res_compressed = (AaruPacketResCompressed*)client->lz_out;
+
+    pkt_res_compressed->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_compressed->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_compressed->hdr.len         = htole32(sizeof(AaruPacketResCompressed) + packed);
+    pkt_res_compressed->hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_compressed->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_COMPRESSED;
+    pkt_res_compressed->hdr.tag         = client->tag;
+    pkt_res_compressed->raw_len         = htole32(len);
+
+    client->compressed_in_bytes += len;
+    client->compressed_out_bytes += sizeof(AaruPacketResCompressed) + packed;
+
+    iov      = &compressed_iov;
+    iov->buf = pkt_res_compressed;
+    iov->len = sizeof(AaruPacketResCompressed) + packed;
+    ret      = WriteResponsev(client, iov, 1);
+
+    ShrinkLzBuffers(client);
+    return ret;
+}
+
+int32_t SparseResponse(ClientContext* client, NetIoVec** iov, int32_t iov_count)
+{
+    AaruPacketResSparse* pkt_res_sparse = client->pkt_res_sparse;
+    NetIoVec*            out;
+    const uint8_t*       data       = (*iov)[iov_count - 1].buf;
+    uint32_t             data_len   = (*iov)[iov_count - 1].len;
+    uint32_t             blocks     = (data_len + AARUREMOTE_SPARSE_BLOCK_SIZE - 1) / AARUREMOTE_SPARSE_BLOCK_SIZE;
+    uint32_t             map_len    = (blocks + 7) / 8;
+    uint32_t             prefix_len = 0;
+    uint32_t             len;
+    uint32_t             start;
+    uint32_t             end;
+    uint32_t             n;
+    int32_t              count;
+    int32_t              i;
+    uint8_t*             new_map;
+    NetIoVec*            new_iov;
+
+    if(map_len > client->sparse_map_size)
+    {
+        new_map = realloc(client->sparse_map, map_len);
+
+        if(!new_map) return iov_count;
+
+        client->sparse_map      = new_map;
+        client->sparse_map_size = map_len;
+    }
+
+    // Header, prefix, map and, at worst, every other block
+    n = iov_count + 2 + (blocks + 1) / 2;
+
+    if(n > client->sparse_iov_size)
+    {
+        new_iov = realloc(client->sparse_iov, sizeof(NetIoVec) * n);
+
+        if(!new_iov) return iov_count;
+
+        client->sparse_iov      = new_iov;
+        client->sparse_iov_size = n;
+    }
+
+    n = ZeroBlocks(data, data_len, AARUREMOTE_SPARSE_BLOCK_SIZE, client->sparse_map);
+
+    // Not worth it when the descriptor takes more than the zeroes it spares
+    if(n * AARUREMOTE_SPARSE_BLOCK_SIZE <= sizeof(AaruPacketResSparse) + map_len + AARUREMOTE_SPARSE_BLOCK_SIZE)
+        return iov_count;
+
+    out        = client->sparse_iov;
+    out[0].buf = pkt_res_sparse;
+    out[0].len = sizeof(AaruPacketResSparse);
+    count      = 1;
+
+    for(i = 0; i < iov_count - 1; i++)
+    {
+        out[count++] = (*iov)[i];
+        prefix_len += (*iov)[i].len;
+    }
+
+    out[count].buf = client->sparse_map;
+    out[count].len = map_len;
+    count++;
+
+    len = sizeof(AaruPacketResSparse) + prefix_len + map_len;
+
+    // Blocks that are not zeroes go out as they are, consecutive ones in a single vector
+    for(n = 0; n < blocks;)
+    {
+        if(client->sparse_map[n / 8] & (1 << (n % 8)))
+        {
+            n++;
+            continue;
+        }
+
+        for(start = n; n < blocks && !(client->sparse_map[n / 8] & (1 << (n % 8))); n++)
+            ;
+
+        end = n * AARUREMOTE_SPARSE_BLOCK_SIZE < data_len ? n * AARUREMOTE_SPARSE_BLOCK_SIZE : data_len;
+
+        out[count].buf = data + start * AARUREMOTE_SPARSE_BLOCK_SIZE;
+        out[count].len = end - start * AARUREMOTE_SPARSE_BLOCK_SIZE;
+        len += out[count].len;
+        count++;
+    }
+
+    pkt_res_sparse->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+    pkt_res_sparse->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+    pkt_res_sparse->hdr.len         = htole32(len);
+    pkt_res_sparse->hdr.version     = AARUREMOTE_PACKET_VERSION;
+    pkt_res_sparse->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SPARSE;
+    pkt_res_sparse->hdr.tag         = client->tag;
+    pkt_res_sparse->raw_len         = htole32(prefix_len + data_len);
+    pkt_res_sparse->prefix_len      = htole32(prefix_len);
+    pkt_res_sparse->block_size      = htole32(AARUREMOTE_SPARSE_BLOCK_SIZE);
+    pkt_res_sparse->block_count     = htole32(blocks);
+
+    client->sparse_bytes += prefix_len + data_len + sizeof(AaruPacketResSparse) + map_len - len;
+
+    *iov = out;
+
+    return count;
+}
+
+int32_t ProcessPacket(ClientContext* client)
+{
+    AtaErrorRegistersChs            ata_chs_error_regs;
+    AtaErrorRegistersLba28          ata_lba28_error_regs;
+    AtaErrorRegistersLba48          ata_lba48_error_regs;
+    char*                           buffer;
+    char*                           cdb_buf;
+    char*                           cid;
+    char*                           csd;
+    char*                           in_buf;
+    char*                           ocr;
+    char*                           out_buf;
+    char*                           scr;
+    char                            sense_buf[AARUREMOTE_SENSE_BUFFER_SIZE];
+    AaruPacketCmdAtaChs*            pkt_cmd_ata_chs;
+    AaruPacketCmdAtaLba28*          pkt_cmd_ata_lba28;
+    AaruPacketCmdAtaLba48*          pkt_cmd_ata_lba48;
+    AaruPacketCmdOpen*              pkt_dev_open;
+    AaruPacketCmdScsi*              pkt_cmd_scsi;
+    AaruPacketCmdSdhci*             pkt_cmd_sdhci;
+    AaruPacketMultiCmdSdhci*        pkt_cmd_multi_sdhci;
+    AaruPacketHeader*               pkt_hdr;
+    AaruPacketNop*                  pkt_nop;
+    AaruPacketResAmIRoot*           pkt_res_am_i_root;
+    AaruPacketResAtaChs*            pkt_res_ata_chs;
+    AaruPacketResAtaLba28*          pkt_res_ata_lba28;
+    AaruPacketResAtaLba48*          pkt_res_ata_lba48;
+    AaruPacketResGetDeviceType*     pkt_dev_type;
+    AaruPacketResGetFireWireData*   pkt_res_firewire;
+    AaruPacketResGetPcmciaData*     pkt_res_pcmcia;
+    AaruPacketResGetSdhciRegisters* pkt_res_sdhci_registers;
+    AaruPacketResGetUsbData*        pkt_res_usb;
+    AaruPacketResListDevs*          pkt_res_devinfo;
+    AaruPacketResScsi*              pkt_res_scsi;
+    AaruPacketResSdhci*             pkt_res_sdhci;
+    AaruPacketMultiResSdhci*        pkt_res_multi_sdhci;
+    AaruPacketCmdOsRead*            pkt_cmd_osread;
+    AaruPacketCmdResume*            pkt_cmd_resume;
+    AaruPacketCmdShmSetup*          pkt_cmd_shm;
+    AaruPacketResOsRead*            pkt_res_osread;
+    int                             ret;
+    struct DeviceInfoList*          device_info_list;
+    uint32_t                        duration;
+    uint32_t                        sdhci_response[4];
+    uint32_t                        sense;
+    uint32_t                        sense_len;
+    uint32_t                        n;
+    uint8_t                         modified;
+    void*                           cli_ctx;
+    void*                           device_ctx;
+    void*                           resume_ctx;
+    long                            off;
+    MmcSingleCommand*               multi_sdhci_commands;
+    NetIoVec                        iov[3];
+    NetIoVec*                       multi_iov;
+
+    cli_ctx    = client->net_ctx;
+    device_ctx = client->device_ctx;
+    pkt_nop    = client->pkt_nop;
+    in_buf     = client->rx_buf + client->rx_off;
+    pkt_hdr    = (AaruPacketHeader*)in_buf;
+
+    // Handlers work on the packet in place, it is consumed once they return
+    client->rx_off += le32toh(pkt_hdr->len);
+    client->packets++;
+
+    // Whatever the previous packet took from the arena has been sent already
+    ArenaReset(&client->arena);
+
+    // Tags are echoed untouched, so their byte order does not matter
+    client->tag = client->protocol >= AARUREMOTE_PROTOCOL_TAGS ? pkt_hdr->tag : 0;
+
+    if(pkt_hdr->version != AARUREMOTE_PACKET_VERSION)
+    {
+        printf("Unrecognized packet version, skipping...\n");
+        return 0;
+    }
+
+    switch(pkt_hdr->packet_type)
+    {
+        case AARUREMOTE_PACKET_TYPE_HELLO:
+            pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_OOO;
+            memset(&pkt_nop->reason, 0, 256);
+            strncpy(pkt_nop->reason, "Received hello packet out of order, skipping...", 256);
+            SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+            printf("%s...\n", pkt_nop->reason);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_LIST_DEVICES:
+            device_info_list = ListDevices();
+
+            if(!device_info_list)
+            {
+                pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_ERROR_LIST_DEVICES;
+                memset(&pkt_nop->reason, 0, 256);
+                strncpy(pkt_nop->reason, "Could not get device list, continuing...", 256);
+                SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+                printf("%s...\n", pkt_nop->reason);
+                return 0;
+            }
+
+            pkt_res_devinfo          = ArenaAlloc(&client->arena, sizeof(AaruPacketResListDevs));
+            pkt_res_devinfo->devices = htole16(DeviceInfoListCount(device_info_list));
+
+            n      = sizeof(AaruPacketResListDevs) + le16toh(pkt_res_devinfo->devices) * sizeof(DeviceInfo);
+            in_buf = ArenaAlloc(&client->arena, n);
+            ((AaruPacketResListDevs*)in_buf)->hdr.len = htole32(n);
+            ((AaruPacketResListDevs*)in_buf)->devices = pkt_res_devinfo->devices;
+            pkt_res_devinfo = (AaruPacketResListDevs*)in_buf;
+
+            pkt_res_devinfo->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_devinfo->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_res_devinfo->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_devinfo->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_LIST_DEVICES;
+
+            // Save list start
+            in_buf = (char*)device_info_list;
+            off    = sizeof(AaruPacketResListDevs);
+
+            while(device_info_list)
+            {
+                memcpy(((char*)pkt_res_devinfo) + off, &device_info_list->this, sizeof(DeviceInfo));
+                device_info_list = device_info_list->next;
+                off += sizeof(DeviceInfo);
+            }
+
+            device_info_list = (struct DeviceInfoList*)in_buf;
+            FreeDeviceInfoList(device_info_list);
+
+            SendResponse(client, pkt_res_devinfo, le32toh(pkt_res_devinfo->hdr.len));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_SDHCI_REGISTERS:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_LIST_DEVICES:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_CHS:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_28:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_48:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_SDHCI:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_DEVTYPE:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_USB_DATA:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_FIREWIRE_DATA:
+        case AARUREMOTE_PACKET_TYPE_RESPONSE_GET_PCMCIA_DATA:
+            pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_OOO;
+            memset(&pkt_nop->reason, 0, 256);
+            strncpy(pkt_nop->reason, "Received response packet?! You should certainly not do that...", 256);
+            SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+            printf("%s...\n", pkt_nop->reason);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_OPEN_DEVICE:
+            pkt_dev_open = (AaruPacketCmdOpen*)in_buf;
+
+            // Do not leak a device the client forgot to close
+            DropDeviceCaches(client);
+
+            if(device_ctx) DeviceClose(device_ctx);
+
+            device_ctx         = DeviceOpen(pkt_dev_open->device_path);
+            client->device_ctx = device_ctx;
+
+            pkt_nop->reason_code = device_ctx == NULL ? AARUREMOTE_PACKET_NOP_REASON_OPEN_ERROR
+                                                      : AARUREMOTE_PACKET_NOP_REASON_OPEN_OK;
+            pkt_nop->error_no    = errno;
+            memset(&pkt_nop->reason, 0, 256);
+            SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_GET_DEVTYPE:
+            pkt_dev_type = ArenaAlloc(&client->arena, sizeof(AaruPacketResGetDeviceType));
+
+            if(!pkt_dev_type)
+            {
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(pkt_dev_type, 0, sizeof(AaruPacketResGetDeviceType));
+
+            pkt_dev_type->hdr.len         = htole32(sizeof(AaruPacketResGetDeviceType));
+            pkt_dev_type->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_DEVTYPE;
+            pkt_dev_type->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_dev_type->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_dev_type->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_dev_type->device_type     = htole32(GetDeviceType(device_ctx));
+
+            SendResponse(client, pkt_dev_type, sizeof(AaruPacketResGetDeviceType));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_SCSI:
+            pkt_cmd_scsi = (AaruPacketCmdScsi*)in_buf;
+
+            // Buffers are used in place, they must not overrun into the next packet
+            if(sizeof(AaruPacketCmdScsi) + (uint64_t)le32toh(pkt_cmd_scsi->cdb_len) + le32toh(pkt_cmd_scsi->buf_len) >
+               le32toh(pkt_hdr->len))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            if(le32toh(pkt_cmd_scsi->cdb_len) > 0) cdb_buf = in_buf + sizeof(AaruPacketCmdScsi);
+            else
+                cdb_buf = NULL;
+
+            if(le32toh(pkt_cmd_scsi->buf_len) > 0)
+                buffer = in_buf + le32toh(pkt_cmd_scsi->cdb_len) + sizeof(AaruPacketCmdScsi);
+            else
+                buffer = NULL;
+
+            buffer = ClientDmaBuffer(client,
+                                     buffer,
+                                     le32toh(pkt_cmd_scsi->buf_len),
+                                     le32toh(pkt_cmd_scsi->direction) == AARUREMOTE_SCSI_DIRECTION_IN);
+
+            // Swap buf_len
+            pkt_cmd_scsi->buf_len = le32toh(pkt_cmd_scsi->buf_len);
+            sense_len             = sizeof(sense_buf);
+
+            ret = ClientScsiCommand(client,
+                                    cdb_buf,
+                                    buffer,
+                                    sense_buf,
+                                    le32toh(pkt_cmd_scsi->timeout),
+                                    le32toh(pkt_cmd_scsi->direction),
+                                    &duration,
+                                    &sense,
+                                    le32toh(pkt_cmd_scsi->cdb_len),
+                                    &pkt_cmd_scsi->buf_len,
+                                    &sense_len);
+
+            // Swap buf_len back
+            pkt_cmd_scsi->buf_len = htole32(pkt_cmd_scsi->buf_len);
+
+            out_buf = ArenaAlloc(&client->arena, sizeof(AaruPacketResScsi));
+
+            if(!out_buf)
+            {
+                printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
+                return -1;
+            }
+
+            pkt_res_scsi = (AaruPacketResScsi*)out_buf;
+
+            pkt_res_scsi->hdr.len =
+                htole32(sizeof(AaruPacketResScsi) + sense_len + le32toh(pkt_cmd_scsi->buf_len));
+            pkt_res_scsi->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SCSI;
+            pkt_res_scsi->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_scsi->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_scsi->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+
+            pkt_res_scsi->sense_len = htole32(sense_len);
+            pkt_res_scsi->buf_len   = pkt_cmd_scsi->buf_len;
+            pkt_res_scsi->duration  = htole32(duration);
+            pkt_res_scsi->sense     = htole32(sense);
+            pkt_res_scsi->error_no  = htole32(ret);
+
+            // Sense and data go out from where the device left them
+            iov[0].buf = pkt_res_scsi;
+            iov[0].len = sizeof(AaruPacketResScsi);
+            iov[1].buf = sense_buf;
+            iov[1].len = sense_len;
+            iov[2].buf = buffer;
+            iov[2].len = buffer ? le32toh(pkt_cmd_scsi->buf_len) : 0;
+
+            SendResponsev(client, iov, 3);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_GET_SDHCI_REGISTERS:
+            pkt_res_sdhci_registers = ArenaAlloc(&client->arena, sizeof(AaruPacketResGetSdhciRegisters));
+            if(!pkt_res_sdhci_registers)
+            {
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(pkt_res_sdhci_registers, 0, sizeof(AaruPacketResGetSdhciRegisters));
+            pkt_res_sdhci_registers->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_sdhci_registers->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_res_sdhci_registers->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_sdhci_registers->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_SDHCI_REGISTERS;
+            pkt_res_sdhci_registers->hdr.len         = htole32(sizeof(AaruPacketResGetSdhciRegisters));
+            pkt_res_sdhci_registers->is_sdhci        = GetSdhciRegisters(device_ctx,
+                                                                         &csd,
+                                                                         &cid,
+                                                                         &ocr,
+                                                                         &scr,
+                                                                         &pkt_res_sdhci_registers->csd_len,
+                                                                         &pkt_res_sdhci_registers->cid_len,
+                                                                         &pkt_res_sdhci_registers->ocr_len,
+                                                                         &pkt_res_sdhci_registers->scr_len);
+
+            if(pkt_res_sdhci_registers->csd_len > 0 && csd != NULL)
+            {
+                if(pkt_res_sdhci_registers->csd_len > 16) pkt_res_sdhci_registers->csd_len = 16;
+
+                memcpy(pkt_res_sdhci_registers->csd, csd, pkt_res_sdhci_registers->csd_len);
+            }
+            if(pkt_res_sdhci_registers->cid_len > 0 && cid != NULL)
+            {
+                if(pkt_res_sdhci_registers->cid_len > 16) pkt_res_sdhci_registers->cid_len = 16;
+
+                memcpy(pkt_res_sdhci_registers->cid, cid, pkt_res_sdhci_registers->cid_len);
+            }
+            if(pkt_res_sdhci_registers->ocr_len > 0 && ocr != NULL)
+            {
+                if(pkt_res_sdhci_registers->ocr_len > 4) pkt_res_sdhci_registers->ocr_len = 4;
+
+                memcpy(pkt_res_sdhci_registers->ocr, ocr, pkt_res_sdhci_registers->ocr_len);
+            }
+            if(pkt_res_sdhci_registers->scr_len > 0 && scr != NULL)
+            {
+                if(pkt_res_sdhci_registers->scr_len > 8) pkt_res_sdhci_registers->scr_len = 8;
+
+                memcpy(pkt_res_sdhci_registers->scr, scr, pkt_res_sdhci_registers->scr_len);
+            }
+
+            // Swap lengths
+            pkt_res_sdhci_registers->csd_len = htole32(pkt_res_sdhci_registers->csd_len);
+            pkt_res_sdhci_registers->cid_len = htole32(pkt_res_sdhci_registers->cid_len);
+            pkt_res_sdhci_registers->ocr_len = htole32(pkt_res_sdhci_registers->ocr_len);
+            pkt_res_sdhci_registers->scr_len = htole32(pkt_res_sdhci_registers->scr_len);
+
+            free(csd);
+            free(cid);
+            free(scr);
+            free(ocr);
+
+            SendResponse(client, pkt_res_sdhci_registers, le32toh(pkt_res_sdhci_registers->hdr.len));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_GET_USB_DATA:
+            pkt_res_usb = ArenaAlloc(&client->arena, sizeof(AaruPacketResGetUsbData));
+            if(!pkt_res_usb)
+            {
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(pkt_res_usb, 0, sizeof(AaruPacketResGetUsbData));
+            pkt_res_usb->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_usb->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_res_usb->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_usb->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_USB_DATA;
+            pkt_res_usb->hdr.len         = htole32(sizeof(AaruPacketResGetUsbData));
+            pkt_res_usb->is_usb          = GetUsbData(device_ctx,
+                                                      &pkt_res_usb->desc_len,
+                                                      pkt_res_usb->descriptors,
+                                                      &pkt_res_usb->id_vendor,
+                                                      &pkt_res_usb->id_product,
+                                                      pkt_res_usb->manufacturer,
+                                                      pkt_res_usb->product,
+                                                      pkt_res_usb->serial);
+
+            // Swap parameters
+            pkt_res_usb->desc_len = htole32(pkt_res_usb->desc_len);
+            // TODO: Need to swap vendor, product?
+
+            SendResponse(client, pkt_res_usb, le32toh(pkt_res_usb->hdr.len));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_GET_FIREWIRE_DATA:
+            pkt_res_firewire = ArenaAlloc(&client->arena, sizeof(AaruPacketResGetFireWireData));
+            if(!pkt_res_firewire)
+            {
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(pkt_res_firewire, 0, sizeof(AaruPacketResGetFireWireData));
+            pkt_res_firewire->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_firewire->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_res_firewire->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_firewire->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_FIREWIRE_DATA;
+            pkt_res_firewire->hdr.len         = htole32(sizeof(AaruPacketResGetFireWireData));
+            pkt_res_firewire->is_firewire     = GetFireWireData(device_ctx,
+                                                                &pkt_res_firewire->id_model,
+                                                                &pkt_res_firewire->id_vendor,
+                                                                &pkt_res_firewire->guid,
+                                                                pkt_res_firewire->vendor,
+                                                                pkt_res_firewire->model);
+
+            // TODO: Need to swap IDs?
+
+            SendResponse(client, pkt_res_firewire, le32toh(pkt_res_firewire->hdr.len));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_GET_PCMCIA_DATA:
+            pkt_res_pcmcia = ArenaAlloc(&client->arena, sizeof(AaruPacketResGetPcmciaData));
+            if(!pkt_res_pcmcia)
+            {
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(pkt_res_pcmcia, 0, sizeof(AaruPacketResGetPcmciaData));
+            pkt_res_pcmcia->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_pcmcia->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_res_pcmcia->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_pcmcia->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_GET_PCMCIA_DATA;
+            pkt_res_pcmcia->hdr.len         = htole32(sizeof(AaruPacketResGetPcmciaData));
+            pkt_res_pcmcia->is_pcmcia =
+                GetPcmciaData(device_ctx, &pkt_res_pcmcia->cis_len, pkt_res_pcmcia->cis);
+
+            pkt_res_pcmcia->cis_len = htole32(pkt_res_pcmcia->cis_len);
+
+            SendResponse(client, pkt_res_pcmcia, le32toh(pkt_res_pcmcia->hdr.len));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_ATA_CHS:
+            pkt_cmd_ata_chs = (AaruPacketCmdAtaChs*)in_buf;
+
+            // Buffers are used in place, they must not overrun into the next packet
+            if(sizeof(AaruPacketCmdAtaChs) + (uint64_t)le32toh(pkt_cmd_ata_chs->buf_len) > le32toh(pkt_hdr->len))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            if(le32toh(pkt_cmd_ata_chs->buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdAtaChs);
+            else
+                buffer = NULL;
+
+            buffer = ClientDmaBuffer(
+                client, buffer, le32toh(pkt_cmd_ata_chs->buf_len), AtaProtocolReads(pkt_cmd_ata_chs->protocol));
+
+            memset(&ata_chs_error_regs, 0, sizeof(AtaErrorRegistersChs));
+
+            pkt_cmd_ata_chs->buf_len = le32toh(pkt_cmd_ata_chs->buf_len);
+
+            ScsiCacheLockDevice(client->scsi_cache);
+
+            duration = 0;
+            sense    = 1;
+            ret      = SendAtaChsCommand(device_ctx,
+                                         pkt_cmd_ata_chs->registers,
+                                         &ata_chs_error_regs,
+                                         pkt_cmd_ata_chs->protocol,
+                                         pkt_cmd_ata_chs->transfer_register,
+                                         buffer,
+                                         le32toh(pkt_cmd_ata_chs->timeout),
+                                         pkt_cmd_ata_chs->transfer_blocks,
+                                         &duration,
+                                         &sense,
+                                         &pkt_cmd_ata_chs->buf_len);
+
+            // Anything but a read may write, erase or reset the medium
+            ScsiCacheUnlockDevice(client->scsi_cache, !AtaProtocolReads(pkt_cmd_ata_chs->protocol));
+
+            out_buf = ArenaAlloc(&client->arena, sizeof(AaruPacketResAtaChs));
+
+            pkt_cmd_ata_chs->buf_len = htole32(pkt_cmd_ata_chs->buf_len);
+
+            if(!out_buf)
+            {
+                printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
+                return -1;
+            }
+
+            pkt_res_ata_chs = (AaruPacketResAtaChs*)out_buf;
+
+            pkt_res_ata_chs->hdr.len = htole32(sizeof(AaruPacketResAtaChs) + htole32(pkt_cmd_ata_chs->buf_len));
+            pkt_res_ata_chs->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_CHS;
+            pkt_res_ata_chs->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_ata_chs->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_ata_chs->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+
+            pkt_res_ata_chs->registers = ata_chs_error_regs;
+            pkt_res_ata_chs->buf_len   = pkt_cmd_ata_chs->buf_len;
+            pkt_res_ata_chs->duration  = htole32(duration);
+            pkt_res_ata_chs->sense     = htole32(sense);
+            pkt_res_ata_chs->error_no  = htole32(ret);
+
+            iov[0].buf = pkt_res_ata_chs;
+            iov[0].len = sizeof(AaruPacketResAtaChs);
+            iov[1].buf = buffer;
+            iov[1].len = buffer ? le32toh(pkt_cmd_ata_chs->buf_len) : 0;
+
+            SendResponsev(client, iov, 2);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_ATA_LBA_28:
+            pkt_cmd_ata_lba28 = (AaruPacketCmdAtaLba28*)in_buf;
+
+            // Buffers are used in place, they must not overrun into the next packet
+            if(sizeof(AaruPacketCmdAtaLba28) + (uint64_t)le32toh(pkt_cmd_ata_lba28->buf_len) > le32toh(pkt_hdr->len))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            if(le32toh(pkt_cmd_ata_lba28->buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdAtaLba28);
+            else
+                buffer = NULL;
+
+            buffer = ClientDmaBuffer(
+                client, buffer, le32toh(pkt_cmd_ata_lba28->buf_len), AtaProtocolReads(pkt_cmd_ata_lba28->protocol));
+
+            memset(&ata_lba28_error_regs, 0, sizeof(AtaErrorRegistersLba28));
+
+            pkt_cmd_ata_lba28->buf_len = le32toh(pkt_cmd_ata_lba28->buf_len);
+
+            ScsiCacheLockDevice(client->scsi_cache);
+
+            duration = 0;
+            sense    = 1;
+            ret      = SendAtaLba28Command(device_ctx,
+                                           pkt_cmd_ata_lba28->registers,
+                                           &ata_lba28_error_regs,
+                                           pkt_cmd_ata_lba28->protocol,
+                                           pkt_cmd_ata_lba28->transfer_register,
+                                           buffer,
+                                           le32toh(pkt_cmd_ata_lba28->timeout),
+                                           pkt_cmd_ata_lba28->transfer_blocks,
+                                           &duration,
+                                           &sense,
+                                           &pkt_cmd_ata_lba28->buf_len);
+
+            // Anything but a read may write, erase or reset the medium
+            ScsiCacheUnlockDevice(client->scsi_cache, !AtaProtocolReads(pkt_cmd_ata_lba28->protocol));
+
+            out_buf                    = ArenaAlloc(&client->arena, sizeof(AaruPacketResAtaLba28));
+            pkt_cmd_ata_lba28->buf_len = htole32(pkt_cmd_ata_lba28->buf_len);
+
+            if(!out_buf)
+            {
+                printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
+                return -1;
+            }
+
+            pkt_res_ata_lba28 = (AaruPacketResAtaLba28*)out_buf;
+
+            pkt_res_ata_lba28->hdr.len =
+                htole32(sizeof(AaruPacketResAtaLba28) + le32toh(pkt_cmd_ata_lba28->buf_len));
+            pkt_res_ata_lba28->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_28;
+            pkt_res_ata_lba28->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_ata_lba28->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_ata_lba28->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+
+            pkt_res_ata_lba28->registers = ata_lba28_error_regs;
+            pkt_res_ata_lba28->buf_len   = pkt_cmd_ata_lba28->buf_len;
+            pkt_res_ata_lba28->duration  = le32toh(duration);
+            pkt_res_ata_lba28->sense     = le32toh(sense);
+            pkt_res_ata_lba28->error_no  = le32toh(ret);
+
+            iov[0].buf = pkt_res_ata_lba28;
+            iov[0].len = sizeof(AaruPacketResAtaLba28);
+            iov[1].buf = buffer;
+            iov[1].len = buffer ? le32toh(pkt_cmd_ata_lba28->buf_len) : 0;
+
+            SendResponsev(client, iov, 2);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_ATA_LBA_48:
+            pkt_cmd_ata_lba48 = (AaruPacketCmdAtaLba48*)in_buf;
+
+            // Buffers are used in place, they must not overrun into the next packet
+            if(sizeof(AaruPacketCmdAtaLba48) + (uint64_t)le32toh(pkt_cmd_ata_lba48->buf_len) > le32toh(pkt_hdr->len))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            if(le32toh(pkt_cmd_ata_lba48->buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdAtaLba48);
+            else
+                buffer = NULL;
+
+            buffer = ClientDmaBuffer(
+                client, buffer, le32toh(pkt_cmd_ata_lba48->buf_len), AtaProtocolReads(pkt_cmd_ata_lba48->protocol));
+
+            memset(&ata_lba48_error_regs, 0, sizeof(AtaErrorRegistersLba48));
+            pkt_cmd_ata_lba48->buf_len = le32toh(pkt_cmd_ata_lba48->buf_len);
+
+            // Swapping
+            pkt_cmd_ata_lba48->registers.sector_count = le16toh(pkt_cmd_ata_lba48->registers.sector_count);
+
+            ScsiCacheLockDevice(client->scsi_cache);
+
+            duration = 0;
+            sense    = 1;
+            ret      = SendAtaLba48Command(device_ctx,
+                                           pkt_cmd_ata_lba48->registers,
+                                           &ata_lba48_error_regs,
+                                           pkt_cmd_ata_lba48->protocol,
+                                           pkt_cmd_ata_lba48->transfer_register,
+                                           buffer,
+                                           le32toh(pkt_cmd_ata_lba48->timeout),
+                                           pkt_cmd_ata_lba48->transfer_blocks,
+                                           &duration,
+                                           &sense,
+                                           &pkt_cmd_ata_lba48->buf_len);
+
+            // Anything but a read may write, erase or reset the medium
+            ScsiCacheUnlockDevice(client->scsi_cache, !AtaProtocolReads(pkt_cmd_ata_lba48->protocol));
+
+            out_buf                    = ArenaAlloc(&client->arena, sizeof(AaruPacketResAtaLba48));
+            pkt_cmd_ata_lba48->buf_len = htole32(pkt_cmd_ata_lba48->buf_len);
+
+            if(!out_buf)
+            {
+                printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
+                return -1;
+            }
+
+            pkt_res_ata_lba48 = (AaruPacketResAtaLba48*)out_buf;
+
+            pkt_res_ata_lba48->hdr.len =
+                htole32(sizeof(AaruPacketResAtaLba48) + le32toh(pkt_cmd_ata_lba48->buf_len));
+            pkt_res_ata_lba48->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_ATA_LBA_48;
+            pkt_res_ata_lba48->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_ata_lba48->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_ata_lba48->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+
+            // Swapping
+            ata_lba48_error_regs.sector_count = htole16(ata_lba48_error_regs.sector_count);
+
+            pkt_res_ata_lba48->registers = ata_lba48_error_regs;
+            pkt_res_ata_lba48->buf_len   = pkt_cmd_ata_lba48->buf_len;
+            pkt_res_ata_lba48->duration  = le32toh(duration);
+            pkt_res_ata_lba48->sense     = le32toh(sense);
+            pkt_res_ata_lba48->error_no  = le32toh(ret);
+
+            iov[0].buf = pkt_res_ata_lba48;
+            iov[0].len = sizeof(AaruPacketResAtaLba48);
+            iov[1].buf = buffer;
+            iov[1].len = buffer ? le32toh(pkt_cmd_ata_lba48->buf_len) : 0;
+
+            SendResponsev(client, iov, 2);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_SDHCI:
+            pkt_cmd_sdhci = (AaruPacketCmdSdhci*)in_buf;
+
+            // Buffers are used in place, they must not overrun into the next packet
+            if(sizeof(AaruPacketCmdSdhci) + (uint64_t)le32toh(pkt_cmd_sdhci->command.buf_len) > le32toh(pkt_hdr->len))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            if(le32toh(pkt_cmd_sdhci->command.buf_len) > 0) buffer = in_buf + sizeof(AaruPacketCmdSdhci);
+            else
+                buffer = NULL;
+
+            memset((char*)&sdhci_response, 0, sizeof(uint32_t) * 4);
+
+            ScsiCacheLockDevice(client->scsi_cache);
+
+            duration = 0;
+            sense    = 1;
+            ret      = SendSdhciCommand(device_ctx,
+                                        pkt_cmd_sdhci->command.command,
+                                        pkt_cmd_sdhci->command.write,
+                                        pkt_cmd_sdhci->command.application,
+                                        le32toh(pkt_cmd_sdhci->command.flags),
+                                        le32toh(pkt_cmd_sdhci->command.argument),
+                                        le32toh(pkt_cmd_sdhci->command.block_size),
+                                        le32toh(pkt_cmd_sdhci->command.blocks),
+                                        buffer,
+                                        le32toh(pkt_cmd_sdhci->command.buf_len),
+                                        le32toh(pkt_cmd_sdhci->command.timeout),
+                                        (uint32_t*)&sdhci_response,
+                                        &duration,
+                                        &sense);
+
+            ScsiCacheUnlockDevice(client->scsi_cache, pkt_cmd_sdhci->command.write);
+
+            out_buf = ArenaAlloc(&client->arena, sizeof(AaruPacketResSdhci));
+
+            if(!out_buf)
+            {
+                printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
+                return -1;
+            }
+
+            pkt_res_sdhci = (AaruPacketResSdhci*)out_buf;
+
+            pkt_res_sdhci->hdr.len =
+                htole32(sizeof(AaruPacketResSdhci) + le32toh(pkt_cmd_sdhci->command.buf_len));
+            pkt_res_sdhci->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_SDHCI;
+            pkt_res_sdhci->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_sdhci->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_sdhci->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+
+            sdhci_response[0] = htole32(sdhci_response[0]);
+            sdhci_response[1] = htole32(sdhci_response[1]);
+            sdhci_response[2] = htole32(sdhci_response[2]);
+            sdhci_response[3] = htole32(sdhci_response[3]);
+
+            memcpy((char*)&pkt_res_sdhci->res.response, (char*)&sdhci_response, sizeof(uint32_t) * 4);
+            pkt_res_sdhci->res.buf_len  = pkt_cmd_sdhci->command.buf_len;
+            pkt_res_sdhci->res.duration = htole32(duration);
+            pkt_res_sdhci->res.sense    = htole32(sense);
+            pkt_res_sdhci->res.error_no = htole32(ret);
+
+            iov[0].buf = pkt_res_sdhci;
+            iov[0].len = sizeof(AaruPacketResSdhci);
+            iov[1].buf = buffer;
+            iov[1].len = buffer ? le32toh(pkt_cmd_sdhci->command.buf_len) : 0;
+
+            SendResponsev(client, iov, 2);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_CLOSE_DEVICE:
+            DropDeviceCaches(client);
+            DeviceClose(device_ctx);
+            device_ctx         = NULL;
+            client->device_ctx = NULL;
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_AM_I_ROOT:
+            pkt_res_am_i_root = ArenaAlloc(&client->arena, sizeof(AaruPacketResAmIRoot));
+            if(!pkt_res_am_i_root)
+            {
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(pkt_res_am_i_root, 0, sizeof(AaruPacketResAmIRoot));
+            pkt_res_am_i_root->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_am_i_root->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_res_am_i_root->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_am_i_root->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_AM_I_ROOT;
+            pkt_res_am_i_root->hdr.len         = htole32(sizeof(AaruPacketResAmIRoot));
+            pkt_res_am_i_root->am_i_root       = AmIRoot();
+
+            SendResponse(client, pkt_res_am_i_root, le32toh(pkt_res_am_i_root->hdr.len));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_SDHCI:
+            pkt_cmd_multi_sdhci = (AaruPacketMultiCmdSdhci*)in_buf;
+
+            pkt_cmd_multi_sdhci->cmd_count = le64toh(pkt_cmd_multi_sdhci->cmd_count);
+
+            // Buffers are used in place, they must not overrun into the next packet
+            if(le32toh(pkt_hdr->len) < sizeof(AaruPacketMultiCmdSdhci) ||
+               pkt_cmd_multi_sdhci->cmd_count >
+                   (le32toh(pkt_hdr->len) - sizeof(AaruPacketMultiCmdSdhci)) / sizeof(AaruCmdSdhci))
+            {
+                printf("Packet is smaller than its commands, closing connection...\n");
+                return -1;
+            }
+
+            multi_sdhci_commands =
+                ArenaAlloc(&client->arena, sizeof(MmcSingleCommand) * pkt_cmd_multi_sdhci->cmd_count);
+
+            if(!multi_sdhci_commands)
+            {
+                printf("Fatal error %d allocating memory for commands, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(multi_sdhci_commands, 0, sizeof(MmcSingleCommand) * pkt_cmd_multi_sdhci->cmd_count);
+
+            for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
+            {
+                multi_sdhci_commands[n].argument    = le32toh(pkt_cmd_multi_sdhci->commands[n].argument);
+                multi_sdhci_commands[n].block_size  = le32toh(pkt_cmd_multi_sdhci->commands[n].block_size);
+                multi_sdhci_commands[n].blocks      = le32toh(pkt_cmd_multi_sdhci->commands[n].blocks);
+                multi_sdhci_commands[n].command     = pkt_cmd_multi_sdhci->commands[n].command;
+                multi_sdhci_commands[n].flags       = le32toh(pkt_cmd_multi_sdhci->commands[n].flags);
+                multi_sdhci_commands[n].application = pkt_cmd_multi_sdhci->commands[n].application;
+                multi_sdhci_commands[n].write       = pkt_cmd_multi_sdhci->commands[n].write;
+                multi_sdhci_commands[n].buf_len     = le32toh(pkt_cmd_multi_sdhci->commands[n].buf_len);
+            }
+
+            off = (long)(sizeof(AaruPacketMultiCmdSdhci) +
+                         (sizeof(AaruCmdSdhci) * pkt_cmd_multi_sdhci->cmd_count));
+
+            for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
+            {
+                multi_sdhci_commands[n].buffer = (char*)pkt_cmd_multi_sdhci + off;
+                off += multi_sdhci_commands[n].buf_len;
+            }
+
+            if(off > (long)le32toh(pkt_hdr->len))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            modified = 0;
+
+            for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++) modified |= multi_sdhci_commands[n].write;
+
+            ScsiCacheLockDevice(client->scsi_cache);
+            ret = SendMultiSdhciCommand(
+                device_ctx, pkt_cmd_multi_sdhci->cmd_count, multi_sdhci_commands, &duration, &sense);
+            ScsiCacheUnlockDevice(client->scsi_cache, modified);
+
+            off =
+                (long)(sizeof(AaruPacketMultiResSdhci) + sizeof(AaruResSdhci) * pkt_cmd_multi_sdhci->cmd_count);
+
+            out_buf   = ArenaAlloc(&client->arena, off);
+            multi_iov = ArenaAlloc(&client->arena, sizeof(NetIoVec) * (pkt_cmd_multi_sdhci->cmd_count + 1));
+
+            if(!out_buf || !multi_iov)
+            {
+                printf("Fatal error %d allocating memory for packet, continuing...\n", errno);
+                return -1;
+            }
+
+            multi_iov[0].buf = out_buf;
+            multi_iov[0].len = off;
+
+            for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
+            {
+                multi_iov[n + 1].buf = multi_sdhci_commands[n].buffer;
+                multi_iov[n + 1].len = multi_sdhci_commands[n].buf_len;
+                off += multi_sdhci_commands[n].buf_len;
+            }
+
+            pkt_res_multi_sdhci = (AaruPacketMultiResSdhci*)out_buf;
+
+            pkt_res_multi_sdhci->hdr.len         = htole32(off);
+            pkt_res_multi_sdhci->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_MULTI_SDHCI;
+            pkt_res_multi_sdhci->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_multi_sdhci->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_multi_sdhci->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+            pkt_res_multi_sdhci->cmd_count       = htole64(pkt_cmd_multi_sdhci->cmd_count);
+
+            for(n = 0; n < pkt_cmd_multi_sdhci->cmd_count; n++)
+            {
+                pkt_res_multi_sdhci->responses[n].duration    = htole32(duration);
+                pkt_res_multi_sdhci->responses[n].error_no    = htole32(ret);
+                pkt_res_multi_sdhci->responses[n].sense       = htole32(sense);
+                pkt_res_multi_sdhci->responses[n].buf_len     = htole32(multi_sdhci_commands[n].buf_len);
+                pkt_res_multi_sdhci->responses[n].response[0] = htole32(multi_sdhci_commands[n].response[0]);
+                pkt_res_multi_sdhci->responses[n].response[1] = htole32(multi_sdhci_commands[n].response[1]);
+                pkt_res_multi_sdhci->responses[n].response[2] = htole32(multi_sdhci_commands[n].response[2]);
+                pkt_res_multi_sdhci->responses[n].response[3] = htole32(multi_sdhci_commands[n].response[3]);
+            }
+
+            SendResponsev(client, multi_iov, (int32_t)pkt_cmd_multi_sdhci->cmd_count + 1);
+
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_SCSI:
+            return MultiScsiCommand(client, (AaruPacketMultiCmdScsi*)in_buf);
+        case AARUREMOTE_PACKET_TYPE_MULTI_COMMAND_OSREAD:
+            return MultiOsRead(client, (AaruPacketMultiCmdOsRead*)in_buf);
+        case AARUREMOTE_PACKET_TYPE_COMMAND_SCSI_READ_STREAM:
+            if(le32toh(pkt_hdr->len) < sizeof(AaruPacketCmdScsiReadStream))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            return StreamScsiRead(client, (AaruPacketCmdScsiReadStream*)in_buf);
+        case AARUREMOTE_PACKET_TYPE_COMMAND_SCSI_RECOVER:
+            if(le32toh(pkt_hdr->len) < sizeof(AaruPacketCmdScsiRecover))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            return RecoverScsiRead(client, (AaruPacketCmdScsiRecover*)in_buf);
+        case AARUREMOTE_PACKET_TYPE_COMMAND_HASH:
+            if(le32toh(pkt_hdr->len) < sizeof(AaruPacketCmdHash))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            return HashRead(client, (AaruPacketCmdHash*)in_buf);
+        case AARUREMOTE_PACKET_TYPE_COMMAND_DEVICE:
+            return DeviceHandleCommand(client, (AaruPacketCmdDevice*)in_buf);
+        case AARUREMOTE_PACKET_TYPE_COMMAND_REOPEN:
+            // A reopened device may hold another medium
+            DropDeviceCaches(client);
+
+            ret = ReOpen(device_ctx, &sense);
+            memset(&pkt_nop->reason, 0, 256);
+
+            if(ret)
+            {
+                pkt_nop->error_no = htole32(ret);
+
+                // Error on close
+                if(sense != 0) pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_CLOSE_ERROR;
+                else
+                    pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_OPEN_ERROR;
+            }
+            else
+            {
+                pkt_nop->error_no    = 0;
+                pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_REOPEN_OK;
+            }
+
+            SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_RESUME:
+            pkt_cmd_resume = (AaruPacketCmdResume*)in_buf;
+
+            if(le32toh(pkt_hdr->len) < sizeof(AaruPacketCmdResume))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            // Tokens are echoed untouched, so their byte order does not matter
+            resume_ctx = ResumeSession(pkt_cmd_resume->token);
+
+            if(resume_ctx)
+            {
+                DropDeviceCaches(client);
+
+                if(device_ctx) DeviceClose(device_ctx);
+
+                device_ctx         = resume_ctx;
+                client->device_ctx = device_ctx;
+                printf("Client %s resumed a previous session.\n", client->address);
+            }
+
+            pkt_nop->reason_code = resume_ctx == NULL ? AARUREMOTE_PACKET_NOP_REASON_RESUME_ERROR
+                                                      : AARUREMOTE_PACKET_NOP_REASON_RESUME_OK;
+            pkt_nop->error_no    = 0;
+            memset(&pkt_nop->reason, 0, 256);
+            SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_SHM_SETUP:
+            pkt_cmd_shm = (AaruPacketCmdShmSetup*)in_buf;
+
+            if(le32toh(pkt_hdr->len) < sizeof(AaruPacketCmdShmSetup))
+            {
+                printf("Packet is smaller than its buffers, closing connection...\n");
+                return -1;
+            }
+
+            if(SetupShm(client, le32toh(pkt_cmd_shm->size)) == 0) return 0;
+
+            pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_SHM_ERROR;
+            pkt_nop->error_no    = errno;
+            memset(&pkt_nop->reason, 0, 256);
+            strncpy(pkt_nop->reason, "Could not set up shared memory, continuing...", 256);
+            SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+            printf("%s...\n", pkt_nop->reason);
+            return 0;
+        case AARUREMOTE_PACKET_TYPE_COMMAND_OSREAD:
+            pkt_cmd_osread = (AaruPacketCmdOsRead*)in_buf;
+
+            // Local clients read the data straight from the ring, when it has room for it
+            ret = client->shm ? ShmOsRead(client, le64toh(pkt_cmd_osread->offset), le32toh(pkt_cmd_osread->length))
+                              : 1;
+
+            if(ret <= 0) return ret;
+
+            out_buf = ArenaAlloc(&client->arena, sizeof(AaruPacketResOsRead));
+
+            if(!out_buf)
+            {
+                printf("Fatal error %d allocating memory for packet, closing connection...\n", errno);
+                return -1;
+            }
+
+            pkt_res_osread = (AaruPacketResOsRead*)out_buf;
+
+            pkt_res_osread->hdr.len = htole32(sizeof(AaruPacketResOsRead) + le32toh(pkt_cmd_osread->length));
+            pkt_res_osread->hdr.packet_type = AARUREMOTE_PACKET_TYPE_RESPONSE_OSREAD;
+            pkt_res_osread->hdr.version     = AARUREMOTE_PACKET_VERSION;
+            pkt_res_osread->hdr.remote_id   = htole32(AARUREMOTE_REMOTE_ID);
+            pkt_res_osread->hdr.packet_id   = htole32(AARUREMOTE_PACKET_ID);
+
+            // Move the data from the device to the socket without copying it when the platform can.
+            // That path sends the header itself, so it needs the tag beforehand.
+            pkt_res_osread->hdr.tag = client->tag;
+
+            // Compressed and sparse responses need the data in memory, local sockets do not splice.
+            // Once there are device handles, their responses could land between the header and the data.
+            // Sequential reads are better served by the read-ahead, that has likely read them already.
+            ret = 0;
+
+            if(!client->compress && !client->sparse && !client->local && !client->send_mutex &&
+               !ReadAheadFollows(ClientReadAhead(client), le64toh(pkt_cmd_osread->offset)))
+            {
+                ReadAheadCancel(client->read_ahead);
+
+                ret = OsReadToNet(device_ctx,
+                                  cli_ctx,
+                                  pkt_res_osread,
+                                  le64toh(pkt_cmd_osread->offset),
+                                  le32toh(pkt_cmd_osread->length));
+
+                if(ret > 0)
+                    ReadAheadSkip(client->read_ahead, le64toh(pkt_cmd_osread->offset), le32toh(pkt_cmd_osread->length));
+            }
+
+            if(ret != 0) return ret < 0 ? -1 : 0;
+
+            if(le32toh(pkt_cmd_osread->length) > AARUREMOTE_STREAM_CHUNK_SIZE &&
+               client->protocol >= AARUREMOTE_PROTOCOL_STREAM)
+            {
+                return StreamOsRead(client, le64toh(pkt_cmd_osread->offset), le32toh(pkt_cmd_osread->length));
+            }
+
+            if(le32toh(pkt_cmd_osread->length) > AARUREMOTE_MAX_PACKET_SIZE)
+            {
+                pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_TOO_LARGE;
+                pkt_nop->error_no    = 0;
+                memset(&pkt_nop->reason, 0, 256);
+                strncpy(pkt_nop->reason, "Requested read is too large, skipping...", 256);
+                SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+                printf("%s...\n", pkt_nop->reason);
+                return 0;
+            }
+
+            buffer = ArenaAlloc(&client->arena, le32toh(pkt_cmd_osread->length));
+
+            if(!buffer)
+            {
+                printf("Fatal error %d allocating memory for buffer, closing connection...\n", errno);
+                return -1;
+            }
+
+            memset(buffer, 0, le32toh(pkt_cmd_osread->length));
+
+            ret = ClientOsRead(client,
+                               buffer,
+                               le64toh(pkt_cmd_osread->offset),
+                               le32toh(pkt_cmd_osread->length),
+                               &duration);
+
+            pkt_res_osread->error_no = htole32(ret);
+            pkt_res_osread->duration = htole32(duration);
+
+            iov[0].buf = pkt_res_osread;
+            iov[0].len = sizeof(AaruPacketResOsRead);
+            iov[1].buf = buffer;
+            iov[1].len = le32toh(pkt_cmd_osread->length);
+
+            SendResponsev(client, iov, 2);
+
+            return 0;
+        default:
+            pkt_nop->reason_code = AARUREMOTE_PACKET_NOP_REASON_NOT_RECOGNIZED;
+            memset(&pkt_nop->reason, 0, 256);
+#ifdef _WIN32
+            sprintf_s(pkt_nop->reason,
+                      256,
+                      "Received unrecognized packet with type %d, skipping...",
+                      pkt_hdr->packet_type);
+#else
+            snprintf(pkt_nop->reason,
+                     256,
+                     "Received unrecognized packet with type %d, skipping...",
+                     pkt_hdr->packet_type);
+#endif
+            SendResponse(client, pkt_nop, sizeof(AaruPacketNop));
+            printf("%s...\n", pkt_nop->reason);
+            return 0;
+    }
 }
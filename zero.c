@@ -0,0 +1,155 @@
+/*
+ * This file is part of the Aaru Remote Server.
+ * Copyright (c) 2019-2021 Natalia Portillo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define AARUREMOTE_ZERO_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(AARUREMOTE_ZERO_SSE2) && defined(__GNUC__)
+#define AARUREMOTE_ZERO_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define AARUREMOTE_ZERO_NEON
+#include <arm_neon.h>
+#endif
+
+#include "aaruremote.h"
+
+typedef int (*IsZeroFunc)(const uint8_t* buf, uint32_t len);
+
+static int IsZeroScalar(const uint8_t* buf, uint32_t len)
+{
+    uint64_t acc = 0;
+    uint64_t word;
+    uint32_t i;
+
+    for(i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        memcpy(&word, buf + i, sizeof(uint64_t));
+        acc |= word;
+    }
+
+    for(; i < len; i++) acc |= buf[i];
+
+    return acc == 0;
+}
+
+#ifdef AARUREMOTE_ZERO_SSE2
+static int IsZeroSse2(const uint8_t* buf, uint32_t len)
+{
+    __m128i  acc = _mm_setzero_si128();
+    uint32_t i;
+
+    for(i = 0; i + 64 <= len; i += 64)
+    {
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(buf + i)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(buf + i + 16)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(buf + i + 32)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(buf + i + 48)));
+    }
+
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) return 0;
+
+    return IsZeroScalar(buf + i, len - i);
+}
+#endif
+
+#ifdef AARUREMOTE_ZERO_AVX2
+__attribute__((target("avx2"))) static int IsZeroAvx2(const uint8_t* buf, uint32_t len)
+{
+    __m256i  acc = _mm256_setzero_si256();
+    uint32_t i;
+
+    for(i = 0; i + 128 <= len; i += 128)
+    {
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i)));
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i + 32)));
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i + 64)));
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i + 96)));
+    }
+
+    if(!_mm256_testz_si256(acc, acc)) return 0;
+
+    return IsZeroSse2(buf + i, len - i);
+}
+#endif
+
+#ifdef AARUREMOTE_ZERO_NEON
+static int IsZeroNeon(const uint8_t* buf, uint32_t len)
+{
+    uint8x16_t acc = vdupq_n_u8(0);
+    uint32_t   i;
+
+    for(i = 0; i + 64 <= len; i += 64)
+    {
+        acc = vorrq_u8(acc, vld1q_u8(buf + i));
+        acc = vorrq_u8(acc, vld1q_u8(buf + i + 16));
+        acc = vorrq_u8(acc, vld1q_u8(buf + i + 32));
+        acc = vorrq_u8(acc, vld1q_u8(buf + i + 48));
+    }
+
+    if(vmaxvq_u8(acc) != 0) return 0;
+
+    return IsZeroScalar(buf + i, len - i);
+}
+#endif
+
+static IsZeroFunc SelectIsZero()
+{
+#ifdef AARUREMOTE_ZERO_AVX2
+    if(__builtin_cpu_supports("avx2")) return IsZeroAvx2;
+#endif
+#if defined(AARUREMOTE_ZERO_SSE2)
+    return IsZeroSse2;
+#elif defined(AARUREMOTE_ZERO_NEON)
+    return IsZeroNeon;
+#else
+    return IsZeroScalar;
+#endif
+}
+
+uint32_t ZeroBlocks(const uint8_t* buf, uint32_t len, uint32_t block_size, uint8_t* map)
+{
+    // Selecting twice from two threads is harmless
+    static IsZeroFunc is_zero = NULL;
+    uint32_t          blocks  = (len + block_size - 1) / block_size;
+    uint32_t          zeroes  = 0;
+    uint32_t          n;
+    uint32_t          size;
+
+    if(!is_zero) is_zero = SelectIsZero();
+
+    memset(map, 0, (blocks + 7) / 8);
+
+    for(n = 0; n < blocks; n++)
+    {
+        size = len - n * block_size < block_size ? len - n * block_size : block_size;
+
+        if(!is_zero(buf + n * block_size, size)) continue;
+
+        map[n / 8] |= (uint8_t)(1 << (n % 8));
+        zeroes++;
+    }
+
+    return zeroes;
+}